@@ -0,0 +1,875 @@
+/*
+ * benchmark.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Host microbenchmarks of firmware functions which run for every frame. Each benchmark is repeated until it ran for
+ * at least the configured time and reports the time per operation and the resulting rate. The neighbor table
+ * benchmarks use a full table (VCP_MAX_NEIGHBORS) and compare against the linear scans it replaced. The receive
+ * ring benchmarks run the producer in a second thread, like the WiFi task on the other core, check that every frame
+ * arrives once and in order and measure the maximum ingest rate. The metrics and trace benchmarks show what recording
+ * a frame costs. The vcp benchmarks run one node in the simulator and hand it the frames of its neighbors. Every line
+ * also shows the heap allocations and packet buffers per operation and can be written as CSV to compare commits.
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "vcp.h"
+#include "neighbor-table.h"
+#include "vcp-message.h"
+#include "receive-ring.h"
+#include "metrics.h"
+#include "trace.h"
+#include "sender-receiver.h"
+#include "link-layer.h"
+#include "packet-pool.h"
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+typedef struct
+{
+    const char *name;
+    uint8_t bytes;                // frame length handled per operation, 0 if not applicable
+    void (*setup)(void);          // optional, runs once before the measurement
+    void (*run)(uint64_t count);  // runs the operation count times
+    void (*report)(void);         // optional, appends results of the last run to the line
+    void (*teardown)(void);       // optional, runs once after the measurement
+} benchmark_t;
+
+typedef struct
+{
+    char name[64];
+    double ns_per_op;
+} baseline_t;
+
+static uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+static uint8_t frame_len;
+static uint8_t payload[ESP_NOW_MAX_DATA_LEN];
+static vcp_message_t message;
+static volatile uint32_t sink; // keeps the compiler from dropping the benchmarked work
+
+#define BENCH_NEIGHBORS 8     // neighbors of the node in the vcp benchmarks, the mean degree of the simulated grid
+#define VCP_BENCH_PAYLOAD 32  // bytes of the DATA messages in the vcp benchmarks if they do not set their own
+#define VCP_OP_US SIM_MS(3)   // virtual time per frame, a DATA frame and its ACK take about 1.5 ms on the air
+#define LOOKUP_KEYS (2 * VCP_MAX_NEIGHBORS) // lookups cycle through these keys, every second one is in the table
+static uint8_t lookup_macs[LOOKUP_KEYS][ESP_NOW_ETH_ALEN];
+static vcp_position_t lookup_positions[LOOKUP_KEYS];
+
+static receive_ring_t ring;
+static atomic_bool producer_done;
+static bool lossless;   // the producer retries a full ring instead of dropping the frame
+static uint64_t popped; // frames the consumer took out of the ring in the last run
+
+static bool sim_running;                           // a vcp benchmark runs its node in the simulator
+static uint8_t vcp_payload_len = VCP_BENCH_PAYLOAD; // bytes of the DATA messages of the running vcp benchmark
+static uint32_t node_pool_allocs;                  // packet buffers the node took from its pool so far
+static vcp_position_t node_position;               // cord position of the node
+static uint16_t neighbor_seq[BENCH_NEIGHBORS + 1]; // next sequence number of the frames of each neighbor
+static uint64_t ops_done;                          // frames handed to the node so far
+
+#define BASELINE_MAX 64
+static baseline_t baseline[BASELINE_MAX]; // results of an earlier run to compare with
+static int baseline_len;
+static FILE *results;                     // machine readable results, one line per benchmark
+
+void app_main(void);
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/* ---- vcp-message.c ---- */
+
+static void setup_hello(void)
+{
+    message = (vcp_message_t){.type = VCP_HELLO};
+    message.hello.position = VCP_END / 2;
+    message.hello.successor = VCP_END / 4 * 3;
+    message.hello.predecessor = VCP_END / 4;
+    vcp_encode(&message, frame, &frame_len);
+}
+
+static void setup_data(void)
+{
+    memset(payload, 'x', sizeof(payload));
+    message = (vcp_message_t){.type = VCP_DATA};
+    message.data.recipient = VCP_END / 2;
+    message.data.source = VCP_END / 4;
+    message.data.payload = payload;
+    message.data.payload_len =
+        ESP_NOW_MAX_DATA_LEN - sizeof(vcp_header_t) - sizeof(uint16_t) - 2 * sizeof(vcp_position_t);
+    vcp_encode(&message, frame, &frame_len);
+}
+
+static void encode(uint64_t count)
+{
+    uint8_t len;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        message.type = frame[1]; // depends on the previous iteration
+        vcp_encode(&message, frame, &len);
+        sink += len;
+    }
+}
+
+static void decode(uint64_t count)
+{
+    vcp_message_t msg;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        vcp_decode(frame, frame_len, &msg);
+        sink += msg.type;
+        frame[2] ^= (uint8_t)sink; // next frame differs from the previous one
+    }
+}
+
+/* ---- neighbor-table.c ---- */
+
+/* Fills the neighbor table completely, half of the lookup keys hit a neighbor */
+static void setup_neighbors(void)
+{
+    srand(1);
+    init_neighbor_table();
+    for (int k = 0; k < LOOKUP_KEYS; k++)
+    {
+        for (int b = 0; b < ESP_NOW_ETH_ALEN; b++)
+        {
+            lookup_macs[k][b] = rand();
+        }
+        lookup_positions[k] = (vcp_position_t)rand() * 2 % VCP_END;
+    }
+    for (int k = 0; k < VCP_MAX_NEIGHBORS; k++)
+    {
+        int8_t n = neighbor_add(lookup_macs[2 * k % LOOKUP_KEYS]);
+        neighbor_set_position(n, lookup_positions[2 * k % LOOKUP_KEYS]);
+    }
+}
+
+/* The flat array scans the neighbor table replaced */
+static int8_t linear_find_addr(const uint8_t addr[ESP_NOW_ETH_ALEN])
+{
+    for (int i = 0; i < neighbors_len; i++)
+    {
+        if (memcmp(neighbors[i].mac_addr, addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int8_t linear_find_pos(vcp_position_t p)
+{
+    for (int i = 0; i < neighbors_len; i++)
+    {
+        if (neighbors[i].position == p)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void find_addr_linear(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sink += linear_find_addr(lookup_macs[i % LOOKUP_KEYS]);
+    }
+}
+
+static void find_addr(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sink += neighbor_find_addr(lookup_macs[i % LOOKUP_KEYS]);
+    }
+}
+
+static void find_pos_linear(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sink += linear_find_pos(lookup_positions[i % LOOKUP_KEYS]);
+    }
+}
+
+static void find_pos(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sink += neighbor_find_pos(lookup_positions[i % LOOKUP_KEYS]);
+    }
+}
+
+static void nearest(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sink += neighbor_nearest_predecessor(lookup_positions[i % LOOKUP_KEYS]);
+        sink += neighbor_nearest_successor(lookup_positions[i % LOOKUP_KEYS]);
+    }
+}
+
+/* What a HELLO of a neighbor which moved on the cord costs */
+static void hello_update(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        int8_t n = neighbor_add(lookup_macs[2 * i % LOOKUP_KEYS]);
+        neighbor_set_position(n, neighbors[n].position ^ 0x10000);
+    }
+}
+
+/* ---- receive-ring.c ---- */
+
+/* The sequence number of a frame travels in the buffer pointer, the other fields are derived from it */
+static void ring_frame(uint64_t seq, q_receive_data_t *frame)
+{
+    frame->data = (uint8_t *)(uintptr_t)seq;
+    frame->data_len = seq;
+    frame->rssi = seq;
+    memcpy(frame->mac_addr, &seq, ESP_NOW_ETH_ALEN);
+}
+
+static bool ring_frame_valid(uint64_t seq, const q_receive_data_t *frame)
+{
+    q_receive_data_t expected;
+
+    ring_frame(seq, &expected);
+    return frame->data_len == expected.data_len && frame->rssi == expected.rssi &&
+           memcmp(frame->mac_addr, expected.mac_addr, ESP_NOW_ETH_ALEN) == 0;
+}
+
+/* The receive callback: pushes count frames as fast as it can */
+static void *ring_producer(void *arg)
+{
+    uint64_t count = *(uint64_t *)arg;
+    q_receive_data_t frame;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        ring_frame(i, &frame);
+        while (!receive_ring_push(&ring, &frame) && lossless)
+        {
+            sched_yield(); // the consumer may share the core
+        }
+    }
+    atomic_store(&producer_done, true);
+    return NULL;
+}
+
+/* The vcp task: empties the ring until the producer is done, every frame has to arrive once and in order */
+static void ring_spsc(uint64_t count)
+{
+    pthread_t producer;
+    q_receive_data_t frame;
+    uint64_t next = 0, seq;
+    bool done;
+
+    receive_ring_init(&ring);
+    atomic_store(&producer_done, false);
+    popped = 0;
+    pthread_create(&producer, NULL, ring_producer, &count);
+    do
+    {
+        done = atomic_load(&producer_done);
+        while (receive_ring_pop(&ring, &frame))
+        {
+            seq = (uintptr_t)frame.data;
+            if (seq < next || seq >= count || (lossless && seq != next) || !ring_frame_valid(seq, &frame))
+            {
+                fprintf(stderr, "receive ring: frame %llu arrived corrupted or out of order, expected %llu\n",
+                        (unsigned long long)seq, (unsigned long long)next);
+                exit(1);
+            }
+            next = seq + 1;
+            popped++;
+        }
+        sched_yield();
+    } while (!done);
+    pthread_join(producer, NULL);
+
+    if (!lossless && popped + ring.stats.dropped != count)
+    {
+        fprintf(stderr, "receive ring: %llu frames popped and %u dropped of %llu\n", (unsigned long long)popped,
+                ring.stats.dropped, (unsigned long long)count);
+        exit(1);
+    }
+}
+
+static void setup_lossy(void)
+{
+    lossless = false;
+}
+
+static void setup_lossless(void)
+{
+    lossless = true;
+}
+
+static void report_ring(void)
+{
+    if (lossless)
+    {
+        printf(" %10.1f full/frame", (double)ring.stats.dropped / popped);
+    }
+    else
+    {
+        printf(" %9.1f %% dropped", 100.0 * ring.stats.dropped / (ring.stats.dropped + popped));
+    }
+}
+
+/* Uncontended cost of handing one frame over */
+static void ring_push_pop(uint64_t count)
+{
+    q_receive_data_t frame;
+
+    receive_ring_init(&ring);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        ring_frame(i, &frame);
+        receive_ring_push(&ring, &frame);
+        receive_ring_pop(&ring, &frame);
+        sink += frame.data_len;
+    }
+}
+
+/* What a forwarded frame records: its receive and handle latencies and two message counters */
+static void metrics_record(uint64_t count)
+{
+    init_metrics();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        metrics_latency(METRICS_STAGE_RECEIVE, (int64_t)(i & 0xffff));
+        metrics_count(VCP_DATA, METRICS_RX);
+        metrics_count(VCP_DATA, METRICS_FORWARD);
+        metrics_latency(METRICS_STAGE_HANDLE, (int64_t)(i & 0xfff));
+    }
+}
+
+/* Recording a received DATA frame of 250 bytes in the packet trace */
+static void trace_frame(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        trace_record((int64_t)i, lookup_macs[i % LOOKUP_KEYS], frame, frame_len, TRACE_FORWARDED);
+    }
+}
+
+/* ---- sender-receiver.c ---- */
+
+static void parse(uint64_t count)
+{
+    q_receive_data_t received = {.data = frame, .data_len = 14, .rssi = -60};
+    esp_now_data_t parsed;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        memcpy(received.mac_addr, lookup_macs[i % LOOKUP_KEYS], ESP_NOW_ETH_ALEN);
+        parsed = parse_data(&received);
+        sink += parsed.payload_length + parsed.mac_addr[5];
+    }
+}
+
+/* ---- vcp.c in the simulator ----
+ * The receive path of the vcp task (handle_vcp_message, the routing decision, the link layer and the send task) only
+ * runs inside its FreeRTOS tasks, so one node runs in the simulator. Its neighbors are nodes of the simulator which
+ * only acknowledge the frames on the air, the benchmark hands the node their HELLO and DATA frames and answers every
+ * sequenced frame the node sends with an ACK like a neighbor would. Every operation hands over one frame and lets
+ * VCP_OP_US of virtual time pass (vcp_op_us), so the measured time includes the scheduling of the simulator. */
+
+static vcp_position_t neighbor_position(int k)
+{
+    return (vcp_position_t)((uint64_t)VCP_END / (BENCH_NEIGHBORS + 1) * k);
+}
+
+static void neighbor_idle(void)
+{
+}
+
+/* Runs after every event, in the context of the node */
+static void observe_node(sim_node_t *node)
+{
+    packet_pool_stats_t pool;
+
+    if (node->id == 0)
+    {
+        packet_pool_get_stats(&pool);
+        node_pool_allocs = pool.allocs;
+        node_position = own_position;
+    }
+}
+
+/* Neighbor k acknowledges every frame the node sends it which has a sequence number */
+static void acknowledge(sim_node_t *node, const uint8_t *dst_mac, const uint8_t *data, int len)
+{
+    vcp_message_t msg, ack = {.type = VCP_ACK};
+    uint8_t ack_frame[ESP_NOW_MAX_DATA_LEN], ack_len;
+
+    if (node->id != 0 || dst_mac[0] == 0xFF || vcp_decode(data, len, &msg) != ESP_OK || !link_sequenced(msg.type))
+    {
+        return;
+    }
+    ack.ack.cumulative = msg.seq + 1;
+    vcp_encode(&ack, ack_frame, &ack_len);
+    sim_radio_inject(node, dst_mac, ack_frame, ack_len);
+}
+
+/* Hands the node a frame of neighbor k */
+static void receive_from(int k, vcp_message_t *msg)
+{
+    uint8_t buf[ESP_NOW_MAX_DATA_LEN], len;
+
+    if (link_sequenced(msg->type))
+    {
+        msg->seq = neighbor_seq[k]++;
+    }
+    vcp_encode(msg, buf, &len);
+    sim_radio_inject(sim_node(0), sim_node(k)->mac, buf, len);
+}
+
+/* Neighbors 1 to BENCH_NEIGHBORS form a cord, the node is the successor or predecessor of two of them once joined */
+static void hello_of(int k, vcp_message_t *msg)
+{
+    *msg = (vcp_message_t){.type = VCP_HELLO};
+    msg->hello.position = neighbor_position(k);
+    msg->hello.successor = k < BENCH_NEIGHBORS ? neighbor_position(k + 1) : VCP_INITIAL;
+    msg->hello.predecessor = k > 1 ? neighbor_position(k - 1) : VCP_INITIAL;
+    if (node_position != VCP_INITIAL && node_position > msg->hello.position &&
+        (msg->hello.successor == VCP_INITIAL || node_position < msg->hello.successor))
+    {
+        msg->hello.successor = node_position;
+    }
+    if (node_position != VCP_INITIAL && node_position < msg->hello.position &&
+        (msg->hello.predecessor == VCP_INITIAL || node_position > msg->hello.predecessor))
+    {
+        msg->hello.predecessor = node_position;
+    }
+}
+
+static void hello_round(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_message_t msg;
+
+    for (int k = 1; k <= BENCH_NEIGHBORS; k++)
+    {
+        hello_of(k, &msg);
+        receive_from(k, &msg);
+    }
+}
+
+/* Boots the node and its neighbors and lets the node join the cord, returns false if it did not */
+static bool boot_and_join(void)
+{
+    sim_init(1 + BENCH_NEIGHBORS, 1);
+    sim_set_log_level(ESP_LOG_NONE);
+    sim_set_observer(observe_node);
+    sim_radio_set_hooks(acknowledge, NULL);
+    for (int k = 1; k <= BENCH_NEIGHBORS; k++)
+    {
+        sim_node(k)->x = 1.0; // all in range of the node
+        sim_boot(sim_node(k), 0, neighbor_idle);
+        neighbor_seq[k] = (uint16_t)(k * 1000);
+    }
+    sim_radio_connect();
+    node_position = VCP_INITIAL;
+    sim_boot(sim_node(0), 0, app_main);
+    sim_schedule(SIM_MS(100), sim_node(0), hello_round, NULL, 0);
+    sim_run_until(SIM_MS(VCP_DISCOVERY_PERIOD + 500));
+    return node_position != VCP_INITIAL;
+}
+
+/* Booting the firmware and joining the cord between two of BENCH_NEIGHBORS neighbors */
+static void boot_join(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!boot_and_join())
+        {
+            fprintf(stderr, "vcp: the node did not join the cord\n");
+            exit(1);
+        }
+        sim_deinit();
+    }
+}
+
+/* Receive callback of the node, reads the payload where the firmware received it */
+static void on_node_data(vcp_position_t source, const uint8_t *data, uint8_t len)
+{
+    sink += data[0] + len;
+}
+
+static void register_node_data(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_data_register(on_node_data);
+}
+
+static void setup_node(void)
+{
+    if (!boot_and_join())
+    {
+        fprintf(stderr, "vcp: the node did not join the cord\n");
+        exit(1);
+    }
+    // the neighbors learn the position of the node
+    sim_schedule(sim_now(), sim_node(0), hello_round, NULL, 0);
+    sim_schedule(sim_now(), sim_node(0), register_node_data, NULL, 0);
+    sim_run_until(sim_now() + SIM_MS(10));
+    sim_running = true;
+}
+
+/* Forwarding with DATA messages of different sizes, a forwarded frame is not copied whatever its size */
+static void setup_node_16(void)
+{
+    vcp_payload_len = 16;
+    setup_node();
+}
+
+static void setup_node_64(void)
+{
+    vcp_payload_len = 64;
+    setup_node();
+}
+
+static void setup_node_128(void)
+{
+    vcp_payload_len = 128;
+    setup_node();
+}
+
+static void setup_node_230(void)
+{
+    vcp_payload_len = 230;
+    setup_node();
+}
+
+static void teardown_node(void)
+{
+    sim_deinit();
+    sim_running = false;
+    vcp_payload_len = VCP_BENCH_PAYLOAD;
+}
+
+/* Virtual time per operation, DATA messages larger than VCP_BENCH_PAYLOAD take longer on the air */
+static uint64_t vcp_op_us(void)
+{
+    uint32_t extra = vcp_payload_len > VCP_BENCH_PAYLOAD ? vcp_payload_len - VCP_BENCH_PAYLOAD : 0;
+
+    return VCP_OP_US + extra * 8 * 1000000ULL / sim_radio_config.bitrate;
+}
+
+/* Frame of operation i of a mix of hello_share HELLOs, forward_share forwarded DATA and DATA for the node in 10 */
+static void vcp_mix(uint64_t count, int hello_share, int forward_share)
+{
+    static uint8_t data[VCP_DATA_MAX_LEN];
+    vcp_message_t msg;
+    uint64_t op;
+    int k;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        op = ops_done++;
+        k = 1 + op % BENCH_NEIGHBORS;
+        if ((int)(op % 10) < hello_share)
+        {
+            hello_of(k, &msg);
+        }
+        else
+        {
+            msg = (vcp_message_t){.type = VCP_DATA};
+            msg.data.source = neighbor_position(k);
+            msg.data.payload = data;
+            msg.data.payload_len = vcp_payload_len;
+            // forwarded messages go to both ends of the cord, beyond the first and the last neighbor
+            if ((int)(op % 10) < hello_share + forward_share)
+            {
+                msg.data.recipient = op % 2 ? VCP_START + 1 : VCP_END - 1;
+            }
+            else
+            {
+                msg.data.recipient = node_position;
+            }
+        }
+        receive_from(k, &msg);
+        sim_run_until(sim_now() + vcp_op_us());
+    }
+}
+
+static void vcp_hello(uint64_t count)
+{
+    vcp_mix(count, 10, 0);
+}
+
+static void vcp_forward(uint64_t count)
+{
+    vcp_mix(count, 0, 10);
+}
+
+static void vcp_deliver(uint64_t count)
+{
+    vcp_mix(count, 0, 0);
+}
+
+/* The node writes a DATA message for one of the ends of the cord into a frame buffer and sends it from there */
+static void send_from_node(sim_node_t *node, void *arg, uint64_t op)
+{
+    uint8_t *data = vcp_data_alloc();
+
+    if (data == NULL)
+    {
+        return;
+    }
+    memset(data, (int)op, vcp_payload_len);
+    if (vcp_data_send(op % 2 ? VCP_START + 1 : VCP_END - 1, data, vcp_payload_len, 0) != ESP_OK)
+    {
+        vcp_data_free(data);
+    }
+}
+
+static void vcp_send(uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        sim_schedule(sim_now(), sim_node(0), send_from_node, NULL, ops_done++);
+        sim_run_until(sim_now() + vcp_op_us());
+    }
+}
+
+/* Mostly forwarding, a node in the middle of the cord */
+static void vcp_traffic(uint64_t count)
+{
+    vcp_mix(count, 3, 6);
+}
+
+static const benchmark_t benchmarks[] = {
+    {"encode/hello", 14, setup_hello, encode},
+    {"decode/hello", 14, setup_hello, decode},
+    {"encode/data_250", ESP_NOW_MAX_DATA_LEN, setup_data, encode},
+    {"decode/data_250", ESP_NOW_MAX_DATA_LEN, setup_data, decode},
+    {"neighbors/find_addr_linear", 0, setup_neighbors, find_addr_linear},
+    {"neighbors/find_addr", 0, setup_neighbors, find_addr},
+    {"neighbors/find_pos_linear", 0, setup_neighbors, find_pos_linear},
+    {"neighbors/find_pos", 0, setup_neighbors, find_pos},
+    {"neighbors/nearest", 0, setup_neighbors, nearest},
+    {"neighbors/hello_update", 0, setup_neighbors, hello_update},
+    {"ring/push_pop", 0, NULL, ring_push_pop},
+    {"ring/spsc_lossless", 0, setup_lossless, ring_spsc, report_ring},
+    {"ring/spsc_drop", 0, setup_lossy, ring_spsc, report_ring},
+    {"metrics/record_frame", 0, NULL, metrics_record},
+    {"trace/record_data_250", 0, setup_data, trace_frame},
+    {"receive/parse_data", 14, NULL, parse},
+    {"vcp/boot_join_8", 0, NULL, boot_join},
+    {"vcp/hello", 14, setup_node, vcp_hello, NULL, teardown_node},
+    {"vcp/forward_data", 14 + VCP_BENCH_PAYLOAD, setup_node, vcp_forward, NULL, teardown_node},
+    {"vcp/forward_data_16", 14 + 16, setup_node_16, vcp_forward, NULL, teardown_node},
+    {"vcp/forward_data_64", 14 + 64, setup_node_64, vcp_forward, NULL, teardown_node},
+    {"vcp/forward_data_128", 14 + 128, setup_node_128, vcp_forward, NULL, teardown_node},
+    {"vcp/forward_data_230", 14 + 230, setup_node_230, vcp_forward, NULL, teardown_node},
+    {"vcp/deliver_data", 14 + VCP_BENCH_PAYLOAD, setup_node, vcp_deliver, NULL, teardown_node},
+    {"vcp/send_data", 14 + VCP_BENCH_PAYLOAD, setup_node, vcp_send, NULL, teardown_node},
+    {"vcp/mix", 0, setup_node, vcp_traffic, NULL, teardown_node},
+};
+
+/* Packet buffers taken from the pool so far, of the simulated node while a vcp benchmark runs */
+static uint32_t pool_allocs(void)
+{
+    packet_pool_stats_t pool;
+
+    if (sim_running)
+    {
+        return node_pool_allocs;
+    }
+    packet_pool_get_stats(&pool);
+    return pool.allocs;
+}
+
+static void measure(const benchmark_t *b, double min_seconds)
+{
+    uint64_t count = 1, start, elapsed, allocs;
+    uint32_t buffers;
+    double ns_per_op;
+
+    if (b->setup != NULL)
+    {
+        b->setup();
+    }
+    // grow the batch until it runs long enough to be measured reliably
+    while (true)
+    {
+        allocs = sim_heap_allocs;
+        buffers = pool_allocs();
+        start = now_ns();
+        b->run(count);
+        elapsed = now_ns() - start;
+        allocs = sim_heap_allocs - allocs;
+        buffers = pool_allocs() - buffers;
+        if (elapsed >= min_seconds * 1e9)
+        {
+            break;
+        }
+        count *= elapsed > 0 && elapsed < min_seconds * 1e8 ? 10 : 2;
+    }
+
+    ns_per_op = (double)elapsed / count;
+
+    printf("%-28s %12llu ops %12.2f ns/op %10.4f Mops/s %8.2f allocs/op %6.2f bufs/op", b->name,
+           (unsigned long long)count, ns_per_op, count * 1e3 / elapsed, (double)allocs / count,
+           (double)buffers / count);
+    if (b->bytes > 0)
+    {
+        printf(" %10.1f MB/s", b->bytes * count * 1e3 / elapsed);
+    }
+    if (b->report != NULL)
+    {
+        b->report();
+    }
+    for (int i = 0; i < baseline_len; i++)
+    {
+        if (strcmp(baseline[i].name, b->name) == 0 && baseline[i].ns_per_op > 0)
+        {
+            printf(" %+7.1f %%", 100.0 * (ns_per_op - baseline[i].ns_per_op) / baseline[i].ns_per_op);
+        }
+    }
+    printf("\n");
+    if (results != NULL)
+    {
+        fprintf(results, "%s,%llu,%.3f,%.4f,%.4f\n", b->name, (unsigned long long)count, ns_per_op,
+                (double)allocs / count, (double)buffers / count);
+    }
+
+    if (b->teardown != NULL)
+    {
+        b->teardown();
+    }
+}
+
+/* Reads the results of an earlier run written with --output, returns false if the file cannot be read */
+static bool load_baseline(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+
+    if (f == NULL)
+    {
+        return false;
+    }
+    while (fgets(line, sizeof(line), f) != NULL && baseline_len < BASELINE_MAX)
+    {
+        baseline_t *entry = &baseline[baseline_len];
+
+        // the header line does not parse
+        if (sscanf(line, "%63[^,],%*u,%lf", entry->name, &entry->ns_per_op) == 2)
+        {
+            baseline_len++;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] [name ...]\n"
+            "  -t, --time SECONDS      minimum run time of every benchmark (0.2)\n"
+            "  -o, --output FILE       write the results as CSV to FILE\n"
+            "  -c, --compare FILE      show the change of ns/op against the results in FILE\n"
+            "  -l, --list              list the benchmarks\n"
+            "  -h, --help              show this help\n"
+            "Only benchmarks whose name starts with one of the given names are run.\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    double min_seconds = 0.2;
+    int c;
+    static const struct option options[] = {
+        {"time", required_argument, NULL, 't'},
+        {"output", required_argument, NULL, 'o'},
+        {"compare", required_argument, NULL, 'c'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((c = getopt_long(argc, argv, "t:o:c:lh", options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            min_seconds = atof(optarg);
+            break;
+        case 'o':
+            results = fopen(optarg, "w");
+            if (results == NULL)
+            {
+                perror(optarg);
+                return 1;
+            }
+            fprintf(results, "benchmark,ops,ns_per_op,allocs_per_op,buffers_per_op\n");
+            break;
+        case 'c':
+            if (!load_baseline(optarg))
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+            {
+                printf("%s\n", benchmarks[i].name);
+            }
+            return 0;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        bool selected = optind == argc;
+
+        for (int a = optind; a < argc && !selected; a++)
+        {
+            selected = strncmp(benchmarks[i].name, argv[a], strlen(argv[a])) == 0;
+        }
+        if (selected)
+        {
+            measure(&benchmarks[i], min_seconds);
+        }
+    }
+    if (results != NULL)
+    {
+        fclose(results);
+    }
+    return 0;
+}
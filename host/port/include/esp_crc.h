@@ -0,0 +1,16 @@
+/*
+ * esp_crc.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ */
+
+#ifndef ESP_CRC_H
+#define ESP_CRC_H
+
+#include "esp_err.h"
+
+uint16_t esp_crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len);
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * esp_err.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Host stand-in for the ESP-IDF error codes, only the subset used by the firmware is provided
+ */
+
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sim-port.h"
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_VERSION 0x10A
+
+#define ESP_ERR_WIFI_BASE 0x3000
+
+const char *esp_err_to_name(esp_err_t code);
+void sim_error_check_failed(esp_err_t rc, const char *file, int line, const char *expression);
+
+#define ESP_ERROR_CHECK(x)                                              \
+    do                                                                  \
+    {                                                                   \
+        esp_err_t err_rc_ = (x);                                        \
+        if (err_rc_ != ESP_OK)                                          \
+        {                                                               \
+            sim_error_check_failed(err_rc_, __FILE__, __LINE__, #x);    \
+        }                                                               \
+    } while (0)
+
+#endif
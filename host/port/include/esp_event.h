@@ -0,0 +1,15 @@
+/*
+ * esp_event.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ */
+
+#ifndef ESP_EVENT_H
+#define ESP_EVENT_H
+
+#include "esp_err.h"
+
+esp_err_t esp_event_loop_create_default(void);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * esp_log.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Host stand-in for the ESP-IDF logging macros, messages are tagged with the virtual time and the node id
+ */
+
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include "esp_err.h"
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(__printf__, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) sim_log(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) sim_log(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) sim_log(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) sim_log(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) sim_log(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif
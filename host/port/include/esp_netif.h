@@ -0,0 +1,15 @@
+/*
+ * esp_netif.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ */
+
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+#include "esp_err.h"
+
+esp_err_t esp_netif_init(void);
+
+#endif
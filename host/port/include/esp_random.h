@@ -0,0 +1,19 @@
+/*
+ * esp_random.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Random numbers come from the seeded simulator generator, so that every run can be reproduced
+ */
+
+#ifndef ESP_RANDOM_H
+#define ESP_RANDOM_H
+
+#include <stddef.h>
+#include "esp_err.h"
+
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * esp_sleep.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Sleep modes are not used by the firmware, the header only exists to satisfy its includes
+ */
+
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+#include "esp_err.h"
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * esp_task_wdt.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * The task watchdog is not used by the firmware, the header only exists to satisfy its includes
+ */
+
+#ifndef ESP_TASK_WDT_H
+#define ESP_TASK_WDT_H
+
+#include "esp_err.h"
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * esp_timer.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * esp_timer_get_time returns the virtual time of the simulation in microseconds
+ */
+
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include "esp_err.h"
+
+int64_t esp_timer_get_time(void);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * sim-port.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Glue pulled in by every host stand-in header. Firmware translation units are compiled with SIM_FIRMWARE, which
+ * puts their per-node state into its own section, routes their console output through the simulator log and counts
+ * their heap allocations.
+ */
+
+#ifndef SIM_PORT_H
+#define SIM_PORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef SIM_FIRMWARE
+/* Everything tagged NODE_STATE is swapped in and out by the scheduler whenever it switches to another node */
+#define NODE_STATE __attribute__((section("vcp_node_state")))
+
+int sim_printf(const char *format, ...) __attribute__((format(__printf__, 1, 2)));
+#define printf sim_printf
+
+/* Heap allocations of the firmware are counted per node */
+void *sim_malloc(size_t size);
+#define malloc sim_malloc
+#endif
+
+#endif
@@ -0,0 +1,535 @@
+/*
+ * sim-radio.c (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * ESP-NOW stand-in on top of a simple shared channel model:
+ * - nodes hear each other within sim_radio_config.range, a node defers its transmission while it hears the channel busy
+ * - overlapping frames at a receiver collide, frames are lost independently with sim_radio_config.loss plus the
+ *   edge_loss share of their distance, so that links close to the range are lossy and have a weak RSSI
+ * - unicast frames are acknowledged and retransmitted up to mac_retries times, the send callback reports the outcome
+ * - esp_now_send only queues the frame, the driver accepts tx_queue_size frames before returning NO_MEM
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "esp_now.h"
+#include "esp_wifi.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+/* 802.11b at 1 Mbit/s: long PLCP preamble, ESP-NOW vendor specific action frame overhead and the MAC ACK */
+#define PLCP_US 192
+#define ESPNOW_OVERHEAD_BYTES 43
+#define ACK_US (10 + PLCP_US + 14 * 8)
+#define DIFS_US 50
+#define SLOT_US 20
+#define CW_SLOTS 16
+#define CW_MAX_SLOTS 1024
+
+struct sim_frame
+{
+    sim_node_t *src;
+    uint8_t src_mac[ESP_NOW_ETH_ALEN];
+    uint8_t dst[ESP_NOW_ETH_ALEN];
+    bool broadcast;
+    bool acked;
+    int attempts;
+    int refs;
+    sim_node_t **receivers;
+    int receivers_len;
+    sim_frame_t *next;
+    int len;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+};
+
+sim_radio_config_t sim_radio_config = {
+    .range = 15.0,
+    .loss = 0.0,
+    .edge_loss = 0.0,
+    .bitrate = 1000000,
+    .tx_queue_size = 8,
+    .mac_retries = 2,
+};
+sim_radio_stats_t sim_radio_stats;
+
+static const uint8_t broadcast[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static sim_tx_hook_t tx_hook;
+static sim_rx_hook_t rx_hook;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+static void radio_start(sim_node_t *node, void *arg, uint64_t tag);
+
+static void frame_unref(sim_frame_t *frame)
+{
+    if (--frame->refs == 0)
+    {
+        free(frame->receivers);
+        free(frame);
+    }
+}
+
+static double distance(const sim_node_t *a, const sim_node_t *b)
+{
+    return hypot(a->x - b->x, a->y - b->y);
+}
+
+/* Log-distance path loss (exponent 3) scaled to the range, a frame from the edge of the range arrives with the
+ * -90 dBm sensitivity of the receiver, only used to fill rx_ctrl.rssi */
+static int8_t rssi_of(const sim_node_t *a, const sim_node_t *b)
+{
+    double d = distance(a, b);
+    double rssi = -90.0 + 30.0 * log10(sim_radio_config.range / (d < 1.0 ? 1.0 : d));
+
+    rssi += (sim_random_uniform() - 0.5) * 4.0;
+    return (int8_t)(rssi < -100.0 ? -100.0 : rssi > 0.0 ? 0.0 : rssi);
+}
+
+static double loss_of(const sim_node_t *a, const sim_node_t *b)
+{
+    double edge = distance(a, b) / sim_radio_config.range;
+    return sim_radio_config.loss + sim_radio_config.edge_loss * edge * edge * edge * edge;
+}
+
+/* Binary exponential backoff: the contention window doubles with every retry of a frame, otherwise two hidden
+ * terminals whose frames collided would most likely collide again */
+static uint64_t backoff(int attempts)
+{
+    uint32_t cw = CW_SLOTS << attempts < CW_MAX_SLOTS && attempts < 16 ? CW_SLOTS << attempts : CW_MAX_SLOTS;
+
+    return DIFS_US + (uint64_t)(sim_random() % cw) * SLOT_US;
+}
+
+static uint64_t airtime(const sim_frame_t *frame)
+{
+    uint64_t us = PLCP_US + (uint64_t)(ESPNOW_OVERHEAD_BYTES + frame->len) * 8 * 1000000 / sim_radio_config.bitrate;
+    return frame->broadcast ? us : us + ACK_US;
+}
+
+/* Computes the links of every node with a grid of range sized cells, so large networks stay cheap to set up */
+void sim_radio_connect(void)
+{
+    int len = sim_nodes_len();
+    double range = sim_radio_config.range;
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    int cols, rows;
+    int *cell_head, *cell_next;
+
+    for (int i = 0; i < len; i++)
+    {
+        sim_node_t *n = sim_node(i);
+        min_x = fmin(min_x, n->x);
+        min_y = fmin(min_y, n->y);
+        max_x = fmax(max_x, n->x);
+        max_y = fmax(max_y, n->y);
+    }
+    cols = (int)((max_x - min_x) / range) + 1;
+    rows = (int)((max_y - min_y) / range) + 1;
+    cell_head = malloc((size_t)cols * rows * sizeof(int));
+    cell_next = malloc((size_t)len * sizeof(int));
+    assert(cell_head != NULL && cell_next != NULL);
+    memset(cell_head, -1, (size_t)cols * rows * sizeof(int));
+
+    for (int i = 0; i < len; i++)
+    {
+        sim_node_t *n = sim_node(i);
+        int c = (int)((n->x - min_x) / range) + cols * (int)((n->y - min_y) / range);
+        cell_next[i] = cell_head[c];
+        cell_head[c] = i;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        sim_node_t *n = sim_node(i);
+        int cx = (int)((n->x - min_x) / range), cy = (int)((n->y - min_y) / range);
+        int cap = 16;
+
+        free(n->links);
+        n->links = malloc(cap * sizeof(int));
+        n->links_len = 0;
+        for (int y = cy - 1; y <= cy + 1; y++)
+        {
+            for (int x = cx - 1; x <= cx + 1; x++)
+            {
+                if (x < 0 || y < 0 || x >= cols || y >= rows)
+                {
+                    continue;
+                }
+                for (int j = cell_head[x + cols * y]; j != -1; j = cell_next[j])
+                {
+                    if (j == i || distance(n, sim_node(j)) > range)
+                    {
+                        continue;
+                    }
+                    if (n->links_len == cap)
+                    {
+                        cap *= 2;
+                        n->links = realloc(n->links, cap * sizeof(int));
+                    }
+                    n->links[n->links_len++] = j;
+                }
+            }
+        }
+    }
+
+    free(cell_head);
+    free(cell_next);
+}
+
+void sim_radio_set_hooks(sim_tx_hook_t tx, sim_rx_hook_t rx)
+{
+    tx_hook = tx;
+    rx_hook = rx;
+}
+
+/* ----------------------------------------------- channel model ----------------------------------------------- */
+
+static void deliver(sim_node_t *node, void *arg, uint64_t tag)
+{
+    sim_frame_t *frame = arg;
+    wifi_pkt_rx_ctrl_t rx_ctrl = {0};
+    esp_now_recv_info_t info;
+
+    if (node->espnow_init && node->recv_cb != NULL)
+    {
+        rx_ctrl.rssi = rssi_of(frame->src, node);
+        rx_ctrl.channel = 1;
+        rx_ctrl.sig_len = frame->len;
+        info.src_addr = frame->src_mac;
+        info.des_addr = frame->dst;
+        info.rx_ctrl = &rx_ctrl;
+        sim_radio_stats.delivered++;
+        if (rx_hook != NULL)
+        {
+            rx_hook(node, frame->src, frame->data, frame->len);
+        }
+        node->recv_cb(&info, frame->data, frame->len);
+    }
+    frame_unref(frame);
+}
+
+static void send_done(sim_node_t *node, void *arg, uint64_t tag)
+{
+    sim_frame_t *frame = arg;
+
+    if (node->espnow_init && node->send_cb != NULL)
+    {
+        node->send_cb(frame->dst, (esp_now_send_status_t)tag);
+    }
+    frame_unref(frame);
+}
+
+static void tx_end(sim_node_t *node, void *arg, uint64_t tag)
+{
+    sim_frame_t *frame = arg;
+    esp_now_send_status_t status;
+
+    frame->acked = false;
+    for (int i = 0; i < frame->receivers_len; i++)
+    {
+        sim_node_t *r = frame->receivers[i];
+
+        if (r->rx_frame != frame)
+        {
+            continue;
+        }
+        r->rx_frame = NULL;
+        if (r->rx_corrupt)
+        {
+            sim_radio_stats.collisions++;
+            continue;
+        }
+        if (sim_random_uniform() < loss_of(node, r))
+        {
+            sim_radio_stats.lost++;
+            continue;
+        }
+        if (frame->broadcast || memcmp(frame->dst, r->mac, ESP_NOW_ETH_ALEN) == 0)
+        {
+            frame->acked = true;
+            frame->refs++;
+            sim_schedule(sim_now(), r, deliver, frame, 0);
+        }
+    }
+    free(frame->receivers);
+    frame->receivers = NULL;
+    frame->receivers_len = 0;
+
+    if (!frame->broadcast && !frame->acked && frame->attempts <= sim_radio_config.mac_retries)
+    {
+        sim_radio_stats.retries++;
+        sim_schedule(sim_now() + backoff(frame->attempts), node, radio_start, NULL, 0);
+        return;
+    }
+
+    status = frame->broadcast || frame->acked ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL;
+    if (status == ESP_NOW_SEND_FAIL)
+    {
+        sim_radio_stats.send_fail++;
+    }
+
+    node->tx_head = frame->next;
+    if (node->tx_head == NULL)
+    {
+        node->tx_tail = NULL;
+    }
+    node->tx_len--;
+    node->tx_busy = false;
+    sim_schedule(sim_now(), node, send_done, frame, status);
+
+    if (node->tx_head != NULL)
+    {
+        node->tx_busy = true;
+        sim_schedule(sim_now() + backoff(0), node, radio_start, NULL, 0);
+    }
+}
+
+/* Puts the head of the tx queue on air as soon as the channel is sensed idle */
+static void radio_start(sim_node_t *node, void *arg, uint64_t tag)
+{
+    sim_frame_t *frame = node->tx_head;
+    uint64_t now = sim_now();
+    uint64_t end;
+
+    if (node->crashed || frame == NULL)
+    {
+        return;
+    }
+    if (now < node->channel_busy_until)
+    {
+        sim_schedule(node->channel_busy_until + backoff(frame->attempts), node, radio_start, NULL, 0);
+        return;
+    }
+
+    end = now + airtime(frame);
+    frame->attempts++;
+    node->tx_until = end;
+    sim_radio_stats.frames++;
+    sim_radio_stats.bytes += frame->len;
+    sim_radio_stats.airtime_us += end - now;
+
+    frame->receivers = malloc(node->links_len * sizeof(sim_node_t *));
+    frame->receivers_len = 0;
+    for (int i = 0; i < node->links_len; i++)
+    {
+        sim_node_t *r = sim_node(node->links[i]);
+
+        if (r->channel_busy_until < end)
+        {
+            r->channel_busy_until = end;
+        }
+        if (!r->booted || r->crashed || r->tx_until > now)
+        {
+            continue; // off or transmitting itself
+        }
+        if (r->rx_frame != NULL && r->rx_until > now)
+        {
+            r->rx_corrupt = true; // collision, neither frame makes it
+            continue;
+        }
+        r->rx_frame = frame;
+        r->rx_until = end;
+        r->rx_corrupt = false;
+        frame->receivers[frame->receivers_len++] = r;
+    }
+
+    sim_schedule(end, node, tx_end, frame, 0);
+}
+
+/* Hands a frame to the receive callback of the node as if it came from src_mac, without using the channel */
+void sim_radio_inject(sim_node_t *node, const uint8_t *src_mac, const uint8_t *data, int len)
+{
+    sim_frame_t *frame = calloc(1, sizeof(sim_frame_t));
+
+    assert(frame != NULL && len <= ESP_NOW_MAX_DATA_LEN);
+    frame->src = node;
+    memcpy(frame->src_mac, src_mac, ESP_NOW_ETH_ALEN);
+    memcpy(frame->dst, node->mac, ESP_NOW_ETH_ALEN);
+    memcpy(frame->data, data, len);
+    frame->len = len;
+    frame->refs = 1;
+    sim_schedule(sim_now(), node, deliver, frame, 0);
+}
+
+/* ----------------------------------------------- ESP-NOW API ----------------------------------------------- */
+
+esp_err_t esp_now_init(void)
+{
+    sim_node_t *node = sim_current_node();
+
+    node->espnow_init = true;
+    node->peers_len = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void)
+{
+    sim_node_t *node = sim_current_node();
+
+    node->espnow_init = false;
+    node->recv_cb = NULL;
+    node->send_cb = NULL;
+    node->peers_len = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+    sim_node_t *node = sim_current_node();
+
+    if (!node->espnow_init)
+    {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    node->recv_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb(void)
+{
+    sim_current_node()->recv_cb = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+    sim_node_t *node = sim_current_node();
+
+    if (!node->espnow_init)
+    {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    node->send_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_send_cb(void)
+{
+    sim_current_node()->send_cb = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_set_pmk(const uint8_t *pmk)
+{
+    return pmk == NULL ? ESP_ERR_ESPNOW_ARG : ESP_OK;
+}
+
+static int find_peer(sim_node_t *node, const uint8_t *mac)
+{
+    for (int i = 0; i < node->peers_len; i++)
+    {
+        if (memcmp(node->peers[i], mac, ESP_NOW_ETH_ALEN) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr)
+{
+    return find_peer(sim_current_node(), peer_addr) != -1;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+    sim_node_t *node = sim_current_node();
+
+    if (!node->espnow_init)
+    {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    if (peer == NULL)
+    {
+        return ESP_ERR_ESPNOW_ARG;
+    }
+    if (find_peer(node, peer->peer_addr) != -1)
+    {
+        return ESP_ERR_ESPNOW_EXIST;
+    }
+    if (node->peers_len == ESP_NOW_MAX_TOTAL_PEER_NUM)
+    {
+        return ESP_ERR_ESPNOW_FULL;
+    }
+    memcpy(node->peers[node->peers_len++], peer->peer_addr, ESP_NOW_ETH_ALEN);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr)
+{
+    sim_node_t *node = sim_current_node();
+    int i = find_peer(node, peer_addr);
+
+    if (i == -1)
+    {
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    }
+    memcpy(node->peers[i], node->peers[--node->peers_len], ESP_NOW_ETH_ALEN);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+    sim_node_t *node = sim_current_node();
+    sim_frame_t *frame;
+
+    if (!node->espnow_init)
+    {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    if (peer_addr == NULL || data == NULL || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+    {
+        return ESP_ERR_ESPNOW_ARG;
+    }
+    if (find_peer(node, peer_addr) == -1)
+    {
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    }
+    if (node->tx_len >= sim_radio_config.tx_queue_size)
+    {
+        sim_radio_stats.send_no_mem++;
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+
+    frame = calloc(1, sizeof(sim_frame_t));
+    if (frame == NULL)
+    {
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+    frame->src = node;
+    memcpy(frame->src_mac, node->mac, ESP_NOW_ETH_ALEN);
+    memcpy(frame->dst, peer_addr, ESP_NOW_ETH_ALEN);
+    frame->broadcast = memcmp(peer_addr, broadcast, ESP_NOW_ETH_ALEN) == 0;
+    frame->len = (int)len;
+    frame->refs = 1;
+    memcpy(frame->data, data, len);
+
+    if (tx_hook != NULL)
+    {
+        tx_hook(node, peer_addr, data, (int)len);
+    }
+
+    if (node->tx_tail != NULL)
+    {
+        node->tx_tail->next = frame;
+    }
+    else
+    {
+        node->tx_head = frame;
+    }
+    node->tx_tail = frame;
+    node->tx_len++;
+
+    if (!node->tx_busy)
+    {
+        node->tx_busy = true;
+        sim_schedule(sim_now() + backoff(0), node, radio_start, NULL, 0);
+    }
+    return ESP_OK;
+}
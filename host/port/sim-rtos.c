@@ -0,0 +1,939 @@
+/*
+ * sim-rtos.c (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Virtual time event loop and the FreeRTOS stand-ins built on top of it.
+ *
+ * Every event belongs to a node. Before it runs, the NODE_STATE section of the firmware is swapped to the one of
+ * that node, so the unmodified firmware code of many nodes can share one process. Tasks are ucontext coroutines that
+ * return to the event loop whenever they block; nothing consumes virtual time except waiting.
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+typedef enum
+{
+    TASK_BLOCKED,
+    TASK_RUNNING,
+    TASK_DONE,
+} sim_task_state_t;
+
+struct sim_task
+{
+    ucontext_t ctx;
+    void *stack;
+    sim_node_t *node;
+    TaskFunction_t fn;
+    void *param;
+    const char *name;
+    sim_task_state_t state;
+    uint64_t wake_token; // resume events carrying an older token are stale
+    bool woken;          // false if the last block ended with a timeout
+    uint32_t notify_value;
+    bool notify_pending;
+    bool notify_waiting;
+    struct sim_task *next_waiter;
+};
+
+struct sim_queue
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *storage;
+    struct sim_task *rx_waiters;
+    struct sim_task *tx_waiters;
+};
+
+struct sim_timer
+{
+    sim_node_t *node;
+    const char *name;
+    TickType_t period;
+    bool auto_reload;
+    bool active;
+    void *id;
+    TimerCallbackFunction_t callback;
+    uint64_t token;
+};
+
+typedef struct
+{
+    uint64_t time;
+    uint64_t seq;
+    sim_node_t *node;
+    sim_event_fn_t fn;
+    void *arg;
+    uint64_t tag;
+} sim_event_t;
+
+/* Section boundaries generated by the linker for the NODE_STATE variables of the firmware */
+extern uint8_t __start_vcp_node_state[] __attribute__((weak));
+extern uint8_t __stop_vcp_node_state[] __attribute__((weak));
+
+static sim_node_t *nodes;
+static int nodes_len;
+static uint8_t *initial_state;
+static size_t state_size;
+static sim_node_t *active_node; // node whose state currently occupies the section
+static sim_node_t *current_node;
+static struct sim_task *current_task;
+static ucontext_t scheduler_ctx;
+static jmp_buf abort_jmp;
+
+static sim_event_t *events;
+static size_t events_len;
+static size_t events_cap;
+static uint64_t events_seq;
+static uint64_t now;
+
+uint64_t sim_heap_allocs;
+
+static sim_observer_t observer;
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static uint64_t rng_state;
+static uint64_t firmware_rng_state; // esp_random(), separate so the firmware does not shift the simulated traffic
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+static void enter_node(sim_node_t *node);
+static void task_resume(sim_node_t *node, void *arg, uint64_t tag);
+static bool task_block(uint64_t deadline);
+static void task_wake(struct sim_task *task);
+static void wait_on(struct sim_task **list, uint64_t deadline);
+static void wake_one(struct sim_task **list);
+static uint64_t deadline_of(TickType_t ticks);
+
+/* ----------------------------------------------- event loop ----------------------------------------------- */
+
+void sim_init(int len, uint64_t seed)
+{
+    nodes_len = len;
+    nodes = calloc(len, sizeof(sim_node_t));
+    assert(nodes != NULL);
+
+    state_size = (size_t)(__stop_vcp_node_state - __start_vcp_node_state);
+    initial_state = malloc(state_size);
+    assert(initial_state != NULL || state_size == 0);
+    memcpy(initial_state, __start_vcp_node_state, state_size);
+
+    for (int i = 0; i < len; i++)
+    {
+        nodes[i].id = i;
+        nodes[i].mac[0] = 0x02; // locally administered
+        nodes[i].mac[2] = (uint8_t)(i >> 24);
+        nodes[i].mac[3] = (uint8_t)(i >> 16);
+        nodes[i].mac[4] = (uint8_t)(i >> 8);
+        nodes[i].mac[5] = (uint8_t)i;
+        nodes[i].state = malloc(state_size);
+        assert(nodes[i].state != NULL || state_size == 0);
+        memcpy(nodes[i].state, initial_state, state_size);
+    }
+
+    rng_state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    firmware_rng_state = rng_state ^ 0xD1B54A32D192ED03ULL;
+    now = 0;
+    events_len = 0;
+    events_seq = 0;
+    active_node = NULL;
+    current_node = NULL;
+    current_task = NULL;
+}
+
+/* Releases the nodes and restores the pristine firmware state, so that another simulation can follow */
+void sim_deinit(void)
+{
+    memcpy(__start_vcp_node_state, initial_state, state_size);
+    for (int i = 0; i < nodes_len; i++)
+    {
+        free(nodes[i].state);
+        free(nodes[i].links);
+    }
+    free(nodes);
+    free(initial_state);
+    free(events);
+    nodes = NULL;
+    nodes_len = 0;
+    events = NULL;
+    events_len = 0;
+    events_cap = 0;
+    active_node = NULL;
+}
+
+int sim_nodes_len(void)
+{
+    return nodes_len;
+}
+
+sim_node_t *sim_node(int id)
+{
+    return &nodes[id];
+}
+
+sim_node_t *sim_current_node(void)
+{
+    return current_node;
+}
+
+uint64_t sim_now(void)
+{
+    return now;
+}
+
+void sim_set_observer(sim_observer_t fn)
+{
+    observer = fn;
+}
+
+void sim_set_log_level(esp_log_level_t level)
+{
+    log_level = level;
+}
+
+/* xorshift64*, deterministic for a given seed. Callers that must not depend on how often the others draw keep their
+ * own state */
+uint32_t sim_random_stream(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+uint32_t sim_random(void)
+{
+    return sim_random_stream(&rng_state);
+}
+
+uint32_t sim_firmware_random(void)
+{
+    return sim_random_stream(&firmware_rng_state);
+}
+
+double sim_random_uniform(void)
+{
+    return sim_random() / 4294967296.0;
+}
+
+static bool event_before(const sim_event_t *a, const sim_event_t *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+void sim_schedule(uint64_t at, sim_node_t *node, sim_event_fn_t fn, void *arg, uint64_t tag)
+{
+    size_t i;
+
+    if (events_len == events_cap)
+    {
+        events_cap = events_cap ? 2 * events_cap : 1024;
+        events = realloc(events, events_cap * sizeof(sim_event_t));
+        assert(events != NULL);
+    }
+
+    i = events_len++;
+    events[i] = (sim_event_t){.time = at < now ? now : at, .seq = events_seq++, .node = node, .fn = fn, .arg = arg, .tag = tag};
+
+    while (i > 0 && event_before(&events[i], &events[(i - 1) / 2]))
+    {
+        sim_event_t tmp = events[i];
+        events[i] = events[(i - 1) / 2];
+        events[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static sim_event_t pop_event(void)
+{
+    sim_event_t top = events[0];
+    size_t i = 0;
+
+    events[0] = events[--events_len];
+    while (true)
+    {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < events_len && event_before(&events[l], &events[m]))
+        {
+            m = l;
+        }
+        if (r < events_len && event_before(&events[r], &events[m]))
+        {
+            m = r;
+        }
+        if (m == i)
+        {
+            break;
+        }
+        sim_event_t tmp = events[i];
+        events[i] = events[m];
+        events[m] = tmp;
+        i = m;
+    }
+    return top;
+}
+
+static void enter_node(sim_node_t *node)
+{
+    if (node == active_node)
+    {
+        return;
+    }
+    if (active_node != NULL)
+    {
+        memcpy(active_node->state, __start_vcp_node_state, state_size);
+    }
+    memcpy(__start_vcp_node_state, node->state, state_size);
+    active_node = node;
+}
+
+void sim_run_until(uint64_t until)
+{
+    while (events_len > 0 && events[0].time <= until)
+    {
+        sim_event_t ev = pop_event();
+        now = ev.time;
+
+        if (ev.node != NULL)
+        {
+            if (ev.node->crashed)
+            {
+                continue;
+            }
+            enter_node(ev.node);
+        }
+
+        current_node = ev.node;
+        if (setjmp(abort_jmp) == 0)
+        {
+            ev.fn(ev.node, ev.arg, ev.tag);
+        }
+        if (ev.node != NULL && observer != NULL)
+        {
+            observer(ev.node);
+        }
+        current_node = NULL;
+    }
+
+    if (until != SIM_FOREVER && now < until)
+    {
+        now = until;
+    }
+}
+
+static void boot_task(void *entry)
+{
+    ((void (*)(void))entry)();
+}
+
+static void boot_event(sim_node_t *node, void *entry, uint64_t tag)
+{
+    node->booted = true;
+    xTaskCreate(boot_task, "main", 3584, entry, 1, NULL);
+}
+
+/* Powers the node on at the given time, entry (usually app_main) runs in the "main" task like on the ESP32 */
+void sim_boot(sim_node_t *node, uint64_t at, void (*entry)(void))
+{
+    sim_schedule(at, node, boot_event, (void *)entry, 0);
+}
+
+/* ----------------------------------------------- tasks ----------------------------------------------- */
+
+static void task_entry(void)
+{
+    struct sim_task *task = current_task;
+
+    task->fn(task->param);
+    task->state = TASK_DONE;
+    swapcontext(&task->ctx, &scheduler_ctx);
+}
+
+static void task_free(struct sim_task *task)
+{
+    munmap(task->stack, SIM_TASK_STACK_SIZE);
+    free(task);
+}
+
+static void task_resume(sim_node_t *node, void *arg, uint64_t tag)
+{
+    struct sim_task *task = arg;
+
+    if (task->state != TASK_BLOCKED || tag != task->wake_token)
+    {
+        return; // stale wakeup or timeout
+    }
+
+    task->state = TASK_RUNNING;
+    current_task = task;
+    swapcontext(&scheduler_ctx, &task->ctx);
+    current_task = NULL;
+
+    if (task->state == TASK_DONE)
+    {
+        task_free(task);
+    }
+}
+
+/* Suspends the running task until task_wake is called or the deadline passes. Returns false on timeout */
+static bool task_block(uint64_t deadline)
+{
+    struct sim_task *task = current_task;
+
+    assert(task != NULL);
+    task->state = TASK_BLOCKED;
+    task->woken = false;
+    task->wake_token++;
+    if (deadline != SIM_FOREVER)
+    {
+        sim_schedule(deadline, task->node, task_resume, task, task->wake_token);
+    }
+    swapcontext(&task->ctx, &scheduler_ctx);
+    return task->woken;
+}
+
+static void task_wake(struct sim_task *task)
+{
+    if (task->state != TASK_BLOCKED)
+    {
+        return;
+    }
+    task->woken = true;
+    task->wake_token++;
+    sim_schedule(now, task->node, task_resume, task, task->wake_token);
+}
+
+static uint64_t deadline_of(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        return SIM_FOREVER;
+    }
+    return now + (uint64_t)ticks * SIM_TICK_US;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *const name, const uint32_t stack_depth, void *const param,
+                                   UBaseType_t priority, TaskHandle_t *const created, const BaseType_t core)
+{
+    struct sim_task *task = calloc(1, sizeof(struct sim_task));
+
+    assert(current_node != NULL);
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    task->stack = mmap(NULL, SIM_TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(task->stack != MAP_FAILED);
+    task->node = current_node;
+    task->fn = fn;
+    task->param = param;
+    task->name = name;
+    task->state = TASK_BLOCKED;
+
+    getcontext(&task->ctx);
+    task->ctx.uc_stack.ss_sp = task->stack;
+    task->ctx.uc_stack.ss_size = SIM_TASK_STACK_SIZE;
+    task->ctx.uc_link = NULL;
+    makecontext(&task->ctx, task_entry, 0);
+
+    sim_schedule(now, task->node, task_resume, task, task->wake_token);
+
+    if (created != NULL)
+    {
+        *created = task;
+    }
+    return pdPASS;
+}
+
+/* The stack of a task starts out zeroed and grows down, the lowest byte which is not zero any more marks the deepest
+ * use. Returns the bytes of the SIM_TASK_STACK_SIZE host stack which stayed unused, the depth the firmware asked for
+ * does not apply as frames on the host are larger than on the ESP32 */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    const uint8_t *stack;
+    uint32_t unused = 0;
+
+    if (task == NULL)
+    {
+        task = current_task;
+    }
+    stack = task->stack;
+    while (unused < SIM_TASK_STACK_SIZE && stack[unused] == 0)
+    {
+        unused++;
+    }
+    return unused;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *const name, const uint32_t stack_depth, void *const param,
+                       UBaseType_t priority, TaskHandle_t *const created)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task)
+    {
+        current_task->state = TASK_DONE;
+        swapcontext(&current_task->ctx, &scheduler_ctx);
+        return;
+    }
+    // pending events of the task become stale, the stack is leaked on purpose as a resume event may still point at it
+    task->state = TASK_DONE;
+    task->wake_token++;
+}
+
+void vTaskDelay(const TickType_t ticks)
+{
+    task_block(now + (uint64_t)ticks * SIM_TICK_US);
+}
+
+void taskYIELD(void)
+{
+    task_block(now);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now / SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    switch (action)
+    {
+    case eSetBits:
+        task->notify_value |= value;
+        break;
+    case eIncrement:
+        task->notify_value++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notify_value = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notify_pending)
+        {
+            return pdFAIL;
+        }
+        task->notify_value = value;
+        break;
+    case eNoAction:
+        break;
+    }
+    task->notify_pending = true;
+    if (task->notify_waiting)
+    {
+        task_wake(task);
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    struct sim_task *task = current_task;
+    uint64_t deadline = deadline_of(ticks);
+
+    if (!task->notify_pending)
+    {
+        task->notify_value &= ~clear_on_entry;
+        if (ticks > 0)
+        {
+            task->notify_waiting = true;
+            task_block(deadline);
+            task->notify_waiting = false;
+        }
+    }
+
+    if (value != NULL)
+    {
+        *value = task->notify_value;
+    }
+    if (!task->notify_pending)
+    {
+        return pdFALSE;
+    }
+    task->notify_value &= ~clear_on_exit;
+    task->notify_pending = false;
+    return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct sim_task *task = current_task;
+    uint32_t value;
+
+    if (task->notify_value == 0 && ticks > 0)
+    {
+        task->notify_waiting = true;
+        task_block(deadline_of(ticks));
+        task->notify_waiting = false;
+    }
+
+    value = task->notify_value;
+    if (value != 0)
+    {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = false;
+    return value;
+}
+
+/* ----------------------------------------------- queues ----------------------------------------------- */
+
+static void wait_on(struct sim_task **list, uint64_t deadline)
+{
+    struct sim_task *task = current_task;
+
+    task->next_waiter = *list;
+    *list = task;
+    task_block(deadline);
+
+    // unlink again, woken tasks are already removed by wake_one
+    for (struct sim_task **it = list; *it != NULL; it = &(*it)->next_waiter)
+    {
+        if (*it == task)
+        {
+            *it = task->next_waiter;
+            break;
+        }
+    }
+}
+
+/* Wakes the task that waits longest */
+static void wake_one(struct sim_task **list)
+{
+    struct sim_task **it = list;
+
+    if (*it == NULL)
+    {
+        return;
+    }
+    while ((*it)->next_waiter != NULL)
+    {
+        it = &(*it)->next_waiter;
+    }
+    task_wake(*it);
+    *it = NULL;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *q = calloc(1, sizeof(struct sim_queue));
+
+    if (q == NULL)
+    {
+        return NULL;
+    }
+    q->length = length;
+    q->item_size = item_size;
+    if (item_size > 0)
+    {
+        q->storage = malloc((size_t)length * item_size);
+        if (q->storage == NULL)
+        {
+            free(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    struct sim_queue *q = xQueueCreate(max_count, 0);
+
+    if (q != NULL)
+    {
+        q->count = initial_count;
+    }
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    free(q->storage);
+    free(q);
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void *const item, TickType_t ticks, const BaseType_t position)
+{
+    uint64_t deadline = deadline_of(ticks);
+
+    while (true)
+    {
+        if (q->count < q->length)
+        {
+            if (q->item_size > 0)
+            {
+                UBaseType_t slot;
+                if (position == queueSEND_TO_FRONT)
+                {
+                    q->head = (q->head + q->length - 1) % q->length;
+                    slot = q->head;
+                }
+                else
+                {
+                    slot = (q->head + q->count) % q->length;
+                }
+                memcpy(q->storage + (size_t)slot * q->item_size, item, q->item_size);
+            }
+            q->count++;
+            wake_one(&q->rx_waiters);
+            return pdTRUE;
+        }
+
+        // callbacks run outside of any task and can not block
+        if (current_task == NULL || ticks == 0 || now >= deadline)
+        {
+            return errQUEUE_FULL;
+        }
+        wait_on(&q->tx_waiters, deadline);
+    }
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *const buffer, TickType_t ticks, bool peek)
+{
+    uint64_t deadline = deadline_of(ticks);
+
+    while (true)
+    {
+        if (q->count > 0)
+        {
+            if (q->item_size > 0 && buffer != NULL)
+            {
+                memcpy(buffer, q->storage + (size_t)q->head * q->item_size, q->item_size);
+            }
+            if (!peek)
+            {
+                if (q->item_size > 0)
+                {
+                    q->head = (q->head + 1) % q->length;
+                }
+                q->count--;
+                wake_one(&q->tx_waiters);
+            }
+            return pdTRUE;
+        }
+
+        if (current_task == NULL || ticks == 0 || now >= deadline)
+        {
+            return errQUEUE_EMPTY;
+        }
+        wait_on(&q->rx_waiters, deadline);
+    }
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *const buffer, TickType_t ticks)
+{
+    return queue_receive(q, buffer, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *const buffer, TickType_t ticks)
+{
+    return queue_receive(q, buffer, ticks, true);
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t q)
+{
+    return q->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t q)
+{
+    return q->length - q->count;
+}
+
+/* ----------------------------------------------- timers ----------------------------------------------- */
+
+static void timer_fire(sim_node_t *node, void *arg, uint64_t tag)
+{
+    struct sim_timer *timer = arg;
+
+    if (!timer->active || tag != timer->token)
+    {
+        return;
+    }
+    if (timer->auto_reload)
+    {
+        sim_schedule(now + (uint64_t)timer->period * SIM_TICK_US, node, timer_fire, timer, timer->token);
+    }
+    else
+    {
+        timer->active = false;
+    }
+    timer->callback(timer);
+}
+
+TimerHandle_t xTimerCreate(const char *const name, const TickType_t period, const UBaseType_t auto_reload, void *const id,
+                           TimerCallbackFunction_t callback)
+{
+    struct sim_timer *timer = calloc(1, sizeof(struct sim_timer));
+
+    assert(current_node != NULL);
+    if (timer == NULL)
+    {
+        return NULL;
+    }
+    timer->node = current_node;
+    timer->name = name;
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->id = id;
+    timer->callback = callback;
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+    timer->active = true;
+    timer->token++;
+    sim_schedule(now + (uint64_t)timer->period * SIM_TICK_US, timer->node, timer_fire, timer, timer->token);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks)
+{
+    return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+    timer->active = false;
+    timer->token++;
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks)
+{
+    timer->period = period;
+    return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    return timer->active;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks)
+{
+    // the timer may still be referenced by a scheduled event, it is only deactivated
+    xTimerStop(timer, ticks);
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(const TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+/* ----------------------------------------------- logging and errors ----------------------------------------------- */
+
+static void log_prefix(FILE *out)
+{
+    if (current_node != NULL)
+    {
+        fprintf(out, "[%10.6f] node %4d: ", now / 1e6, current_node->id);
+    }
+    else
+    {
+        fprintf(out, "[%10.6f] sim: ", now / 1e6);
+    }
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "-EWIDV";
+    va_list args;
+
+    if (level > log_level)
+    {
+        return;
+    }
+    log_prefix(stderr);
+    fprintf(stderr, "%c (%s) ", letters[level], tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+/* Console output of the firmware, only shown with the highest verbosity */
+int sim_printf(const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    if (log_level < ESP_LOG_VERBOSE)
+    {
+        return 0;
+    }
+    log_prefix(stdout);
+    va_start(args, format);
+    len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
+
+void *sim_malloc(size_t size)
+{
+    sim_heap_allocs++;
+    if (current_node != NULL)
+    {
+        current_node->heap_allocs++;
+        current_node->heap_bytes += size;
+    }
+    return malloc(size);
+}
+
+/* ESP_ERROR_CHECK aborts the ESP32. Here only the failing node crashes, the rest of the network keeps running */
+void sim_error_check_failed(esp_err_t rc, const char *file, int line, const char *expression)
+{
+    sim_node_t *node = current_node;
+
+    if (node == NULL)
+    {
+        fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n", rc, esp_err_to_name(rc),
+                file, line, expression);
+        abort();
+    }
+
+    sim_log(ESP_LOG_ERROR, "sim", "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d, node crashed", rc,
+            esp_err_to_name(rc), file, line);
+    node->crashed = true;
+
+    if (current_task != NULL)
+    {
+        current_task->state = TASK_DONE;
+        swapcontext(&current_task->ctx, &scheduler_ctx);
+    }
+    longjmp(abort_jmp, 1);
+}
@@ -0,0 +1,123 @@
+/*
+ * sim.h (host port)
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Interface between the host stand-ins of ESP-IDF / FreeRTOS and the network simulator. All nodes live in one
+ * process: the firmware state tagged with NODE_STATE is swapped whenever the event loop switches to another node,
+ * every FreeRTOS task is a coroutine and time only advances from one event to the next.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define SIM_FOREVER UINT64_MAX
+#define SIM_HEAP_SIZE (280 * 1024) // free heap of an ESP32 after the WiFi driver started
+#define SIM_TASK_STACK_SIZE (64 * 1024)
+#define SIM_TICK_US (1000000ULL / configTICK_RATE_HZ)
+#define SIM_MS(ms) ((uint64_t)(ms) * 1000ULL)
+#define SIM_SEC(s) ((uint64_t)(s) * 1000000ULL)
+
+typedef struct sim_node sim_node_t;
+typedef struct sim_frame sim_frame_t;
+
+typedef void (*sim_event_fn_t)(sim_node_t *node, void *arg, uint64_t tag);
+typedef void (*sim_observer_t)(sim_node_t *node);
+
+/* Radio hooks of the simulator, called for every frame handed to esp_now_send and for every delivered frame */
+typedef void (*sim_tx_hook_t)(sim_node_t *node, const uint8_t *dst_mac, const uint8_t *data, int len);
+typedef void (*sim_rx_hook_t)(sim_node_t *node, sim_node_t *from, const uint8_t *data, int len);
+
+struct sim_node
+{
+    int id;
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    double x;
+    double y;
+    uint8_t *state; // saved NODE_STATE section while the node is not running
+    bool booted;
+    bool crashed;
+    uint64_t heap_allocs; // malloc calls of the firmware
+    uint64_t heap_bytes;  // bytes the firmware allocated
+
+    /* radio */
+    int *links; // indices of the nodes in radio range
+    int links_len;
+    bool espnow_init;
+    esp_now_recv_cb_t recv_cb;
+    esp_now_send_cb_t send_cb;
+    uint8_t peers[ESP_NOW_MAX_TOTAL_PEER_NUM][ESP_NOW_ETH_ALEN];
+    int peers_len;
+    sim_frame_t *tx_head;
+    sim_frame_t *tx_tail;
+    int tx_len;
+    bool tx_busy;                // a frame of the tx queue is being served
+    uint64_t tx_until;           // end of the frame currently on air
+    uint64_t channel_busy_until; // carrier sense, end of the last frame heard
+    sim_frame_t *rx_frame;       // frame currently being received
+    uint64_t rx_until;
+    bool rx_corrupt;
+
+    void *user; // per node data of the simulator
+};
+
+typedef struct
+{
+    double range;      // meters
+    double loss;       // independent loss probability per receiver and attempt
+    double edge_loss;  // additional loss probability at the edge of the range, grows with (distance / range)^4
+    uint32_t bitrate;  // bit/s
+    int tx_queue_size; // frames the driver accepts before esp_now_send returns ESP_ERR_ESPNOW_NO_MEM
+    int mac_retries;   // retransmissions of an unacknowledged unicast frame
+} sim_radio_config_t;
+
+typedef struct
+{
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t airtime_us;
+    uint64_t retries;
+    uint64_t collisions;
+    uint64_t lost;
+    uint64_t delivered;
+    uint64_t send_no_mem;
+    uint64_t send_fail;
+} sim_radio_stats_t;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* sim-rtos.c */
+extern uint64_t sim_heap_allocs; // malloc calls of the firmware, of all nodes and outside of the simulation
+void sim_init(int nodes_len, uint64_t seed);
+void sim_deinit(void);
+int sim_nodes_len(void);
+sim_node_t *sim_node(int id);
+sim_node_t *sim_current_node(void);
+uint64_t sim_now(void);
+void sim_schedule(uint64_t at, sim_node_t *node, sim_event_fn_t fn, void *arg, uint64_t tag);
+void sim_boot(sim_node_t *node, uint64_t at, void (*entry)(void));
+void sim_run_until(uint64_t until);
+void sim_set_observer(sim_observer_t observer);
+void sim_set_log_level(esp_log_level_t level);
+uint32_t sim_random(void);
+uint32_t sim_firmware_random(void);
+uint32_t sim_random_stream(uint64_t *state);
+double sim_random_uniform(void);
+
+/* sim-radio.c */
+extern sim_radio_config_t sim_radio_config;
+extern sim_radio_stats_t sim_radio_stats;
+void sim_radio_connect(void);
+void sim_radio_set_hooks(sim_tx_hook_t tx_hook, sim_rx_hook_t rx_hook);
+void sim_radio_inject(sim_node_t *node, const uint8_t *src_mac, const uint8_t *data, int len);
+
+#endif
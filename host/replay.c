@@ -0,0 +1,379 @@
+/*
+ * replay.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Replays a packet trace (trace.c) through the firmware on the host. The trace is either a trace file, as the
+ * simulator writes it (--trace), or the "trace-header" and "trace" lines trace_dump printed over the serial console.
+ * One node with the MAC address of the traced node boots and every received frame of the trace is handed to its
+ * receive callback at the time it was recorded, relative to the start of the trace. Time is virtual, so the replay
+ * runs as fast as the firmware handles the frames: the frames go through the receive ring, handle_vcp_message and the
+ * join of the virtual cord like over the air. Only the first TRACE_HEAD_LEN bytes of a frame are recorded, the rest
+ * of a longer frame is replayed as zeros.
+ * The report compares what the replayed node did with every frame to the decision in the trace and shows the frames
+ * the firmware handled per second of wall time. The frames the replayed node sends reach no neighbor, so its unicasts
+ * fail and fill the windows of the link layer, the decisions drift apart where the traced node depended on them.
+ * With --list the trace is printed instead.
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "vcp.h"
+#include "trace.h"
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define DECISIONS 8 // received frames: TRACE_HANDLED to TRACE_MALFORMED, sent frames: SENT and SEND_FAILED
+
+typedef struct
+{
+    trace_header_t header;
+    trace_entry_t *entries;
+    uint32_t len;
+    uint32_t cap;
+} trace_t;
+
+typedef struct
+{
+    int repeat;
+    bool list;
+    uint64_t seed;
+    esp_log_level_t log_level;
+} options_t;
+
+void app_main(void);
+
+static options_t opt = {
+    .repeat = 1,
+    .seed = 1,
+    .log_level = ESP_LOG_NONE,
+};
+
+static const char *decisions[DECISIONS] = {
+    "handled", "forwarded", "link layer", "refused", "dropped", "malformed", "sent", "send failed",
+};
+static const char *types[VCP_MESSAGE_TYPES] = {
+    "HELLO", "UPDATE_SUCC", "UPDATE_PRED", "CREATE_VNODE", "DATA",        "ERR",
+    "ACK",   "FRAGMENT",    "STREAM_ACK",  "DATA_BUNDLE",  "METRICS_REQ", "METRICS",
+};
+
+static trace_t recorded;
+static trace_t replayed;
+static uint32_t replay_cursor; // next entry of the trace of the replayed node to collect
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+static void trace_append(trace_t *trace, const trace_entry_t *entry)
+{
+    if (trace->len == trace->cap)
+    {
+        trace->cap = trace->cap == 0 ? 1024 : 2 * trace->cap;
+        trace->entries = realloc(trace->entries, trace->cap * sizeof(trace_entry_t));
+        if (trace->entries == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    trace->entries[trace->len++] = *entry;
+}
+
+/* Parses len bytes of hex into out, returns false if the text is no hex string of exactly that length */
+static bool parse_hex(const char *text, void *out, size_t len)
+{
+    uint8_t *bytes = out;
+    unsigned int byte;
+
+    if (strlen(text) != 2 * len)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (sscanf(&text[2 * i], "%2x", &byte) != 1)
+        {
+            return false;
+        }
+        bytes[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+/* Reads the lines of trace_dump, other lines of the serial log are skipped */
+static bool read_dump(FILE *f, trace_t *trace)
+{
+    char line[256], hex[256];
+    trace_entry_t entry;
+    bool header = false;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "trace-header %255s", hex) == 1)
+        {
+            header = parse_hex(hex, &trace->header, sizeof(trace->header));
+            trace->len = 0;
+        }
+        else if (header && sscanf(line, "trace %255s", hex) == 1 && parse_hex(hex, &entry, sizeof(entry)))
+        {
+            trace_append(trace, &entry);
+        }
+    }
+    return header;
+}
+
+static bool read_trace(const char *path, trace_t *trace)
+{
+    FILE *f = fopen(path, "rb");
+    trace_entry_t entry;
+    bool ok;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    if (fread(&trace->header, sizeof(trace->header), 1, f) == 1 && memcmp(trace->header.magic, "VCPT", 4) == 0)
+    {
+        ok = trace->header.version == TRACE_VERSION && trace->header.entry_len == sizeof(trace_entry_t);
+        while (ok && fread(&entry, sizeof(entry), 1, f) == 1)
+        {
+            trace_append(trace, &entry);
+        }
+    }
+    else
+    {
+        rewind(f);
+        ok = read_dump(f, trace);
+    }
+    fclose(f);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: no packet trace of version %d\n", path, TRACE_VERSION);
+    }
+    return ok;
+}
+
+/* Time of the entry relative to the start of the trace, the recorded time wraps after 71 min */
+static uint64_t entry_time(const trace_t *trace, const trace_entry_t *entry)
+{
+    return (uint32_t)(entry->time_us - trace->header.started_us);
+}
+
+static int decision_index(uint8_t decision)
+{
+    int index = decision & TRACE_TX ? 6 + (decision & ~TRACE_TX) : decision;
+
+    return index < DECISIONS ? index : DECISIONS - 1;
+}
+
+static void list_trace(const trace_t *trace)
+{
+    const trace_entry_t *e;
+    uint8_t type;
+
+    for (uint32_t i = 0; i < trace->len; i++)
+    {
+        e = &trace->entries[i];
+        type = e->head[1]; // of the vcp_header_t
+        printf("%12.6f %s %02x:%02x:%02x:%02x:%02x:%02x %-12s %3u bytes %s\n", entry_time(trace, e) / 1e6,
+               e->decision & TRACE_TX ? "tx" : "rx", e->mac_addr[0], e->mac_addr[1], e->mac_addr[2], e->mac_addr[3],
+               e->mac_addr[4], e->mac_addr[5], type < VCP_MESSAGE_TYPES ? types[type] : "?", e->len,
+               decisions[decision_index(e->decision)]);
+    }
+}
+
+/* Hands a received frame of the trace to the receive callback of the node */
+static void inject(sim_node_t *node, void *arg, uint64_t tag)
+{
+    const trace_entry_t *e = arg;
+    uint8_t frame[ESP_NOW_MAX_DATA_LEN] = {0};
+
+    memcpy(frame, e->head, e->len < TRACE_HEAD_LEN ? e->len : TRACE_HEAD_LEN);
+    sim_radio_inject(node, e->mac_addr, frame, e->len);
+}
+
+/* Collects the trace of the replayed node after each of its events, before the ring wraps */
+static void observe(sim_node_t *node)
+{
+    trace_entry_t entries[32];
+    uint32_t len;
+
+    while ((len = trace_export(entries, sizeof(entries) / sizeof(entries[0]), &replay_cursor)) > 0)
+    {
+        for (uint32_t i = 0; i < len; i++)
+        {
+            trace_append(&replayed, &entries[i]);
+        }
+    }
+}
+
+/* Replays the trace once, returns the wall time it took in s */
+static double replay(void)
+{
+    struct timespec t0, t1;
+    sim_node_t *node;
+    uint64_t end = 0;
+
+    replayed.len = 0;
+    replay_cursor = 0;
+    sim_init(1, opt.seed);
+    sim_set_log_level(opt.log_level);
+    node = sim_node(0);
+    memcpy(node->mac, recorded.header.mac_addr, ESP_NOW_ETH_ALEN);
+    sim_radio_connect();
+    sim_set_observer(observe);
+
+    sim_boot(node, 0, app_main);
+    for (uint32_t i = 0; i < recorded.len; i++)
+    {
+        const trace_entry_t *e = &recorded.entries[i];
+        if (!(e->decision & TRACE_TX))
+        {
+            sim_schedule(entry_time(&recorded, e), node, inject, (void *)e, 0);
+        }
+        end = entry_time(&recorded, e) > end ? entry_time(&recorded, e) : end;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sim_run_until(end + SIM_SEC(1));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sim_deinit();
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/* Compares the decisions of the replay to the recorded ones, the received frames in the order of the trace */
+static void report(double wall)
+{
+    uint32_t counts[2][DECISIONS] = {0};
+    uint32_t rx[2] = {0}, same = 0, r = 0;
+    const trace_t *traces[2] = {&recorded, &replayed};
+
+    for (int t = 0; t < 2; t++)
+    {
+        for (uint32_t i = 0; i < traces[t]->len; i++)
+        {
+            counts[t][decision_index(traces[t]->entries[i].decision)]++;
+            rx[t] += !(traces[t]->entries[i].decision & TRACE_TX);
+        }
+    }
+    for (uint32_t i = 0; i < recorded.len; i++)
+    {
+        const trace_entry_t *e = &recorded.entries[i];
+        if (e->decision & TRACE_TX)
+        {
+            continue;
+        }
+        while (r < replayed.len && (replayed.entries[r].decision & TRACE_TX))
+        {
+            r++;
+        }
+        if (r == replayed.len)
+        {
+            break;
+        }
+        same += replayed.entries[r].decision == e->decision && replayed.entries[r].len == e->len &&
+                memcmp(replayed.entries[r].head, e->head, TRACE_HEAD_LEN) == 0;
+        r++;
+    }
+
+    printf("trace         %02x:%02x:%02x:%02x:%02x:%02x, %u entries over %.3f s\n", recorded.header.mac_addr[0],
+           recorded.header.mac_addr[1], recorded.header.mac_addr[2], recorded.header.mac_addr[3],
+           recorded.header.mac_addr[4], recorded.header.mac_addr[5], recorded.len,
+           recorded.len > 0 ? entry_time(&recorded, &recorded.entries[recorded.len - 1]) / 1e6 : 0.0);
+    for (int d = 0; d < DECISIONS; d++)
+    {
+        if (counts[0][d] + counts[1][d] > 0)
+        {
+            printf("%-13s %u recorded, %u replayed\n", decisions[d], counts[0][d], counts[1][d]);
+        }
+    }
+    printf("decisions     %u of %u received frames handled like in the trace (%.1f %%)\n", same, rx[0],
+           rx[0] > 0 ? 100.0 * same / rx[0] : 0.0);
+    printf("replayed      %u received frames in %.3f s wall time, %.0f frames per s (best of %d)\n", rx[1], wall,
+           wall > 0 ? rx[1] / wall : 0.0, opt.repeat);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] TRACE\n"
+            "  TRACE                   trace file of vcp_sim --trace, or a serial log with the output of trace_dump\n"
+            "  -l, --list              print the trace instead of replaying it\n"
+            "  -r, --repeat N          replay N times and report the fastest run (%d)\n"
+            "  -x, --seed N            random seed of the firmware (%llu)\n"
+            "  -v, --verbose           firmware log output, repeat for more\n",
+            prog, opt.repeat, (unsigned long long)opt.seed);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"list", no_argument, NULL, 'l'},
+        {"repeat", required_argument, NULL, 'r'},
+        {"seed", required_argument, NULL, 'x'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    double wall, best = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "lr:x:vh", options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'l':
+            opt.list = true;
+            break;
+        case 'r':
+            opt.repeat = atoi(optarg);
+            break;
+        case 'x':
+            opt.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'v':
+            opt.log_level = opt.log_level == ESP_LOG_NONE ? ESP_LOG_ERROR : opt.log_level + 1;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1 || opt.repeat < 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (!read_trace(argv[optind], &recorded))
+    {
+        return 1;
+    }
+
+    if (opt.list)
+    {
+        list_trace(&recorded);
+    }
+    else
+    {
+        for (int i = 0; i < opt.repeat; i++)
+        {
+            wall = replay();
+            best = i == 0 || wall < best ? wall : best;
+        }
+        report(best);
+    }
+    free(recorded.entries);
+    free(replayed.entries);
+    return 0;
+}
@@ -0,0 +1,1558 @@
+/*
+ * simulator.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Discrete event network simulator for the virtual cord protocol. Every node runs the unmodified firmware
+ * (src/) on top of the host stand-ins in port/. The simulator
+ * - places the nodes (line, grid or random topology) and boots them one after another, breadth first from node 0
+ * - lets the cord settle and records when every node joined and when the last position changed
+ * - sends DATA messages between random pairs of joined nodes through vcp_data_send and the receive callback of
+ *   vcp_data_register and follows them over the air, or sends one stream transfer per flow (--bulk), or makes one
+ *   node per flow a generator of the perf mode of vcp.c (--perf)
+ * - writes the packet trace of one node to a file (--trace), which host/replay.c feeds back into the firmware
+ * and finally reports join convergence, hop counts, delivery ratio and per packet latency.
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "packet-pool.h"
+#include "vcp-message.h"
+#include "vcp.h"
+#include "link-layer.h"
+#include "receive-ring.h"
+#include "sender-receiver.h"
+#include "neighbor-table.h"
+#include "metrics.h"
+#include "trace.h"
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define PACKET_TAG "sim#" // followed by the packet id as uint32_t, the DATA messages carry binary payloads
+#define PACKET_LEN (sizeof(PACKET_TAG) - 1 + sizeof(uint32_t))
+#define MAX_RECORDS 32 // DATA messages per DATA_BUNDLE, a record takes at least 11 bytes
+
+typedef enum
+{
+    TOPOLOGY_LINE,
+    TOPOLOGY_GRID,
+    TOPOLOGY_RANDOM,
+} topology_t;
+
+typedef struct
+{
+    int nodes;
+    topology_t topology;
+    double spacing;
+    uint64_t seed;
+    uint64_t boot_interval;
+    uint64_t settle;
+    int packets;
+    int flows;
+    bool replies;
+    uint32_t bulk;
+    uint16_t budget;
+    int fail;
+    uint64_t recover;
+    double rate;
+    uint64_t drain;
+    uint64_t perf;       // time the perf generators run, 0 for the injected DATA messages
+    uint8_t perf_len;    // payload bytes of a perf message
+    bool metrics;
+    const char *trace; // file the packet trace of trace_node is written to, NULL for none
+    int trace_node;
+    esp_log_level_t log_level;
+} options_t;
+
+typedef struct
+{
+    vcp_position_t position;
+    uint64_t joined_at;
+    uint64_t changed_at;
+    uint32_t changes;
+    uint32_t data_tx;
+    uint64_t first_data_tx;
+    uint64_t last_data_tx;
+    packet_pool_stats_t pool;
+    vcp_route_cache_stats_t routes;
+    link_stats_t links[VCP_MAX_NEIGHBORS];
+    vcp_stream_stats_t streams;
+    vcp_hello_stats_t hellos;
+    peer_cache_stats_t peers;
+    receive_ring_stats_t ring;
+    traffic_class_stats_t classes[TRAFFIC_CLASSES];
+    metrics_snapshot_t metrics; // taken right before the report
+    vcp_perf_stats_t perf;      // generator and sink of the perf mode, taken right before the report
+    uint32_t hellos_in_traffic; // HELLOs sent after the settle time
+    uint8_t neighbors;          // entries of the neighbor table
+    uint8_t stale_neighbors;    // entries of switched off nodes
+    uint64_t heap_allocs_before_traffic;
+} node_info_t;
+
+typedef struct
+{
+    int src;
+    int dst;
+    vcp_position_t recipient;
+    uint64_t injected_at;
+    uint64_t delivered_at;
+    uint16_t budget; // ms, latency budget the message is sent with, 0 for none
+    uint32_t transmissions;
+    bool delivered;
+    int holder; // node which received the packet last and has not sent it on yet
+    uint64_t held_since;
+} packet_t;
+
+typedef struct
+{
+    int src;
+    int dst;
+    uint8_t *data;
+    int stream;        // id the destination got the transfer with, -1 before its first fragment
+    uint32_t received; // bytes handed to the receive callback of the destination
+    uint32_t corrupt;  // bytes which differ from the ones sent
+    uint64_t started_at;
+    uint64_t received_at; // last byte handed to the receive callback
+    esp_err_t status;     // of the sent callback
+    bool done;            // the sent callback was called
+} transfer_t;
+
+/* Generator of the perf mode and its sink, the statistics of the sink include all generators which send to it */
+typedef struct
+{
+    int src;
+    int dst;
+    esp_err_t status; // of vcp_perf_start
+} perf_flow_t;
+
+typedef struct
+{
+    uint64_t *values;
+    int len;
+    int cap;
+} samples_t;
+
+#define METRICS_ATTEMPTS 5 // requests per missing page, 2 s apart
+#define METRICS_PAGES ((sizeof(metrics_snapshot_t) + VCP_METRICS_PAGE_LEN - 1) / VCP_METRICS_PAGE_LEN)
+
+/* Snapshot one node fetches from another one over the cord (--metrics) */
+typedef struct
+{
+    int src;
+    int dst;
+    uint8_t bytes[sizeof(metrics_snapshot_t)];
+    bool received[METRICS_PAGES];
+    uint32_t unexpected; // METRICS messages which did not fit the request
+    int attempts;
+    uint64_t requested_at;
+    uint64_t completed_at;
+} metrics_fetch_t;
+
+void app_main(void);
+
+static options_t opt = {
+    .nodes = 200,
+    .topology = TOPOLOGY_GRID,
+    .spacing = 10.0,
+    .seed = 1,
+    .boot_interval = SIM_MS(500),
+    .settle = SIM_SEC(10),
+    .packets = 200,
+    .flows = 0,
+    .replies = false,
+    .bulk = 0,
+    .rate = 20.0,
+    .drain = SIM_SEC(10),
+    .perf_len = VCP_PERF_PAYLOAD_LEN,
+    .log_level = ESP_LOG_NONE,
+};
+
+static node_info_t *info;
+static packet_t *packets;
+static int packets_len;
+static uint64_t traffic_start;
+static int *failed; // nodes switched off by --fail
+static int failed_len;
+static uint32_t misdelivered;
+static samples_t hop_delays;
+static transfer_t *transfers;
+static int transfers_len;
+static perf_flow_t *perf_flows;
+static int perf_flows_len;
+static metrics_fetch_t fetch = {.src = -1};
+static FILE *trace_file;
+static uint32_t trace_cursor; // next entry of the trace of opt.trace_node to write
+static uint32_t trace_written;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, int len, double p)
+{
+    int i = (int)ceil(p * len) - 1;
+    return len == 0 ? 0 : sorted[i < 0 ? 0 : i];
+}
+
+static void samples_add(samples_t *s, uint64_t value)
+{
+    if (s->len == s->cap)
+    {
+        s->cap = s->cap ? 2 * s->cap : 256;
+        s->values = realloc(s->values, s->cap * sizeof(uint64_t));
+    }
+    s->values[s->len++] = value;
+}
+
+/* Decodes the DATA messages of a frame, a DATA_BUNDLE carries several of them. Returns how many were stored in msgs */
+static int data_messages(const uint8_t *data, int len, vcp_message_t msgs[MAX_RECORDS])
+{
+    vcp_message_t msg;
+    uint8_t offset = 0;
+    int count = 0;
+
+    if (vcp_decode(data, len, &msg) != ESP_OK)
+    {
+        return 0;
+    }
+    if (msg.type == VCP_DATA)
+    {
+        msgs[0] = msg;
+        return 1;
+    }
+    while (msg.type == VCP_DATA_BUNDLE && count < MAX_RECORDS && vcp_bundle_next(&msg, &offset, &msgs[count]))
+    {
+        count++;
+    }
+    return count;
+}
+
+/* Extracts the packet id of a DATA payload created by the simulator, -1 for any other payload */
+static int packet_id(const uint8_t *data, uint8_t len)
+{
+    uint32_t id;
+
+    if (len != PACKET_LEN || memcmp(data, PACKET_TAG, strlen(PACKET_TAG)) != 0)
+    {
+        return -1;
+    }
+    memcpy(&id, data + strlen(PACKET_TAG), sizeof(id));
+    return id < (uint32_t)packets_len ? (int)id : -1;
+}
+
+static int packet_of(const vcp_message_t *msg)
+{
+    return packet_id(msg->data.payload, msg->data.payload_len);
+}
+
+/* Runs after every event of a node while its state is swapped in */
+/* Appends the entries the traced node recorded since the last call to the trace file, the header goes first */
+static void save_trace(void)
+{
+    trace_entry_t entries[32];
+    trace_header_t header;
+    uint32_t len;
+
+    while ((len = trace_export(entries, sizeof(entries) / sizeof(entries[0]), &trace_cursor)) > 0)
+    {
+        if (trace_written == 0)
+        {
+            trace_header(&header);
+            fwrite(&header, sizeof(header), 1, trace_file);
+        }
+        fwrite(entries, sizeof(trace_entry_t), len, trace_file);
+        trace_written += len;
+    }
+}
+
+static void observe(sim_node_t *node)
+{
+    node_info_t *n = &info[node->id];
+
+    if (trace_file != NULL && node->id == opt.trace_node)
+    {
+        // after every event of the node, so that no entry is overwritten before it is written
+        save_trace();
+    }
+
+    if (own_position != n->position)
+    {
+        if (n->position == VCP_INITIAL)
+        {
+            n->joined_at = sim_now();
+        }
+        n->position = own_position;
+        n->changed_at = sim_now();
+        n->changes++;
+    }
+    packet_pool_get_stats(&n->pool);
+    vcp_get_route_cache_stats(&n->routes);
+    for (int8_t i = 0; i < VCP_MAX_NEIGHBORS; i++)
+    {
+        link_get_stats(i, neighbors[i].mac_addr, &n->links[i]);
+    }
+    vcp_get_stream_stats(&n->streams);
+    vcp_get_hello_stats(&n->hellos);
+    peer_cache_get_stats(&n->peers);
+    receiver_get_ring_stats(&n->ring);
+    for (uint8_t c = 0; c < TRAFFIC_CLASSES; c++)
+    {
+        sender_get_class_stats(c, &n->classes[c]);
+    }
+    n->neighbors = neighbors_len;
+    n->stale_neighbors = 0;
+    for (int r = 0; r < neighbors_len; r++)
+    {
+        for (int k = 0; k < failed_len; k++)
+        {
+            n->stale_neighbors += memcmp(neighbors[neighbor_at(r)].mac_addr, sim_node(failed[k])->mac,
+                                         ESP_NOW_ETH_ALEN) == 0;
+        }
+    }
+}
+
+static void on_tx(sim_node_t *node, const uint8_t *dst_mac, const uint8_t *data, int len)
+{
+    vcp_message_t msgs[MAX_RECORDS];
+    int count = data_messages(data, len, msgs);
+    vcp_header_t header;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.type == VCP_HELLO && traffic_start > 0 && sim_now() >= traffic_start)
+    {
+        info[node->id].hellos_in_traffic++;
+    }
+    for (int m = 0; m < count; m++)
+    {
+        int id = packet_of(&msgs[m]);
+        node_info_t *n = &info[node->id];
+        packet_t *p;
+
+        if (id < 0 || id >= packets_len)
+        {
+            continue;
+        }
+        p = &packets[id];
+
+        p->transmissions++;
+        if (p->holder == node->id)
+        {
+            samples_add(&hop_delays, sim_now() - p->held_since);
+            p->holder = -1;
+        }
+        if (n->data_tx++ == 0)
+        {
+            n->first_data_tx = sim_now();
+        }
+        n->last_data_tx = sim_now();
+    }
+}
+
+static void on_rx(sim_node_t *node, sim_node_t *from, const uint8_t *data, int len)
+{
+    vcp_message_t msgs[MAX_RECORDS];
+    int count = data_messages(data, len, msgs);
+
+    for (int m = 0; m < count; m++)
+    {
+        int id = packet_of(&msgs[m]);
+        packet_t *p;
+
+        if (id < 0 || id >= packets_len)
+        {
+            continue;
+        }
+        p = &packets[id];
+        p->holder = node->id;
+        p->held_since = sim_now();
+    }
+}
+
+/* Receive callback of the DATA messages (vcp_data_register), gets the payload in the frame of the firmware */
+static void on_data(vcp_position_t source, const uint8_t *data, uint8_t len)
+{
+    int id = packet_id(data, len);
+    packet_t *p;
+
+    if (id < 0)
+    {
+        return;
+    }
+    p = &packets[id];
+    if (sim_current_node()->id != p->dst)
+    {
+        misdelivered++;
+    }
+    else if (!p->delivered)
+    {
+        p->delivered = true;
+        p->delivered_at = sim_now();
+    }
+}
+
+/* Sends packet tag like an application would: the payload is written into the frame buffer of vcp_data_alloc */
+static void inject(sim_node_t *node, void *arg, uint64_t tag)
+{
+    packet_t *p = &packets[tag];
+    uint32_t id = (uint32_t)tag;
+    uint8_t *data = vcp_data_alloc();
+
+    p->recipient = info[p->dst].position;
+    p->injected_at = sim_now();
+    if (data == NULL)
+    {
+        return;
+    }
+    memcpy(data, PACKET_TAG, strlen(PACKET_TAG));
+    memcpy(data + strlen(PACKET_TAG), &id, sizeof(id));
+    if (vcp_data_send(p->recipient, data, PACKET_LEN, p->budget) != ESP_OK)
+    {
+        vcp_data_free(data);
+        return;
+    }
+    // the source holds the packet until it sends it
+    p->holder = node->id;
+    p->held_since = sim_now();
+}
+
+static void register_data_callback(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_data_register(on_data);
+}
+
+/* Content of byte offset of transfer k, so that the destination can check every byte it gets */
+static uint8_t bulk_byte(int k, uint32_t offset)
+{
+    return (uint8_t)(offset * 131 + (offset >> 8) + k * 17);
+}
+
+static void on_stream_receive(vcp_position_t source, uint16_t stream, uint32_t offset, const uint8_t *data, uint8_t len,
+                              uint32_t total_len)
+{
+    int id = sim_current_node()->id;
+
+    for (int k = 0; k < transfers_len; k++)
+    {
+        transfer_t *t = &transfers[k];
+        if (t->dst != id || info[t->src].position != source || total_len != opt.bulk)
+        {
+            continue;
+        }
+        // fragments arrive in order, the first one tells which of the transfers between the two nodes it is
+        if (t->stream == -1 && offset == 0 && memcmp(data, t->data, len) == 0)
+        {
+            t->stream = stream;
+        }
+        if (t->stream != stream || t->received != offset)
+        {
+            continue;
+        }
+        for (int i = 0; i < len; i++)
+        {
+            t->corrupt += data[i] != bulk_byte(k, offset + i);
+        }
+        t->received += len;
+        t->received_at = sim_now();
+        return;
+    }
+}
+
+static void on_stream_sent(const uint8_t *data, uint32_t len, esp_err_t status)
+{
+    for (int k = 0; k < transfers_len; k++)
+    {
+        if (transfers[k].data == data)
+        {
+            transfers[k].done = true;
+            transfers[k].status = status;
+        }
+    }
+}
+
+static void start_transfer(sim_node_t *node, void *arg, uint64_t tag)
+{
+    transfer_t *t = &transfers[tag];
+
+    vcp_stream_register(on_stream_receive, on_stream_sent);
+    t->started_at = sim_now();
+    t->status = vcp_stream_send(info[t->dst].position, t->data, opt.bulk);
+    t->done = t->status != ESP_OK;
+}
+
+static void register_stream_callbacks(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_stream_register(on_stream_receive, on_stream_sent);
+}
+
+static void start_perf(sim_node_t *node, void *arg, uint64_t tag)
+{
+    perf_flow_t *f = &perf_flows[tag];
+
+    f->status = vcp_perf_start(info[f->dst].position, (uint16_t)opt.rate, opt.perf_len);
+}
+
+static void stop_perf(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_perf_stop();
+}
+
+static void collect_perf(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_perf_get_stats(&info[node->id].perf);
+}
+
+static void collect_metrics(sim_node_t *node, void *arg, uint64_t tag)
+{
+    metrics_snapshot(&info[node->id].metrics);
+}
+
+static void on_metrics(vcp_position_t source, uint16_t offset, const uint8_t *data, uint8_t len, uint16_t total_len)
+{
+    bool complete = true;
+
+    if (sim_current_node()->id != fetch.src || source != info[fetch.dst].position || total_len != sizeof(fetch.bytes) ||
+        offset % VCP_METRICS_PAGE_LEN != 0 || offset + len > sizeof(fetch.bytes))
+    {
+        fetch.unexpected++;
+        return;
+    }
+    memcpy(&fetch.bytes[offset], data, len);
+    fetch.received[offset / VCP_METRICS_PAGE_LEN] = true;
+    for (int page = 0; page < METRICS_PAGES; page++)
+    {
+        complete = complete && fetch.received[page];
+    }
+    if (complete && fetch.completed_at == 0)
+    {
+        fetch.completed_at = sim_now();
+    }
+}
+
+static void request_metrics(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_metrics_register(on_metrics);
+    fetch.attempts++;
+    for (int page = 0; page < METRICS_PAGES; page++)
+    {
+        if (!fetch.received[page] &&
+            vcp_metrics_request(info[fetch.dst].position, page * VCP_METRICS_PAGE_LEN) != ESP_OK)
+        {
+            fetch.unexpected++;
+        }
+    }
+}
+
+static void place_nodes(void)
+{
+    int n = opt.nodes;
+    int side = (int)ceil(sqrt(n));
+
+    for (int i = 0; i < n; i++)
+    {
+        sim_node_t *node = sim_node(i);
+        switch (opt.topology)
+        {
+        case TOPOLOGY_LINE:
+            node->x = i * opt.spacing;
+            node->y = 0.0;
+            break;
+        case TOPOLOGY_GRID:
+            node->x = (i % side) * opt.spacing;
+            node->y = (i / side) * opt.spacing;
+            break;
+        case TOPOLOGY_RANDOM:
+            // same density as the grid
+            node->x = sim_random_uniform() * side * opt.spacing;
+            node->y = sim_random_uniform() * side * opt.spacing;
+            break;
+        }
+    }
+    sim_radio_connect();
+}
+
+/* Boots the nodes breadth first, so that every node (except the first of each component) finds joined neighbors */
+static uint64_t boot_nodes(int *components)
+{
+    int n = opt.nodes;
+    int *order = malloc(n * sizeof(int));
+    bool *seen = calloc(n, sizeof(bool));
+    int head = 0, tail = 0;
+    uint64_t at = 0;
+
+    *components = 0;
+    for (int root = 0; root < n; root++)
+    {
+        if (seen[root])
+        {
+            continue;
+        }
+        (*components)++;
+        seen[root] = true;
+        order[tail++] = root;
+        while (head < tail)
+        {
+            sim_node_t *node = sim_node(order[head++]);
+            for (int i = 0; i < node->links_len; i++)
+            {
+                if (!seen[node->links[i]])
+                {
+                    seen[node->links[i]] = true;
+                    order[tail++] = node->links[i];
+                }
+            }
+        }
+    }
+
+    // real nodes never power up in lockstep, the jitter keeps their periodic tasks from being aligned
+    for (int i = 0; i < n; i++)
+    {
+        at = i * opt.boot_interval + (uint64_t)(sim_random_uniform() * opt.boot_interval / 2);
+        sim_boot(sim_node(order[i]), at, app_main);
+    }
+
+    free(order);
+    free(seen);
+    return at;
+}
+
+/* Switches off opt.fail random joined nodes, they neither send nor receive anymore */
+static void fail_nodes(void)
+{
+    uint64_t fail_rng = opt.seed ^ 0xD6E8FEB86659FD93ULL;
+    int *candidates = malloc(opt.nodes * sizeof(int));
+    int candidates_len = 0;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        if (info[i].position != VCP_INITIAL && !sim_node(i)->crashed)
+        {
+            candidates[candidates_len++] = i;
+        }
+    }
+    failed = malloc((opt.fail > 0 ? opt.fail : 1) * sizeof(int));
+    while (failed_len < opt.fail && failed_len < candidates_len)
+    {
+        int k = failed_len + sim_random_stream(&fail_rng) % (candidates_len - failed_len);
+        int id = candidates[k];
+
+        candidates[k] = candidates[failed_len];
+        candidates[failed_len] = id;
+        failed[failed_len++] = id;
+        sim_node(id)->crashed = true;
+    }
+    free(candidates);
+}
+
+static void schedule_traffic(uint64_t start)
+{
+    int *joined = malloc(opt.nodes * sizeof(int));
+    int joined_len = 0;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        if (info[i].position != VCP_INITIAL && !sim_node(i)->crashed)
+        {
+            joined[joined_len++] = i;
+        }
+    }
+
+    // own stream so the traffic does not depend on how many random numbers the radio drew so far
+    uint64_t traffic_rng = opt.seed ^ 0x94D049BB133111EBULL;
+
+    if (opt.perf > 0)
+    {
+        // one generator per flow, every flow sends to another sink as long as there are enough nodes
+        perf_flows_len = joined_len < 2 ? 0 : (opt.flows > 0 ? opt.flows : 1);
+        perf_flows = calloc(perf_flows_len > 0 ? perf_flows_len : 1, sizeof(perf_flow_t));
+        for (int k = 0; k < perf_flows_len; k++)
+        {
+            perf_flow_t *f = &perf_flows[k];
+            bool taken;
+            int tries = 0;
+
+            f->src = joined[sim_random_stream(&traffic_rng) % joined_len];
+            do
+            {
+                f->dst = joined[sim_random_stream(&traffic_rng) % joined_len];
+                taken = false;
+                for (int j = 0; j < k; j++)
+                {
+                    taken = taken || perf_flows[j].dst == f->dst;
+                }
+            } while (f->dst == f->src || (taken && ++tries < joined_len));
+            sim_schedule(start, sim_node(f->src), start_perf, NULL, k);
+            sim_schedule(start + opt.perf, sim_node(f->src), stop_perf, NULL, k);
+        }
+        free(joined);
+        return;
+    }
+
+    if (opt.bulk > 0)
+    {
+        // one transfer per flow, the pairs are drawn like the ones of the messages
+        transfers_len = joined_len < 2 ? 0 : (opt.flows > 0 ? opt.flows : 1);
+        transfers = calloc(transfers_len > 0 ? transfers_len : 1, sizeof(transfer_t));
+        for (int i = 0; i < opt.nodes; i++)
+        {
+            sim_schedule(start, sim_node(i), register_stream_callbacks, NULL, 0);
+        }
+        for (int k = 0; k < transfers_len; k++)
+        {
+            transfer_t *t = &transfers[k];
+            t->stream = -1;
+            t->src = joined[sim_random_stream(&traffic_rng) % joined_len];
+            do
+            {
+                t->dst = joined[sim_random_stream(&traffic_rng) % joined_len];
+            } while (t->dst == t->src);
+            t->data = malloc(opt.bulk);
+            for (uint32_t i = 0; i < opt.bulk; i++)
+            {
+                t->data[i] = bulk_byte(k, i);
+            }
+            sim_schedule(start + (uint64_t)(k * 1e6 / opt.rate), sim_node(t->src), start_transfer, NULL, k);
+        }
+        free(joined);
+        return;
+    }
+
+    packets_len = joined_len < 2 ? 0 : opt.packets;
+    packets = calloc(packets_len > 0 ? packets_len : 1, sizeof(packet_t));
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        sim_schedule(start, sim_node(i), register_data_callback, NULL, 0);
+    }
+    for (int k = 0; k < packets_len; k++)
+    {
+        packet_t *p = &packets[k];
+        p->holder = -1;
+        // every second message of each flow
+        p->budget = k / (opt.flows > 0 ? opt.flows : 1) % 2 == 0 ? opt.budget : 0;
+        if (opt.replies && k % 2 == 1)
+        {
+            // answer to the previous message
+            p->src = packets[k - 1].dst;
+            p->dst = packets[k - 1].src;
+        }
+        else if (opt.flows > 0 && k >= opt.flows * (opt.replies + 1))
+        {
+            // fixed set of flows, the packets (and their replies) are spread round robin
+            p->src = packets[k % (opt.flows * (opt.replies + 1))].src;
+            p->dst = packets[k % (opt.flows * (opt.replies + 1))].dst;
+        }
+        else
+        {
+            p->src = joined[sim_random_stream(&traffic_rng) % joined_len];
+            do
+            {
+                p->dst = joined[sim_random_stream(&traffic_rng) % joined_len];
+            } while (p->dst == p->src);
+        }
+        sim_schedule(start + (uint64_t)(k * 1e6 / opt.rate), sim_node(p->src), inject, NULL, k);
+    }
+    free(joined);
+}
+
+/* Length of the shortest path from node src to node dst in hops, -1 if there is none */
+static int shortest_path(int src, int dst)
+{
+    int *distance = malloc(opt.nodes * sizeof(int));
+    int *queue = malloc(opt.nodes * sizeof(int));
+    int head = 0, tail = 0, hops;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        distance[i] = -1;
+    }
+    distance[src] = 0;
+    queue[tail++] = src;
+    while (head < tail && distance[dst] == -1)
+    {
+        sim_node_t *node = sim_node(queue[head++]);
+        for (int i = 0; i < node->links_len; i++)
+        {
+            if (distance[node->links[i]] == -1)
+            {
+                distance[node->links[i]] = distance[node->id] + 1;
+                queue[tail++] = node->links[i];
+            }
+        }
+    }
+    hops = distance[dst];
+    free(distance);
+    free(queue);
+    return hops;
+}
+
+/* Node fetches the snapshot of the joined node farthest from it over the cord, missing pages are requested again */
+static void fetch_metrics(void)
+{
+    int hops, farthest = 0;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        if (info[i].position == VCP_INITIAL || sim_node(i)->crashed)
+        {
+            continue;
+        }
+        if (fetch.src == -1)
+        {
+            fetch.src = i;
+            continue;
+        }
+        hops = shortest_path(fetch.src, i);
+        if (hops > farthest)
+        {
+            farthest = hops;
+            fetch.dst = i;
+        }
+    }
+    if (farthest == 0)
+    {
+        fetch.src = -1;
+        return;
+    }
+    fetch.requested_at = sim_now();
+    while (fetch.completed_at == 0 && fetch.attempts < METRICS_ATTEMPTS)
+    {
+        sim_schedule(sim_now(), sim_node(fetch.src), request_metrics, NULL, 0);
+        sim_run_until(sim_now() + SIM_SEC(2));
+    }
+}
+
+/* Goodput of a transfer: bytes received in order from the start of the transfer to its last byte */
+static void report_transfers(const vcp_stream_stats_t *stream)
+{
+    int complete = 0;
+    uint64_t first = UINT64_MAX, last = 0, corrupt = 0;
+    double duration_sum = 0, duration_max = 0, path_sum = 0;
+
+    for (int k = 0; k < transfers_len; k++)
+    {
+        transfer_t *t = &transfers[k];
+        corrupt += t->corrupt;
+        path_sum += shortest_path(t->src, t->dst);
+        if (!t->done || t->status != ESP_OK || t->received != opt.bulk)
+        {
+            continue;
+        }
+        complete++;
+        duration_sum += (t->received_at - t->started_at) / 1e6;
+        duration_max = (t->received_at - t->started_at) / 1e6 > duration_max ? (t->received_at - t->started_at) / 1e6
+                                                                              : duration_max;
+        first = t->started_at < first ? t->started_at : first;
+        last = t->received_at > last ? t->received_at : last;
+    }
+    printf("stream        %d/%d transfers of %u bytes complete, %llu corrupt bytes, shortest paths mean %.1f hops, "
+           "duration mean %.3f s, max %.3f s\n",
+           complete, transfers_len, opt.bulk, (unsigned long long)corrupt,
+           transfers_len ? path_sum / transfers_len : 0.0, complete ? duration_sum / complete : 0.0, duration_max);
+    printf("goodput       %.1f kB/s per transfer, %.1f kB/s all transfers, %u fragments, %u resent, %u timeouts, "
+           "%u out of order, %u duplicates\n",
+           complete ? opt.bulk / (duration_sum / complete) / 1e3 : 0.0,
+           complete ? (double)complete * opt.bulk / ((last - first) / 1e6) / 1e3 : 0.0, stream->fragments,
+           stream->resent, stream->timeouts, stream->out_of_order, stream->duplicates);
+}
+
+/* Goodput, loss and latency the sinks of the perf mode measured, the sent messages are counted by the generators.
+ * A message for a position two nodes share may end at the other one, the totals include every node */
+static void report_perf(void)
+{
+    uint64_t generated = 0, refused = 0, received = 0, lost = 0, goodput = 0, elsewhere = 0;
+    double path_sum = 0;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        vcp_perf_stats_t *p = &info[i].perf;
+        bool sink = false;
+
+        for (int k = 0; k < perf_flows_len; k++)
+        {
+            sink = sink || perf_flows[k].dst == i;
+        }
+        generated += p->generated;
+        refused += p->refused;
+        received += p->received;
+        lost += p->lost;
+        goodput += p->goodput;
+        elsewhere += sink ? 0 : p->received;
+    }
+    for (int k = 0; k < perf_flows_len; k++)
+    {
+        path_sum += shortest_path(perf_flows[k].src, perf_flows[k].dst);
+    }
+    printf("perf          %d generator(s) of %.0f messages/s with %u bytes for %.1f s, shortest paths mean %.1f hops\n",
+           perf_flows_len, opt.rate, opt.perf_len, opt.perf / 1e6, perf_flows_len ? path_sum / perf_flows_len : 0.0);
+    printf("perf sinks    %llu sent, %llu refused by the generators, %llu received (%llu not by a sink), %llu lost "
+           "(%.1f %%), goodput %.1f kB/s\n",
+           (unsigned long long)generated, (unsigned long long)refused, (unsigned long long)received,
+           (unsigned long long)elsewhere, (unsigned long long)lost, received + lost ? 100.0 * lost / (received + lost)
+                                                                                    : 0.0,
+           goodput / 1e3);
+    for (int k = 0; k < perf_flows_len; k++)
+    {
+        perf_flow_t *f = &perf_flows[k];
+        vcp_perf_stats_t *sent = &info[f->src].perf, *sink = &info[f->dst].perf;
+
+        printf("perf flow %-3d node %d -> %d, %d hops: %u sent, %u received, %u lost, %.1f kB/s, latency ms p50 %.1f, "
+               "p99 %.1f, max %.1f%s\n",
+               k, f->src, f->dst, shortest_path(f->src, f->dst), sent->generated, sink->received, sink->lost,
+               sink->goodput / 1e3, sink->latency_p50_us / 1e3, sink->latency_p99_us / 1e3, sink->latency_max_us / 1e3,
+               f->status != ESP_OK ? ", not started" : "");
+    }
+}
+
+/* Prints the bucket of a latency histogram which holds the p quantile as its upper bound */
+static void print_bucket(const uint64_t hist[METRICS_BUCKETS], double p)
+{
+    uint64_t total = 0, sum = 0;
+    int b;
+
+    for (b = 0; b < METRICS_BUCKETS; b++)
+    {
+        total += hist[b];
+    }
+    for (b = 0; b < METRICS_BUCKETS - 1; b++)
+    {
+        sum += hist[b];
+        if (sum > total * p)
+        {
+            break;
+        }
+    }
+    if (b == METRICS_BUCKETS - 1)
+    {
+        printf(">=%d", 16 << b);
+    }
+    else
+    {
+        printf("<%d", 32 << b);
+    }
+}
+
+/* Totals of the metrics snapshots of the nodes which are still running, with --metrics also the counters per message
+ * type and the snapshot fetched over the cord */
+static void report_metrics(void)
+{
+    static const char *types[VCP_MESSAGE_TYPES] = {
+        "HELLO", "UPDATE_SUCC", "UPDATE_PRED", "CREATE_VNODE", "DATA",        "ERR",
+        "ACK",   "FRAGMENT",    "STREAM_ACK",  "DATA_BUNDLE",  "METRICS_REQ", "METRICS",
+    };
+    static const char *stages[METRICS_STAGES] = {"receive", "handle", "send"};
+    uint64_t messages[VCP_MESSAGE_TYPES][METRICS_COUNTERS] = {0};
+    uint64_t latency[METRICS_STAGES][METRICS_BUCKETS] = {0};
+    uint64_t malformed = 0;
+    uint32_t stack_free[METRICS_TASKS] = {UINT32_MAX, UINT32_MAX, UINT32_MAX}, min_free_heap = UINT32_MAX;
+    uint8_t status_high_water = 0;
+    metrics_snapshot_t fetched;
+
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        metrics_snapshot_t *m = &info[i].metrics;
+        if (sim_node(i)->crashed || m->version != METRICS_VERSION)
+        {
+            continue;
+        }
+        for (int t = 0; t < VCP_MESSAGE_TYPES; t++)
+        {
+            for (int c = 0; c < METRICS_COUNTERS; c++)
+            {
+                messages[t][c] += m->messages[t][c];
+            }
+        }
+        for (int s = 0; s < METRICS_STAGES; s++)
+        {
+            for (int b = 0; b < METRICS_BUCKETS; b++)
+            {
+                latency[s][b] += m->latency[s][b];
+            }
+        }
+        malformed += m->malformed;
+        for (int t = 0; t < METRICS_TASKS; t++)
+        {
+            stack_free[t] = m->stack_free[t] < stack_free[t] ? m->stack_free[t] : stack_free[t];
+        }
+        min_free_heap = m->min_free_heap < min_free_heap ? m->min_free_heap : min_free_heap;
+        status_high_water = m->status_high_water > status_high_water ? m->status_high_water : status_high_water;
+    }
+
+    if (opt.metrics)
+    {
+        for (int t = 0; t < VCP_MESSAGE_TYPES; t++)
+        {
+            if (messages[t][METRICS_RX] + messages[t][METRICS_TX] > 0)
+            {
+                printf("type %-12s %llu received, %llu sent, %llu forwarded, %llu dropped\n", types[t],
+                       (unsigned long long)messages[t][METRICS_RX], (unsigned long long)messages[t][METRICS_TX],
+                       (unsigned long long)messages[t][METRICS_FORWARD], (unsigned long long)messages[t][METRICS_DROP]);
+            }
+        }
+    }
+    printf("stages us     ");
+    for (int s = 0; s < METRICS_STAGES; s++)
+    {
+        printf("%s%s p50 ", s > 0 ? ", " : "", stages[s]);
+        print_bucket(latency[s], 0.50);
+        printf(" p99 ");
+        print_bucket(latency[s], 0.99);
+    }
+    printf(", %llu malformed frames\n", (unsigned long long)malformed);
+    // the host stacks are larger than the ESP32 ones and so are the frames on them, the use is what compares
+    printf("stacks        deepest host stack use vcp task %u bytes, control task %u bytes, send task %u bytes, "
+           "lowest free heap %u bytes, send status queue high water %u/%d\n",
+           SIM_TASK_STACK_SIZE - stack_free[METRICS_TASK_VCP], SIM_TASK_STACK_SIZE - stack_free[METRICS_TASK_CONTROL],
+           SIM_TASK_STACK_SIZE - stack_free[METRICS_TASK_SEND], min_free_heap, status_high_water,
+           SENDER_ERROR_QUEUE_SIZE);
+
+    if (fetch.src == -1)
+    {
+        return;
+    }
+    memcpy(&fetched, fetch.bytes, sizeof(fetched));
+    if (fetch.completed_at == 0 || fetched.version != METRICS_VERSION ||
+        fetched.position != info[fetch.dst].position)
+    {
+        printf("metrics       snapshot of node %d not complete after %d requests, %u unexpected answers\n", fetch.dst,
+               fetch.attempts, fetch.unexpected);
+        return;
+    }
+    printf("metrics       node %d fetched the snapshot of node %d (%d hops, %zu bytes in %d pages) in %.1f ms with %d "
+           "request(s), it forwarded %u DATA messages\n",
+           fetch.src, fetch.dst, shortest_path(fetch.src, fetch.dst), sizeof(fetched), (int)METRICS_PAGES,
+           (fetch.completed_at - fetch.requested_at) / 1e3, fetch.attempts,
+           fetched.messages[VCP_DATA][METRICS_FORWARD]);
+}
+
+static void report(uint64_t last_boot, int components, double wall)
+{
+    int n = opt.nodes, joined = 0, crashed = 0, starts = 0, duplicates = 0, delivered = 0;
+    uint64_t all_joined = 0, settled = 0, links = 0;
+    int max_degree = 0, busiest = 0, pool_high_water = 0;
+    uint64_t pool_exhausted = 0, heap_allocs = 0, heap_allocs_traffic = 0;
+    uint64_t route_hits = 0, route_misses = 0, route_learned = 0, route_invalidated = 0;
+    uint64_t route_link_ties = 0;
+    link_stats_t link = {0};
+    vcp_stream_stats_t stream = {0};
+    vcp_hello_stats_t hello = {0};
+    peer_cache_stats_t peer = {0};
+    uint64_t hellos_in_traffic = 0;
+    int alive = 0, table_entries = 0, stale_entries = 0, stale_peers = 0;
+    int rtt_links = 0;
+    double srtt_sum = 0;
+    uint64_t *hops = malloc((packets_len + 1) * sizeof(uint64_t));
+    uint64_t *latency = malloc((packets_len + 1) * sizeof(uint64_t));
+    uint64_t *budgeted = malloc((packets_len + 1) * sizeof(uint64_t)); // latencies of the messages with a budget
+    int budgeted_len = 0, budget_met = 0, budget_sent = 0;
+    traffic_class_stats_t classes[TRAFFIC_CLASSES] = {0};
+    receive_ring_stats_t ring = {0};
+    vcp_position_t *positions = malloc(n * sizeof(vcp_position_t));
+    double hops_sum = 0, latency_sum = 0, hop_delay_sum = 0, forward_rate = 0;
+    static const char *topologies[] = {"line", "grid", "random"};
+
+    for (int i = 0; i < n; i++)
+    {
+        sim_node_t *node = sim_node(i);
+        links += node->links_len;
+        max_degree = node->links_len > max_degree ? node->links_len : max_degree;
+        crashed += node->crashed;
+        if (info[i].position != VCP_INITIAL)
+        {
+            positions[joined++] = info[i].position;
+            all_joined = info[i].joined_at > all_joined ? info[i].joined_at : all_joined;
+            starts += info[i].position == VCP_START;
+        }
+        settled = info[i].changed_at > settled ? info[i].changed_at : settled;
+        busiest = info[i].data_tx > info[busiest].data_tx ? i : busiest;
+        pool_high_water = info[i].pool.high_water > pool_high_water ? info[i].pool.high_water : pool_high_water;
+        pool_exhausted += info[i].pool.exhausted;
+        heap_allocs += node->heap_allocs;
+        heap_allocs_traffic += node->heap_allocs - info[i].heap_allocs_before_traffic;
+        route_hits += info[i].routes.hits;
+        route_misses += info[i].routes.misses;
+        route_learned += info[i].routes.learned;
+        route_invalidated += info[i].routes.invalidated;
+        route_link_ties += info[i].routes.link_ties;
+        for (int k = 0; k < VCP_MAX_NEIGHBORS; k++)
+        {
+            link_stats_t *l = &info[i].links[k];
+            link.sent += l->sent;
+            link.retransmissions += l->retransmissions;
+            link.fast_retransmissions += l->fast_retransmissions;
+            link.failed += l->failed;
+            link.queue_full += l->queue_full;
+            link.held += l->held;
+            link.duplicates += l->duplicates;
+            link.messages += l->messages;
+            link.bundled += l->bundled;
+            if (l->srtt_us > 0)
+            {
+                rtt_links++;
+                srtt_sum += l->srtt_us;
+            }
+        }
+        if (!node->crashed)
+        {
+            alive++;
+            table_entries += info[i].neighbors;
+            stale_entries += info[i].stale_neighbors;
+            for (int p = 0; p < node->peers_len; p++)
+            {
+                for (int k = 0; k < failed_len; k++)
+                {
+                    stale_peers += memcmp(node->peers[p], sim_node(failed[k])->mac, ESP_NOW_ETH_ALEN) == 0;
+                }
+            }
+        }
+        hello.sent += info[i].hellos.sent;
+        hello.suppressed += info[i].hellos.suppressed;
+        hello.resets += info[i].hellos.resets;
+        hellos_in_traffic += info[i].hellos_in_traffic;
+        peer.hits += info[i].peers.hits;
+        peer.installs += info[i].peers.installs;
+        peer.evictions += info[i].peers.evictions;
+        peer.failed += info[i].peers.failed;
+        ring.pushed += info[i].ring.pushed;
+        ring.dropped += info[i].ring.dropped;
+        ring.high_water = info[i].ring.high_water > ring.high_water ? info[i].ring.high_water : ring.high_water;
+        for (int c = 0; c < TRAFFIC_CLASSES; c++)
+        {
+            classes[c].queued += info[i].classes[c].queued;
+            classes[c].dropped += info[i].classes[c].dropped;
+            classes[c].late += info[i].classes[c].late;
+            classes[c].residence_sum_us += info[i].classes[c].residence_sum_us;
+            classes[c].residence_max_us = info[i].classes[c].residence_max_us > classes[c].residence_max_us
+                                              ? info[i].classes[c].residence_max_us
+                                              : classes[c].residence_max_us;
+        }
+        stream.fragments += info[i].streams.fragments;
+        stream.resent += info[i].streams.resent;
+        stream.timeouts += info[i].streams.timeouts;
+        stream.out_of_order += info[i].streams.out_of_order;
+        stream.duplicates += info[i].streams.duplicates;
+    }
+    for (int i = 0; i < joined; i++)
+    {
+        for (int j = 0; j < joined; j++)
+        {
+            if (i != j && positions[i] == positions[j])
+            {
+                duplicates++;
+                break;
+            }
+        }
+    }
+
+    for (int k = 0; k < packets_len; k++)
+    {
+        budget_sent += packets[k].budget > 0;
+        if (packets[k].delivered)
+        {
+            hops[delivered] = packets[k].transmissions;
+            latency[delivered] = packets[k].delivered_at - packets[k].injected_at;
+            if (packets[k].budget > 0)
+            {
+                budgeted[budgeted_len++] = latency[delivered];
+                budget_met += latency[delivered] <= packets[k].budget * 1000ULL;
+            }
+            hops_sum += hops[delivered];
+            latency_sum += latency[delivered];
+            delivered++;
+        }
+    }
+    qsort(hops, delivered, sizeof(uint64_t), cmp_u64);
+    qsort(latency, delivered, sizeof(uint64_t), cmp_u64);
+    qsort(budgeted, budgeted_len, sizeof(uint64_t), cmp_u64);
+    qsort(hop_delays.values, hop_delays.len, sizeof(uint64_t), cmp_u64);
+    for (int i = 0; i < hop_delays.len; i++)
+    {
+        hop_delay_sum += hop_delays.values[i];
+    }
+    if (info[busiest].last_data_tx > info[busiest].first_data_tx)
+    {
+        forward_rate = (info[busiest].data_tx - 1) * 1e6 / (info[busiest].last_data_tx - info[busiest].first_data_tx);
+    }
+
+    printf("topology      %s, %d nodes, spacing %.1f m, range %.1f m, loss %.2f, edge loss %.2f, seed %llu\n",
+           topologies[opt.topology], n, opt.spacing, sim_radio_config.range, sim_radio_config.loss,
+           sim_radio_config.edge_loss, (unsigned long long)opt.seed);
+    printf("links         avg degree %.1f, max degree %d, %d component(s)\n", (double)links / n, max_degree, components);
+    printf("join          %d/%d joined, last join %.3f s, last position change %.3f s, last boot %.3f s\n", joined, n,
+           all_joined / 1e6, settled / 1e6, last_boot / 1e6);
+    printf("cord          %d node(s) at the cord start, %d node(s) share their position with another node\n", starts,
+           duplicates);
+    printf("hello         %u sent, %u suppressed, %u interval resets, %.3f per node and s after the settle time\n",
+           hello.sent, hello.suppressed, hello.resets,
+           sim_now() > traffic_start ? hellos_in_traffic * 1e6 / n / (sim_now() - traffic_start) : 0.0);
+    printf("neighbors     mean %.1f entries per node, %d entries and %d ESP-NOW peers of %d switched off node(s)\n",
+           alive ? (double)table_entries / alive : 0.0, stale_entries, stale_peers, failed_len);
+    printf("peers         %u unicasts to installed peers, %u installs, %u evictions, %u failed (%d slots per node)\n",
+           peer.hits, peer.installs, peer.evictions, peer.failed, PEER_SLOTS);
+    printf("data          %d/%d delivered (%.1f %%), %u misdelivered\n", delivered, packets_len,
+           packets_len ? 100.0 * delivered / packets_len : 0.0, misdelivered);
+    printf("hops          mean %.2f, p50 %llu, p95 %llu, max %llu\n", delivered ? hops_sum / delivered : 0.0,
+           (unsigned long long)percentile(hops, delivered, 0.50), (unsigned long long)percentile(hops, delivered, 0.95),
+           (unsigned long long)percentile(hops, delivered, 1.0));
+    printf("latency ms    mean %.1f, p50 %.1f, p95 %.1f, p99 %.1f, max %.1f\n",
+           delivered ? latency_sum / delivered / 1e3 : 0.0, percentile(latency, delivered, 0.50) / 1e3,
+           percentile(latency, delivered, 0.95) / 1e3, percentile(latency, delivered, 0.99) / 1e3,
+           percentile(latency, delivered, 1.0) / 1e3);
+    if (opt.budget > 0)
+    {
+        printf("budget        %d/%d delivered within %u ms, p50 %.1f, p95 %.1f, max %.1f ms\n", budget_met,
+               budget_sent, opt.budget, percentile(budgeted, budgeted_len, 0.50) / 1e3,
+               percentile(budgeted, budgeted_len, 0.95) / 1e3, percentile(budgeted, budgeted_len, 1.0) / 1e3);
+    }
+    printf("per hop ms    mean %.2f, p50 %.2f, p99 %.2f, max %.2f (reception to esp_now_send)\n",
+           hop_delays.len ? hop_delay_sum / hop_delays.len / 1e3 : 0.0,
+           percentile(hop_delays.values, hop_delays.len, 0.50) / 1e3,
+           percentile(hop_delays.values, hop_delays.len, 0.99) / 1e3,
+           percentile(hop_delays.values, hop_delays.len, 1.0) / 1e3);
+    printf("route cache   %llu hits, %llu misses (%.1f %% hits), %llu reverse paths learned, %llu entries invalidated\n",
+           (unsigned long long)route_hits, (unsigned long long)route_misses,
+           route_hits + route_misses ? 100.0 * route_hits / (route_hits + route_misses) : 0.0,
+           (unsigned long long)route_learned, (unsigned long long)route_invalidated);
+    printf("link quality  %llu greedy ties of equal progress won by the cheaper link\n",
+           (unsigned long long)route_link_ties);
+    printf("link          %u frames to acknowledge, %u retransmissions (%u fast, %u held back), %u failed, "
+           "%u refused (queue full), %u duplicates received, mean srtt %.2f ms\n",
+           link.sent, link.retransmissions, link.fast_retransmissions, link.held, link.failed, link.queue_full,
+           link.duplicates, rtt_links ? srtt_sum / rtt_links / 1e3 : 0.0);
+    printf("aggregation   %u DATA messages in %u frames, %.2f messages/frame\n", link.messages,
+           link.messages - link.bundled,
+           link.messages > link.bundled ? (double)link.messages / (link.messages - link.bundled) : 0.0);
+    if (opt.bulk > 0)
+    {
+        report_transfers(&stream);
+    }
+    if (opt.perf > 0)
+    {
+        report_perf();
+    }
+    printf("forwarding    busiest node sent %u DATA messages, %.1f frames/s\n", info[busiest].data_tx, forward_rate);
+    printf("radio         %llu frames, %llu bytes, %llu retries, %llu collisions, %llu lost, %llu send failures, %llu "
+           "tx queue full\n",
+           (unsigned long long)sim_radio_stats.frames, (unsigned long long)sim_radio_stats.bytes,
+           (unsigned long long)sim_radio_stats.retries, (unsigned long long)sim_radio_stats.collisions,
+           (unsigned long long)sim_radio_stats.lost, (unsigned long long)sim_radio_stats.send_fail,
+           (unsigned long long)sim_radio_stats.send_no_mem);
+    for (int c = 0; c < TRAFFIC_CLASSES; c++)
+    {
+        uint32_t sent = classes[c].queued - classes[c].dropped;
+        printf("%-13s %u frames, %u dropped, %u late, residence mean %.2f ms, max %.1f ms\n",
+               c == TRAFFIC_CLASS_CONTROL ? "class control" : "class data", classes[c].queued, classes[c].dropped,
+               classes[c].late, sent ? classes[c].residence_sum_us / 1e3 / sent : 0.0,
+               classes[c].residence_max_us / 1e3);
+    }
+    printf("receive ring  %u frames handed to the vcp task, %u dropped, high water %u/%d\n", ring.pushed,
+           ring.dropped, ring.high_water, RECEIVER_RING_SIZE);
+    printf("memory        packet pool high water %d/%d, %llu allocations failed, %llu heap allocations (%llu during "
+           "traffic)\n",
+           pool_high_water, PACKET_POOL_SIZE, (unsigned long long)pool_exhausted, (unsigned long long)heap_allocs,
+           (unsigned long long)heap_allocs_traffic);
+    report_metrics();
+    printf("nodes         %d crashed\n", crashed);
+    printf("simulated     %.1f s in %.2f s wall time\n", sim_now() / 1e6, wall);
+
+    free(hops);
+    free(latency);
+    free(budgeted);
+    free(positions);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --nodes N           number of nodes (%d)\n"
+            "  -t, --topology T        line, grid or random (grid)\n"
+            "  -s, --spacing M         distance between grid/line neighbors in meters (%.1f)\n"
+            "  -r, --range M           radio range in meters (%.1f)\n"
+            "  -l, --loss P            frame loss probability per receiver (%.2f)\n"
+            "  -e, --edge-loss P       additional loss probability at the edge of the range (%.2f)\n"
+            "  -b, --boot-interval MS  time between two node boots (%llu)\n"
+            "  -S, --settle S          time after the last boot before traffic starts (%llu)\n"
+            "  -p, --packets N         DATA messages between random node pairs (%d)\n"
+            "  -f, --flows N           send all messages over N fixed node pairs, 0 picks a pair per message (%d)\n"
+            "  -a, --replies           every second message answers the previous one\n"
+            "  -B, --bulk BYTES        send BYTES as one stream transfer per flow instead of the DATA messages\n"
+            "  -L, --budget MS         every second DATA message (of a flow) carries a budget of MS (%u)\n"
+            "  -R, --rate N            injected DATA messages (started transfers, perf messages of a generator) per "
+            "second (%.1f)\n"
+            "  -d, --drain S           time after the last message before the report (%llu)\n"
+            "  -P, --perf S            run one perf generator per flow for S seconds instead of the DATA messages\n"
+            "  -G, --perf-len BYTES    payload of the perf messages (%u)\n"
+            "  -F, --fail N            switch N random joined nodes off at the end of the settle time (%d)\n"
+            "  -W, --recover S         time between switching the nodes off and the traffic (%llu)\n"
+            "  -M, --metrics           print the counters per message type, fetch the metrics of a node over the cord\n"
+            "  -T, --trace FILE        write the packet trace of a node to FILE, see vcp_replay\n"
+            "  -N, --trace-node N      node whose packet trace is written (%d)\n"
+            "  -x, --seed N            random seed (%llu)\n"
+            "  -v, --verbose           firmware log output, repeat for more\n",
+            prog, opt.nodes, opt.spacing, sim_radio_config.range, sim_radio_config.loss, sim_radio_config.edge_loss,
+            (unsigned long long)(opt.boot_interval / 1000), (unsigned long long)(opt.settle / 1000000), opt.packets, opt.flows,
+            opt.budget, opt.rate, (unsigned long long)(opt.drain / 1000000), opt.perf_len, opt.fail,
+            (unsigned long long)(opt.recover / 1000000), opt.trace_node, (unsigned long long)opt.seed);
+    exit(2);
+}
+
+static void parse_options(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"nodes", required_argument, NULL, 'n'},
+        {"topology", required_argument, NULL, 't'},
+        {"spacing", required_argument, NULL, 's'},
+        {"range", required_argument, NULL, 'r'},
+        {"loss", required_argument, NULL, 'l'},
+        {"edge-loss", required_argument, NULL, 'e'},
+        {"boot-interval", required_argument, NULL, 'b'},
+        {"settle", required_argument, NULL, 'S'},
+        {"packets", required_argument, NULL, 'p'},
+        {"flows", required_argument, NULL, 'f'},
+        {"replies", no_argument, NULL, 'a'},
+        {"bulk", required_argument, NULL, 'B'},
+        {"budget", required_argument, NULL, 'L'},
+        {"rate", required_argument, NULL, 'R'},
+        {"drain", required_argument, NULL, 'd'},
+        {"perf", required_argument, NULL, 'P'},
+        {"perf-len", required_argument, NULL, 'G'},
+        {"fail", required_argument, NULL, 'F'},
+        {"recover", required_argument, NULL, 'W'},
+        {"metrics", no_argument, NULL, 'M'},
+        {"trace", required_argument, NULL, 'T'},
+        {"trace-node", required_argument, NULL, 'N'},
+        {"seed", required_argument, NULL, 'x'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "n:t:s:r:l:e:b:S:p:f:aB:L:R:d:P:G:F:W:MT:N:x:vh", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            opt.nodes = atoi(optarg);
+            break;
+        case 't':
+            if (strcmp(optarg, "line") == 0)
+            {
+                opt.topology = TOPOLOGY_LINE;
+            }
+            else if (strcmp(optarg, "grid") == 0)
+            {
+                opt.topology = TOPOLOGY_GRID;
+            }
+            else if (strcmp(optarg, "random") == 0)
+            {
+                opt.topology = TOPOLOGY_RANDOM;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            opt.spacing = atof(optarg);
+            break;
+        case 'r':
+            sim_radio_config.range = atof(optarg);
+            break;
+        case 'l':
+            sim_radio_config.loss = atof(optarg);
+            break;
+        case 'e':
+            sim_radio_config.edge_loss = atof(optarg);
+            break;
+        case 'b':
+            opt.boot_interval = SIM_MS(atoll(optarg));
+            break;
+        case 'S':
+            opt.settle = (uint64_t)(atof(optarg) * 1e6);
+            break;
+        case 'p':
+            opt.packets = atoi(optarg);
+            break;
+        case 'f':
+            opt.flows = atoi(optarg);
+            break;
+        case 'a':
+            opt.replies = true;
+            break;
+        case 'B':
+            opt.bulk = strtoul(optarg, NULL, 0);
+            break;
+        case 'L':
+            opt.budget = atoi(optarg);
+            break;
+        case 'R':
+            opt.rate = atof(optarg);
+            break;
+        case 'd':
+            opt.drain = (uint64_t)(atof(optarg) * 1e6);
+            break;
+        case 'P':
+            opt.perf = (uint64_t)(atof(optarg) * 1e6);
+            break;
+        case 'G':
+            opt.perf_len = atoi(optarg);
+            break;
+        case 'F':
+            opt.fail = atoi(optarg);
+            break;
+        case 'W':
+            opt.recover = (uint64_t)(atof(optarg) * 1e6);
+            break;
+        case 'M':
+            opt.metrics = true;
+            break;
+        case 'T':
+            opt.trace = optarg;
+            break;
+        case 'N':
+            opt.trace_node = atoi(optarg);
+            break;
+        case 'x':
+            opt.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'v':
+            opt.log_level = opt.log_level == ESP_LOG_NONE ? ESP_LOG_ERROR : opt.log_level + 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (opt.nodes < 1 || opt.trace_node < 0 || opt.trace_node >= opt.nodes || opt.spacing <= 0 ||
+        sim_radio_config.range <= 0 || opt.rate <= 0 || (opt.perf > 0 && opt.rate > UINT16_MAX) ||
+        opt.budget > VCP_DATA_MAX_BUDGET ||
+        opt.perf_len < sizeof(vcp_perf_header_t) || opt.perf_len > VCP_PERF_MAX_PAYLOAD_LEN)
+    {
+        usage(argv[0]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec t0, t1;
+    uint64_t last_boot;
+    int components;
+
+    parse_options(argc, argv);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    sim_init(opt.nodes, opt.seed);
+    sim_set_log_level(opt.log_level);
+    info = calloc(opt.nodes, sizeof(node_info_t));
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        info[i].position = VCP_INITIAL;
+    }
+
+    if (opt.trace != NULL)
+    {
+        trace_file = fopen(opt.trace, "wb");
+        if (trace_file == NULL)
+        {
+            perror(opt.trace);
+            return 1;
+        }
+    }
+
+    place_nodes();
+    sim_set_observer(observe);
+    sim_radio_set_hooks(on_tx, on_rx);
+
+    last_boot = boot_nodes(&components);
+    traffic_start = last_boot + opt.settle;
+    sim_run_until(traffic_start);
+    if (opt.fail > 0)
+    {
+        fail_nodes();
+        traffic_start += opt.recover;
+        sim_run_until(traffic_start);
+    }
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        info[i].heap_allocs_before_traffic = sim_node(i)->heap_allocs;
+    }
+
+    schedule_traffic(traffic_start);
+    if (opt.bulk > 0)
+    {
+        // until every source got its sent callback, at most the drain time plus one second per kB
+        uint64_t until = traffic_start + (uint64_t)(transfers_len * 1e6 / opt.rate) + opt.drain;
+        bool done = false;
+
+        until += SIM_SEC(opt.bulk / 1000);
+        while (!done && sim_now() < until)
+        {
+            sim_run_until(sim_now() + SIM_MS(100) < until ? sim_now() + SIM_MS(100) : until);
+            done = true;
+            for (int k = 0; k < transfers_len; k++)
+            {
+                done = done && transfers[k].done;
+            }
+        }
+    }
+    else if (opt.perf > 0)
+    {
+        sim_run_until(traffic_start + opt.perf + opt.drain);
+        for (int i = 0; i < opt.nodes; i++)
+        {
+            sim_schedule(sim_now(), sim_node(i), collect_perf, NULL, 0);
+        }
+        sim_run_until(sim_now());
+    }
+    else
+    {
+        sim_run_until(traffic_start + (uint64_t)(packets_len * 1e6 / opt.rate) + opt.drain);
+    }
+
+    if (opt.metrics)
+    {
+        fetch_metrics();
+    }
+    // read in the context of every node, the snapshot reads the stacks of its tasks
+    for (int i = 0; i < opt.nodes; i++)
+    {
+        sim_schedule(sim_now(), sim_node(i), collect_metrics, NULL, 0);
+    }
+    sim_run_until(sim_now());
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    report(last_boot, components, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    if (trace_file != NULL)
+    {
+        fclose(trace_file);
+        printf("trace         %u frames of node %d written to %s\n", trace_written, opt.trace_node, opt.trace);
+    }
+
+    for (int k = 0; k < transfers_len; k++)
+    {
+        free(transfers[k].data);
+    }
+    free(transfers);
+    free(perf_flows);
+    free(packets);
+    free(failed);
+    free(info);
+    free(hop_delays.values);
+    sim_deinit();
+    return 0;
+}
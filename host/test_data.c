@@ -0,0 +1,307 @@
+/*
+ * test_data.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * Host test of the binary DATA API (vcp_data_alloc, vcp_data_send, vcp_data_free and the receive callback of
+ * vcp_data_register). A line of TEST_NODES nodes runs in the simulator, each node only hears its direct neighbors, so
+ * a message from one end to the other crosses TEST_NODES - 1 hops. The checks:
+ * - vcp_data_send refuses a payload longer than VCP_DATA_MAX_LEN and a NULL buffer
+ * - with VCP_DATA_QUEUE_SIZE messages waiting for the vcp task it returns ESP_ERR_NO_MEM, the caller still owns the
+ *   buffer and gives it back with vcp_data_free
+ * - a message for the own position is delivered locally
+ * - the callback at the other end of the line gets the source position and the payload bytes unchanged
+ * - a payload which starts like a perf header ("VCPP") reaches the callback as well, also in the build with VCP_PERF
+ *   (vcp_test_data_perf): only the perf generator marks its messages
+ * - every packet buffer is back in the pool afterwards
+ * The exit status is the number of failed checks.
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_now.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "vcp.h"
+#include "packet-pool.h"
+#include "sim.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define TEST_NODES 5
+#define TEST_SPACING 10.0 // m, below the radio range, twice the spacing is above it
+#define TEST_BOOT_INTERVAL SIM_MS(1500)
+#define TEST_SETTLE SIM_SEC(10)
+#define TEST_DRAIN SIM_SEC(2)
+#define TEST_LOCAL_LEN 20 // payload of the messages for the own position
+#define TEST_FAR_LEN 200  // payload of the message across the line
+#define TEST_VCPP_LEN 32  // payload starting with "VCPP", longer than a vcp_perf_header_t
+
+typedef struct
+{
+    int node;
+    vcp_position_t source;
+    uint8_t len;
+    uint8_t data[VCP_DATA_MAX_LEN];
+} received_t;
+
+static vcp_position_t positions[TEST_NODES];
+static uint16_t pool_in_use[TEST_NODES];
+static received_t received[2 * VCP_DATA_QUEUE_SIZE];
+static int received_len;
+static int failures;
+
+#define CHECK(cond, ...)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(cond))                                                                                                   \
+        {                                                                                                              \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                                                                \
+            printf(__VA_ARGS__);                                                                                       \
+            printf("\n");                                                                                              \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+void app_main(void);
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* Runs after every event, in the context of the node */
+static void observe(sim_node_t *node)
+{
+    packet_pool_stats_t pool;
+
+    packet_pool_get_stats(&pool);
+    pool_in_use[node->id] = pool.in_use;
+    positions[node->id] = own_position;
+}
+
+static void on_data(vcp_position_t source, const uint8_t *data, uint8_t len)
+{
+    received_t *r;
+
+    if (received_len == sizeof(received) / sizeof(received[0]))
+    {
+        printf("FAIL more messages received than sent\n");
+        failures++;
+        return;
+    }
+    r = &received[received_len++];
+    r->node = sim_current_node()->id;
+    r->source = source;
+    r->len = len;
+    memcpy(r->data, data, len);
+}
+
+static void register_data(sim_node_t *node, void *arg, uint64_t tag)
+{
+    vcp_data_register(on_data);
+}
+
+/* Byte i of message k, so that every message and every offset has its own content */
+static uint8_t pattern(int k, int i)
+{
+    return (uint8_t)(k * 37 + i * 7 + 1);
+}
+
+static void check_arguments(sim_node_t *node, void *arg, uint64_t tag)
+{
+    uint8_t *data = vcp_data_alloc();
+    esp_err_t err;
+
+    CHECK(data != NULL, "vcp_data_alloc returned NULL");
+    err = vcp_data_send(own_position, data, VCP_DATA_MAX_LEN + 1, 0);
+    CHECK(err == ESP_ERR_INVALID_SIZE, "payload of %d bytes: %s", VCP_DATA_MAX_LEN + 1, esp_err_to_name(err));
+    err = vcp_data_send(own_position, NULL, 1, 0);
+    CHECK(err == ESP_ERR_INVALID_ARG, "NULL buffer: %s", esp_err_to_name(err));
+    vcp_data_free(data);
+}
+
+/* Queues messages for the own position until the queue is full, the vcp task only runs after this event */
+static void fill_queue(sim_node_t *node, void *arg, uint64_t tag)
+{
+    uint8_t *data;
+    esp_err_t err;
+
+    for (int k = 0; k < VCP_DATA_QUEUE_SIZE; k++)
+    {
+        data = vcp_data_alloc();
+        CHECK(data != NULL, "vcp_data_alloc returned NULL");
+        for (int i = 0; i < TEST_LOCAL_LEN; i++)
+        {
+            data[i] = pattern(k, i);
+        }
+        err = vcp_data_send(own_position, data, TEST_LOCAL_LEN, 0);
+        CHECK(err == ESP_OK, "message %d for the own position: %s", k, esp_err_to_name(err));
+    }
+
+    data = vcp_data_alloc();
+    CHECK(data != NULL, "vcp_data_alloc returned NULL");
+    memset(data, 0xAA, TEST_LOCAL_LEN);
+    err = vcp_data_send(own_position, data, TEST_LOCAL_LEN, 0);
+    CHECK(err == ESP_ERR_NO_MEM, "message with a full queue: %s", esp_err_to_name(err));
+    // still the buffer of the caller: writing all of it must not change a queued message
+    memset(data, 0x55, VCP_DATA_MAX_LEN);
+    vcp_data_free(data);
+}
+
+static void send_far(sim_node_t *node, void *arg, uint64_t tag)
+{
+    uint8_t *data = vcp_data_alloc();
+    esp_err_t err;
+
+    CHECK(data != NULL, "vcp_data_alloc returned NULL");
+    for (int i = 0; i < TEST_FAR_LEN; i++)
+    {
+        data[i] = pattern(TEST_NODES, i);
+    }
+    err = vcp_data_send(positions[TEST_NODES - 1], data, TEST_FAR_LEN, 0);
+    CHECK(err == ESP_OK, "message across the line: %s", esp_err_to_name(err));
+}
+
+static void send_vcpp(sim_node_t *node, void *arg, uint64_t tag)
+{
+    uint8_t *data = vcp_data_alloc();
+    esp_err_t err;
+
+    CHECK(data != NULL, "vcp_data_alloc returned NULL");
+    for (int i = 0; i < TEST_VCPP_LEN; i++)
+    {
+        data[i] = pattern(TEST_NODES + 1, i);
+    }
+    memcpy(data, "VCPP", 4);
+    err = vcp_data_send(positions[TEST_NODES - 1], data, TEST_VCPP_LEN, 0);
+    CHECK(err == ESP_OK, "message starting with VCPP: %s", esp_err_to_name(err));
+}
+
+static void check_local(void)
+{
+    received_t *r;
+
+    CHECK(received_len == VCP_DATA_QUEUE_SIZE, "%d of %d messages for the own position delivered", received_len,
+          VCP_DATA_QUEUE_SIZE);
+    for (int k = 0; k < received_len; k++)
+    {
+        r = &received[k];
+        CHECK(r->node == 0 && r->source == positions[0], "message %d: delivered to node %d from position %" PRIu32, k,
+              r->node, r->source);
+        CHECK(r->len == TEST_LOCAL_LEN, "message %d: %u bytes", k, r->len);
+        for (int i = 0; i < r->len; i++)
+        {
+            if (r->data[i] != pattern(k, i))
+            {
+                CHECK(false, "message %d: byte %d is %02x instead of %02x", k, i, r->data[i], pattern(k, i));
+                break;
+            }
+        }
+    }
+}
+
+static void check_far(void)
+{
+    received_t *r = &received[received_len - 1];
+
+    CHECK(received_len == VCP_DATA_QUEUE_SIZE + 1, "message across the line not delivered");
+    if (received_len != VCP_DATA_QUEUE_SIZE + 1)
+    {
+        return;
+    }
+    CHECK(r->node == TEST_NODES - 1, "message across the line delivered to node %d", r->node);
+    CHECK(r->source == positions[0], "source %" PRIu32 " instead of %" PRIu32, r->source, positions[0]);
+    CHECK(r->len == TEST_FAR_LEN, "%u bytes instead of %d", r->len, TEST_FAR_LEN);
+    for (int i = 0; i < r->len; i++)
+    {
+        if (r->data[i] != pattern(TEST_NODES, i))
+        {
+            CHECK(false, "byte %d is %02x instead of %02x", i, r->data[i], pattern(TEST_NODES, i));
+            break;
+        }
+    }
+}
+
+static void check_vcpp(void)
+{
+    received_t *r = &received[received_len - 1];
+
+    CHECK(received_len == VCP_DATA_QUEUE_SIZE + 2, "message starting with VCPP not delivered to the callback");
+    if (received_len != VCP_DATA_QUEUE_SIZE + 2)
+    {
+        return;
+    }
+    CHECK(r->node == TEST_NODES - 1, "message starting with VCPP delivered to node %d", r->node);
+    CHECK(r->len == TEST_VCPP_LEN, "%u bytes instead of %d", r->len, TEST_VCPP_LEN);
+    CHECK(memcmp(r->data, "VCPP", 4) == 0, "payload starts with %02x %02x %02x %02x", r->data[0], r->data[1],
+          r->data[2], r->data[3]);
+    for (int i = 4; i < r->len; i++)
+    {
+        if (r->data[i] != pattern(TEST_NODES + 1, i))
+        {
+            CHECK(false, "byte %d is %02x instead of %02x", i, r->data[i], pattern(TEST_NODES + 1, i));
+            break;
+        }
+    }
+}
+
+int main(void)
+{
+    uint64_t at;
+
+    sim_init(TEST_NODES, 1);
+    sim_set_log_level(ESP_LOG_NONE);
+    sim_set_observer(observe);
+    for (int i = 0; i < TEST_NODES; i++)
+    {
+        sim_node(i)->x = i * TEST_SPACING;
+        sim_node(i)->y = 0.0;
+    }
+    sim_radio_connect();
+    for (int l = 0; l < sim_node(0)->links_len; l++)
+    {
+        CHECK(sim_node(0)->links[l] == 1, "node 0 hears node %d, not only its neighbor", sim_node(0)->links[l]);
+    }
+    for (int i = 0; i < TEST_NODES; i++)
+    {
+        sim_boot(sim_node(i), i * TEST_BOOT_INTERVAL, app_main);
+        sim_schedule(i * TEST_BOOT_INTERVAL, sim_node(i), register_data, NULL, 0);
+    }
+    at = (TEST_NODES - 1) * TEST_BOOT_INTERVAL + TEST_SETTLE;
+    sim_run_until(at);
+    for (int i = 0; i < TEST_NODES; i++)
+    {
+        CHECK(positions[i] != VCP_INITIAL, "node %d did not join the cord", i);
+    }
+    if (failures > 0)
+    {
+        return failures;
+    }
+
+    sim_schedule(at, sim_node(0), check_arguments, NULL, 0);
+    sim_schedule(at, sim_node(0), fill_queue, NULL, 0);
+    at += TEST_DRAIN;
+    sim_run_until(at);
+    check_local();
+
+    sim_schedule(at, sim_node(0), send_far, NULL, 0);
+    at += TEST_DRAIN;
+    sim_run_until(at);
+    check_far();
+
+    sim_schedule(at, sim_node(0), send_vcpp, NULL, 0);
+    at += TEST_DRAIN;
+    sim_run_until(at);
+    check_vcpp();
+
+    for (int i = 0; i < TEST_NODES; i++)
+    {
+        CHECK(pool_in_use[i] == 0, "node %d holds %u packet buffers", i, pool_in_use[i]);
+    }
+
+    sim_deinit();
+    printf("%s: %d failed checks\n", failures == 0 ? "PASS" : "FAIL", failures);
+    return failures;
+}
@@ -10,32 +10,113 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-/* --------------------------------------------- variables and constants --------------------------------------------- */
+/*
+ * Marks the mutable state of a node. It expands to nothing on the ESP32, the host simulator (host/) defines it to
+ * collect these variables in one section which is swapped whenever it switches between the simulated nodes.
+ */
+#ifndef NODE_STATE
+#define NODE_STATE
+#endif
 
-#define ESPNOW_QUEUE_TIMEOUT 512
+/* --------------------------------------------- variables and constants --------------------------------------------- */
 
 #define ESPNOW_WIFI_MODE WIFI_MODE_AP
 #define ESPNOW_WIFI_IF ESP_IF_WIFI_AP
 #define ESPNOW_WIFI_CHANNEL 1
 
-#define SENDER_QUEUE_SIZE 10
-#define RECEIVER_QUEUE_SIZE 5
+#define SENDER_CONTROL_QUEUE_SIZE 6 // HELLO, UPDATE, CREATE_VIRTUAL_NODE, ERR and ACK frames waiting for the radio
+#define SENDER_DATA_QUEUE_SIZE 10   // DATA, DATA_BUNDLE, FRAGMENT and STREAM_ACK frames waiting for the radio
+#define RECEIVER_RING_SIZE 8 // received frames waiting for the vcp task, a power of two
 #define SENDER_ERROR_QUEUE_SIZE 5
-#define ESPNOW_MAX_PEERS 20
+#define ESPNOW_MAX_PEERS 20 // peer list of ESP-NOW, one entry is the broadcast peer, the rest is an LRU cache
+#define PACKET_POOL_SIZE 32 // frame buffers shared by the receive ring, the vcp task and the sender classes
+
+#define SENDER_IN_FLIGHT_WINDOW 4 // frames handed to esp_now_send whose send callback is still pending
 
-#define SENDER_TASK_DELAY_MS 10
-#define VCP_TASK_DELAY_MS 100
+/*
+ * The protocol runs in two tasks (vcp.c), each pinned to its own core of the ESP32:
+ * - the vcp task is the data plane: it takes the frames out of the receive ring, runs the link layer and forwards and
+ *   delivers DATA, stream and metrics messages. It hands HELLO, UPDATE, CREATE_VIRTUAL_NODE and ERR messages to the
+ *   control task through the control queue
+ * - the control task handles these, joins the cord and runs the hello timer and the neighbor expiry. It writes the
+ *   neighbor table and the own position, the UPDATEs it sends and the link state it drops go to the vcp task through
+ *   the link request queue, as the link layer belongs to the vcp task
+ * The vcp task reads the neighbor table without a lock (sequence counter, see vcp.c), so forwarding never waits for
+ * the control task. The control task has the higher priority, if both share one core it is never preempted by the vcp
+ * task while it writes.
+ */
+#define VCP_CONTROL_CORE 0
+#define VCP_DATA_CORE (portNUM_PROCESSORS > 1 ? 1 : 0)
+#define VCP_CONTROL_PRIORITY 5
+#define VCP_DATA_PRIORITY 4
+#define VCP_CONTROL_QUEUE_SIZE 8 // control messages waiting for the control task
+#define VCP_LINK_REQUEST_SIZE 8  // UPDATEs and dropped neighbors waiting for the vcp task
+
+/* Notification bits of the vcp task and the control task, they sleep until one of them is set */
+#define VCP_NOTIFY_RECEIVE (1 << 0)      // a frame was put into the receive ring
+#define VCP_NOTIFY_SEND_STATUS (1 << 1)  // a send status was put into the sender_error_queue
+#define VCP_NOTIFY_HELLO (1 << 2)        // control task: the hello timer expired
+#define VCP_NOTIFY_RETRANSMIT (1 << 3)   // the retransmission timer of the link layer expired
+#define VCP_NOTIFY_STREAM (1 << 4)       // a stream transfer was requested or the stream timer expired
+#define VCP_NOTIFY_EXPIRE (1 << 5)       // control task: the timing wheel of the neighbor table moved on by one slot
+#define VCP_NOTIFY_METRICS (1 << 6)      // a metrics request was put into the metrics request queue
+#define VCP_NOTIFY_PERF (1 << 7)         // the perf timer expired or the perf generator was started or stopped
+#define VCP_NOTIFY_CONTROL (1 << 8)      // control task: a message was put into the control queue
+#define VCP_NOTIFY_LINK_REQUEST (1 << 9) // the control task put a request into the link request queue
+#define VCP_NOTIFY_DATA (1 << 10)        // vcp_data_send put a message into the data queue
+
+/*
+ * Traffic classes of the frames waiting for the radio (sender-receiver.c). The control class is sent first, in FIFO
+ * order, but after TRAFFIC_CONTROL_BURST control frames in a row a waiting DATA frame goes next, so that a burst of
+ * HELLOs and ACKs (Trickle resets, many neighbors) can't starve the DATA frames. DATA frames are sent earliest
+ * deadline first, the deadline is the time the frame was handed to the link layer plus the smallest budget of its
+ * messages, or TRAFFIC_DEFAULT_BUDGET for messages without one. Frames for the same neighbor keep their order. A full control class drops its oldest frame
+ * (a newer HELLO or ACK supersedes it), a full data class drops the frame which would be sent last, which may be the
+ * new one. The link layer retransmits the dropped frames which have to be acknowledged.
+ */
+#define TRAFFIC_CLASS_CONTROL 0
+#define TRAFFIC_CLASS_DATA 1
+#define TRAFFIC_CLASSES 2
+#define TRAFFIC_DEFAULT_BUDGET 1000 // ms, deadline of DATA frames without a latency budget
+#define TRAFFIC_CONTROL_BURST 4     // control frames sent in a row at most while DATA frames wait
 
 #define ESPNOW_PMK "pmk1234567890123"
 #define ESPNOW_LMK "lmk1234567890123"
 
 /*
- * MESSAGE TYPES used in vcp_message_data_t
- * - HELLO (0x00) + float + float + float                   ----> 13 bytes
- * - UPDATE_SUCCESSOR (0x01) + float                        ----> 5 bytes
- * - UPDATE_PREDECESSOR (0x02) + float                      ----> 5 bytes
- * - DATA (0x04) + float(receiver) + char[]                 ----> ? bytes (at least 5)
+ * MESSAGE TYPES, every frame starts with a vcp_header_t (version + type) followed by the fields of the type.
+ * The fields are packed, positions are little endian uint32_t, sequence numbers (seq) little endian uint16_t
+ * (see vcp-message.c)
+ * - HELLO (0x00) + pos(position) + pos(successor) + pos(predecessor)           ----> 14 bytes
+ * - UPDATE_SUCCESSOR (0x01) + seq + pos(new position)                          ----> 8 bytes
+ * - UPDATE_PREDECESSOR (0x02) + seq + pos(new position)                        ----> 8 bytes
+ * - CREATE_VIRTUAL_NODE (0x03) + pos(virtual node position)                    ----> 6 bytes
+ * - DATA (0x04) + seq + pos(recipient) + pos(source) + uint16_t(budget)
+ *   + uint8_t[](payload)                                                       ----> at least 14 bytes
+ * - ERR (0x05)                                                                 ----> 2 bytes
+ * - ACK (0x06) + seq(cumulative) + uint32_t(selective)                         ----> 8 bytes
+ * - FRAGMENT (0x07) + seq + pos(recipient) + pos(source) + uint16_t(stream) + uint16_t(index)
+ *   + uint32_t(total length) + uint8_t[](payload)                              ----> at least 20 bytes
+ * - STREAM_ACK (0x08) + seq + pos(recipient) + pos(source) + uint16_t(stream) + uint16_t(cumulative)
+ *   + uint32_t(selective)                                                      ----> 20 bytes
+ * - DATA_BUNDLE (0x09) + seq + records, every record is
+ *   pos(recipient) + pos(source) + uint16_t(budget) + uint8_t(payload length)
+ *   + uint8_t[](payload)                                                       ----> at least 15 bytes
+ * - METRICS_REQUEST (0x0A) + seq + pos(recipient) + pos(source) + uint16_t(offset) ----> 14 bytes
+ * - METRICS (0x0B) + seq + pos(recipient) + pos(source) + uint16_t(offset) + uint16_t(total length)
+ *   + uint8_t[](payload)                                                       ----> at least 16 bytes
+ * Messages with a seq are acknowledged hop by hop (link-layer.c). An ACK acknowledges all sequence numbers before
+ * cumulative, and cumulative + 1 + i for every bit i set in selective.
+ * FRAGMENT and STREAM_ACK are routed like DATA, they carry the transfers of stream.c. A STREAM_ACK acknowledges the
+ * fragments of a stream end to end in the same way as an ACK acknowledges sequence numbers.
+ * A DATA_BUNDLE carries several DATA messages for the same next hop, every record is handled like a DATA message.
+ * The budget of a DATA message is the rest of its latency budget in ms, every hop takes off the time the message
+ * waited there. 0 means that the message has no budget. Its highest bit (VCP_DATA_PERF_FLAG) is no part of the budget,
+ * it marks the messages of the perf generator, which a sink counts instead of delivering them.
+ * METRICS_REQUEST and METRICS are routed like DATA: the recipient of a request answers with the bytes of its
+ * metrics_snapshot_t from offset on, as many as fit into one frame (VCP_METRICS_PAGE_LEN).
  */
+#define VCP_WIRE_VERSION 9
 #define VCP_HELLO 0x00
 #define VCP_UPDATE_SUCCESSOR 0x01
 #define VCP_UPDATE_PREDECESSOR 0x02
@@ -43,16 +124,172 @@
 #define VCP_DATA 0x04
 #define VCP_ERR 0x05
 #define VCP_ACK 0x06
+#define VCP_FRAGMENT 0x07
+#define VCP_STREAM_ACK 0x08
+#define VCP_DATA_BUNDLE 0x09
+#define VCP_METRICS_REQUEST 0x0A
+#define VCP_METRICS 0x0B
+#define VCP_MESSAGE_TYPES 12
 
-/* VCP parameters */
-#define VCP_START 0.0
-#define VCP_END 1.0
-#define VCP_INITIAL -1.0
-#define VCP_INTERVAL 0.1
-#define VCP_VIRT_INTERVAL 0.9
-#define VCP_DISCOVERY_CYCLES 3 // number of "cycles" before joining the cord
-#define VCP_HELLO_MESSAGE_PERIOD (10 * VCP_TASK_DELAY_MS)
+/*
+ * VCP parameters
+ * Cord positions are integers from VCP_START to VCP_END. A node joining between two neighbors takes the middle of the
+ * gap, gaps smaller than VCP_MIN_GAP are widened first by moving one of the two neighbors (local rebalancing). When a
+ * node takes over an end of the cord, the old end moves VCP_INTERVAL away from its inner neighbor, so that a cord
+ * which keeps growing at one end does not halve the same gap again and again.
+ * HELLOs follow a Trickle timer (RFC 6206): the interval starts at VCP_HELLO_IMIN and doubles up to
+ * VCP_HELLO_IMIN << VCP_HELLO_DOUBLINGS while the neighborhood is stable. A node sends its HELLO at a random point in
+ * the second half of the interval unless it heard VCP_HELLO_REDUNDANCY HELLOs which matched the neighbor table before.
+ * A new neighbor, an UPDATE, a virtual node or a changed position resets the interval, and the first interval after a
+ * reset is never suppressed. A node waiting to join announces itself with a HELLO without position, which is not
+ * added to the neighbor table but resets the intervals of its neighbors, so that it hears all of them during the
+ * discovery period.
+ * A neighbor which was not heard from (any frame) for VCP_NEIGHBOR_TIMEOUT is removed. The expiry runs on a timing
+ * wheel of VCP_NEIGHBOR_WHEEL_SLOTS slots of VCP_NEIGHBOR_TICK each, the timeout has to stay above the longest gap
+ * between two HELLOs of a neighbor ((VCP_HELLO_MAX_SUPPRESSED + 1) * longest hello interval).
+ */
+typedef uint32_t vcp_position_t;
+
+#define VCP_START 0
+#define VCP_END 0xFFFFFFFE
+#define VCP_INITIAL 0xFFFFFFFF // no position (yet)
+#define VCP_INTERVAL (1 << 20)
+#define VCP_MIN_GAP 1024
+#define VCP_DISCOVERY_PERIOD 1500  // ms listening for hello messages before joining the cord, > 2 * VCP_HELLO_IMIN
+#define VCP_HELLO_IMIN 250         // ms, shortest hello interval
+#define VCP_HELLO_DOUBLINGS 5      // longest hello interval VCP_HELLO_IMIN << VCP_HELLO_DOUBLINGS (8 s)
+#define VCP_HELLO_REDUNDANCY 3     // consistent HELLOs heard in an interval which make the own one redundant
+#define VCP_HELLO_MAX_SUPPRESSED 1 // HELLOs suppressed in a row at most, the neighbors still hear from the node
 #define VCP_MAX_VIRTUAL_NODES 1
+#define VCP_MAX_NEIGHBORS 64   // entries of the neighbor table, at most 127, independent of ESPNOW_MAX_PEERS
+#define VCP_MAC_INDEX_SIZE 128 // MAC hash index of the neighbor table, a power of two >= 2 * VCP_MAX_NEIGHBORS
+#define VCP_ROUTE_CACHE_SIZE 16 // cached next hops, the least recently used one is replaced
+#define VCP_NEIGHBOR_TIMEOUT 60000  // ms without a frame from a neighbor before it is removed
+#define VCP_NEIGHBOR_TICK 1000      // ms, one slot of the timing wheel
+#define VCP_NEIGHBOR_WHEEL_SLOTS 64 // > VCP_NEIGHBOR_TIMEOUT / VCP_NEIGHBOR_TICK
+
+/*
+ * Link layer parameters
+ * Every neighbor has its own sequence numbers and a sliding window of LINK_WINDOW frames which are sent without waiting
+ * for their ACK, the frames behind the window wait in the queue of the neighbor. A frame is retransmitted when its
+ * retransmission timeout (RTO) expires or when a frame sent after it was acknowledged first, and dropped after
+ * LINK_MAX_TRANSMISSIONS. The RTO follows the measured round trip time.
+ * DATA messages for a neighbor are appended to the newest frame of its queue as long as that frame was not sent yet
+ * and has room (DATA_BUNDLE). A new DATA frame waits up to LINK_AGGREGATE_DEADLINE for more messages, with 0 it is
+ * sent right away and only frames which wait for the window collect messages.
+ * Every neighbor has a link estimate: the RSSI of its frames and the share of unicasts its MAC acknowledged (send
+ * status), both smoothed by 1/LINK_ESTIMATE_WEIGHT per sample. The link cost is the expected number of transmissions
+ * (ETX = 1 / delivery ratio, at most LINK_MAX_ETX) in LINK_COST_UNIT steps, plus one transmission per
+ * LINK_RSSI_DB_PER_TX dB below LINK_RSSI_WEAK. Greedy routing prefers the cheaper link among neighbors which make the
+ * same progress.
+ */
+#define LINK_WINDOW 4 // frames in flight per neighbor, at most 32 (bits of the selective ACK)
+#define LINK_QUEUE 16 // frames per neighbor which are not acknowledged yet, a power of two >= LINK_WINDOW
+#define LINK_MAX_TRANSMISSIONS 6
+#define LINK_RTO_INITIAL 100      // ms, before the first round trip time was measured
+#define LINK_RTO_MIN 20           // ms
+#define LINK_RTO_MAX 2000         // ms
+#define LINK_AGGREGATE_DEADLINE 0 // ms, how long a new DATA frame waits for more messages
+#define LINK_ESTIMATE_WEIGHT 8
+#define LINK_MAX_ETX 16
+#define LINK_COST_UNIT 16         // link cost of one transmission
+#define LINK_RSSI_WEAK (-80)      // dBm, weaker links cost more than their ETX
+#define LINK_RSSI_DB_PER_TX 5
+
+/*
+ * Stream parameters
+ * A transfer is cut into fragments of VCP_STREAM_FRAGMENT_LEN bytes. The source keeps up to VCP_STREAM_WINDOW of them
+ * in flight which the destination has not acknowledged yet, the destination buffers that many fragments which arrive
+ * before the ones missing in front of them. A source which hears nothing for VCP_STREAM_TIMEOUT sends the oldest
+ * missing fragment again and gives up after VCP_STREAM_MAX_TIMEOUTS timeouts in a row.
+ */
+#define VCP_STREAM_FRAGMENT_LEN (ESP_NOW_MAX_DATA_LEN - 20) // payload of a FRAGMENT
+#define VCP_STREAM_WINDOW 8          // fragments, at most 32 (bits of the selective STREAM_ACK)
+#define VCP_STREAM_ACK_EVERY 8       // fragments received in order per STREAM_ACK, which share the path with them
+#define VCP_STREAM_TX 2              // transfers sent at the same time, further ones wait in the stream queue
+#define VCP_STREAM_RX 2              // transfers received at the same time
+#define VCP_STREAM_QUEUE_SIZE 4
+#define VCP_STREAM_TIMEOUT 1000      // ms, doubled on every timeout in a row
+#define VCP_STREAM_MAX_TIMEOUTS 5
+#define VCP_STREAM_RX_IDLE 10000     // ms without a fragment after which a received transfer is given up
+#define VCP_STREAM_TICK 100          // ms, period of the stream timer while transfers are active
+
+#define VCP_METRICS_PAGE_LEN (ESP_NOW_MAX_DATA_LEN - 16) // snapshot bytes per METRICS message
+#define VCP_METRICS_QUEUE_SIZE 4                         // METRICS_REQUESTs waiting for the vcp task
+
+#define VCP_DATA_HEADER_LEN 14                                     // DATA message without its payload
+#define VCP_DATA_PERF_FLAG 0x8000                                  // in the budget field of a perf DATA message
+#define VCP_DATA_MAX_BUDGET (VCP_DATA_PERF_FLAG - 1)               // ms, longest latency budget of a DATA message
+#define VCP_DATA_MAX_LEN (ESP_NOW_MAX_DATA_LEN - VCP_DATA_HEADER_LEN) // payload of a DATA message
+#define VCP_DATA_QUEUE_SIZE 8                                      // messages of vcp_data_send waiting for the vcp task
+
+/*
+ * Perf mode (vcp.c), compiled in with VCP_PERF 1 (the host build has it for the simulator). A generator sends DATA
+ * messages of payload_len bytes to a cord position, rate per second, marked with VCP_DATA_PERF_FLAG, every payload
+ * starts with a vcp_perf_header_t. Nodes are made generators with vcp_perf_start, a firmware built with
+ * VCP_PERF_TARGET starts one towards it once it joined. Every node is a sink: perf messages delivered to it are
+ * counted instead of handed to the application, it tracks the sequence numbers of VCP_PERF_SOURCES generators for the
+ * loss and keeps a uniform sample of VCP_PERF_SAMPLES latencies for the percentiles. A sink which received something
+ * prints its statistics every VCP_PERF_REPORT_PERIOD. Without VCP_PERF a perf message is delivered like any other.
+ * The latency is the time of the sink minus the send time of the generator, both esp_timer_get_time. The host
+ * simulator has one clock, on the ESP32 the difference of the boot times of the two nodes adds to every latency.
+ */
+#ifndef VCP_PERF
+#define VCP_PERF 0
+#endif
+#define VCP_PERF_TARGET VCP_INITIAL    // generators of all nodes send here from boot on, none if VCP_INITIAL
+#define VCP_PERF_RATE 10               // DATA messages per second of the generator started at boot
+#define VCP_PERF_PAYLOAD_LEN 32        // bytes of payload of these messages, at least sizeof(vcp_perf_header_t)
+#define VCP_PERF_TICK 10               // ms, period of the perf timer, the generator sends what is due every tick
+#define VCP_PERF_REPORT_PERIOD 10000   // ms between two statistics of a sink
+#define VCP_PERF_SOURCES 8             // generators a sink tracks the sequence numbers of
+#define VCP_PERF_SAMPLES 512           // latencies a sink keeps for the percentiles
+#define VCP_PERF_MAX_PAYLOAD_LEN VCP_DATA_MAX_LEN
+
+/*
+ * Metrics (metrics.c), cheap enough to stay on: counters per message type, latency histograms of the stages a frame
+ * passes and the high water marks of the queues, the heap and the task stacks. Every counter has one writer task, the
+ * send task for METRICS_TX and METRICS_STAGE_SEND and the vcp task for all others (see metrics.c).
+ * A latency histogram counts in bucket 0 the latencies below 32 us, in bucket b the ones from 16 << b to 32 << b us
+ * and in the last bucket all longer ones.
+ */
+#define METRICS_RX 0      // messages decoded from received frames, also the records of a DATA_BUNDLE
+#define METRICS_TX 1      // frames handed to esp_now_send, counted by the type of the frame
+#define METRICS_FORWARD 2 // messages routed on towards another position
+#define METRICS_DROP 3    // messages given up: no route or the link layer ran out of retransmissions
+#define METRICS_COUNTERS 4
+
+#define METRICS_STAGE_RECEIVE 0 // receive callback until the vcp task takes the frame out of the receive ring
+#define METRICS_STAGE_HANDLE 1  // the vcp task decoding and handling the frame
+#define METRICS_STAGE_SEND 2    // frame waiting in a traffic class until esp_now_send
+#define METRICS_STAGES 3
+#define METRICS_BUCKETS 12
+
+#define METRICS_TASK_VCP 0
+#define METRICS_TASK_SEND 1
+#define METRICS_TASK_CONTROL 2
+#define METRICS_TASKS 3
+
+#define METRICS_VERSION 2
+
+/*
+ * Packet trace (trace.c): a ring of the last TRACE_ENTRIES frames the node received or sent, always on. An entry keeps
+ * the first TRACE_HEAD_LEN bytes of the frame, which hold the whole header of every message type, and what the node
+ * did with it. trace_dump prints the ring over the serial console, host/replay.c feeds a trace back into the firmware.
+ */
+#define TRACE_ENTRIES 256 // has to be a power of two
+#define TRACE_HEAD_LEN 16
+#define TRACE_VERSION 1
+
+#define TRACE_TX 0x80                    // bit of the decision which marks a sent frame
+#define TRACE_HANDLED 0                  // received, handled by this node
+#define TRACE_FORWARDED 1                // received, (a message of it) was routed on
+#define TRACE_LINK 2                     // received, consumed by the link layer (an ACK or a duplicate)
+#define TRACE_REFUSED 3                  // received, not acknowledged as there was no room to forward it
+#define TRACE_DROPPED 4                  // received, handling failed (e.g. no route)
+#define TRACE_MALFORMED 5                // received, could not be decoded
+#define TRACE_SENT (TRACE_TX | 0)        // handed to esp_now_send
+#define TRACE_SEND_FAILED (TRACE_TX | 1) // esp_now_send refused the frame
 
 typedef struct
 {
@@ -60,6 +297,7 @@ typedef struct
     uint8_t *data;
     uint8_t data_len;
     int8_t rssi;
+    int64_t received_at; // us, when the receive callback got the frame
 } q_receive_data_t;
 
 typedef struct
@@ -68,20 +306,246 @@ typedef struct
     esp_now_send_status_t status;
 } q_send_error_data_t;
 
+typedef struct __attribute__((packed))
+{
+    uint8_t version; // VCP_WIRE_VERSION, frames of other versions are dropped
+    uint8_t type;    // es: VCP_HELLO, VCP_DATA
+} vcp_header_t;
+
+/* Decoded message, the payload of DATA points into the frame it was decoded from */
+typedef struct
+{
+    uint8_t type;
+    uint16_t seq; // DATA, UPDATE_SUCCESSOR and UPDATE_PREDECESSOR, set by the link layer
+    union
+    {
+        struct
+        {
+            vcp_position_t position;
+            vcp_position_t successor;
+            vcp_position_t predecessor;
+        } hello;
+        struct
+        {
+            vcp_position_t position;
+        } update; // UPDATE_SUCCESSOR, UPDATE_PREDECESSOR and CREATE_VIRTUAL_NODE
+        struct
+        {
+            vcp_position_t recipient;
+            vcp_position_t source; // position of the node which created the message
+            const uint8_t *payload;
+            uint8_t payload_len;
+            uint16_t budget; // DATA: ms left of the latency budget, 0 for none
+            bool perf;       // DATA: sent by a perf generator (VCP_DATA_PERF_FLAG)
+            struct
+            {
+                uint16_t id;
+                uint16_t index;     // FRAGMENT: number of the fragment, STREAM_ACK: cumulative
+                uint32_t total_len; // FRAGMENT: bytes of the whole transfer
+                uint32_t selective; // STREAM_ACK
+            } stream;
+        } data; // DATA, FRAGMENT (payload and stream), STREAM_ACK (stream) and DATA_BUNDLE (payload: the records)
+        struct
+        {
+            uint16_t cumulative;
+            uint32_t selective;
+        } ack;
+    };
+} vcp_message_t;
+
+/* Message the vcp task hands to the control task, it was acknowledged and checked for duplicates already. With
+ * add_neighbor set, mac_addr sent a sequenced frame but is not in the neighbor table yet: the frame was refused, the
+ * control task only adds the neighbor and msg is unused */
+typedef struct
+{
+    bool add_neighbor;
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // neighbor it was received from
+    vcp_message_t msg;                  // HELLO, UPDATE_*, CREATE_VIRTUAL_NODE or ERR, without payload
+} vcp_control_message_t;
+
+/* Request of the control task to the vcp task: sending an UPDATE, or dropping the link state of a removed neighbor */
 typedef struct
 {
-    uint8_t type; // es: VCP_HELLO, VCP_DATA
-    void *args;   // args can be of any type and dimension, depending on type
-} vcp_message_data_t;
+    int8_t forget;                      // index the removed neighbor had, -1 for an UPDATE
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // the neighbor the UPDATE is sent to or the removed one
+    vcp_message_t msg;
+} vcp_link_request_t;
+
+/* DATA message of vcp_data_send for the vcp task, frame is a buffer of the packet pool which holds the payload behind
+ * the room for the header (VCP_DATA_HEADER_LEN) */
+typedef struct
+{
+    uint8_t *frame;
+    vcp_position_t to;
+    uint16_t budget; // ms, 0 for none
+    uint8_t payload_len;
+} vcp_data_request_t;
 
 typedef struct
 {
     uint8_t transmit_type;              // 0: unicast, 1: broadcast
     uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // addr of sender OR receiver (depending on which queue struct is in)
     uint8_t payload_length;             // length of the data
-    vcp_message_data_t *payload;        // data
+    uint8_t *payload;                   // encoded frame, a buffer of the packet pool
+    uint8_t traffic_class;              // TRAFFIC_CLASS_CONTROL or TRAFFIC_CLASS_DATA, only used by the sender
+    int64_t deadline;                   // us, order of the frames of TRAFFIC_CLASS_DATA
 } esp_now_data_t;
 
+typedef struct
+{
+    uint32_t allocs;     // buffers handed out by packet_alloc
+    uint32_t exhausted;  // packet_alloc calls which found no free buffer
+    uint16_t in_use;     // buffers currently owned by someone
+    uint16_t high_water; // maximum of in_use since init_packet_pool
+} packet_pool_stats_t;
+
+typedef struct
+{
+    uint32_t pushed;     // frames handed to the vcp task
+    uint32_t dropped;    // frames dropped because the vcp task had not taken the older ones yet
+    uint32_t high_water; // maximum of frames waiting at the same time
+} receive_ring_stats_t;
+
+typedef struct
+{
+    uint32_t queued;       // frames handed to the class
+    uint32_t dropped;      // frames dropped because the class was full
+    uint32_t late;         // DATA frames which left the class after their deadline
+    uint32_t residence_max_us;
+    uint64_t residence_sum_us; // of the frames which left the class for the radio
+    uint8_t high_water;        // maximum of frames waiting in the class at the same time
+} traffic_class_stats_t;
+
+typedef struct
+{
+    uint32_t hits;      // unicasts to a peer which was installed already
+    uint32_t installs;  // peers added to the ESP-NOW peer list on their first unicast
+    uint32_t evictions; // peers deleted to make room for another one
+    uint32_t failed;    // esp_now_add_peer errors, the frame is dropped
+} peer_cache_stats_t;
+
+typedef struct
+{
+    uint32_t hits;        // next hops answered by the route cache
+    uint32_t misses;      // next hops computed from the neighbor table
+    uint32_t learned;     // reverse paths learned from incoming DATA messages
+    uint32_t invalidated; // entries dropped because a neighbor or the own position changed
+    uint32_t link_ties;   // greedy next hops which won a tie of equal progress with the cheaper link
+} vcp_route_cache_stats_t;
+
+/* Snapshot of the metrics of a node, the packed layout is what metrics_dump prints and METRICS messages carry. Fields
+ * are little endian like the wire format: the ESP32 and the host are both little endian, so the struct is copied */
+typedef struct __attribute__((packed))
+{
+    uint8_t version; // METRICS_VERSION
+    vcp_position_t position;
+    uint32_t uptime_ms;
+    uint32_t messages[VCP_MESSAGE_TYPES][METRICS_COUNTERS];
+    uint32_t malformed; // frames which could not be decoded
+    uint32_t latency[METRICS_STAGES][METRICS_BUCKETS];
+    uint32_t ring_dropped;
+    uint8_t ring_high_water;
+    uint8_t class_high_water[TRAFFIC_CLASSES];
+    uint8_t status_high_water; // sender_error_queue
+    uint8_t pool_high_water;
+    uint32_t free_heap;                 // bytes
+    uint32_t min_free_heap;             // bytes, lowest since boot
+    uint16_t stack_free[METRICS_TASKS]; // bytes, lowest since the task started
+} metrics_snapshot_t;
+
+/* Entry of the packet trace, the packed layout is what trace_dump prints and trace files contain */
+typedef struct __attribute__((packed))
+{
+    uint32_t time_us;                   // esp_timer_get_time of the reception or the send, wraps after 71 min
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // sender of a received frame, destination of a sent one
+    uint8_t len;                        // length of the frame
+    uint8_t decision;                   // TRACE_*
+    uint8_t head[TRACE_HEAD_LEN];       // first bytes of the frame, the rest is zero
+} trace_entry_t;
+
+/* Start of a trace file, followed by the entries oldest first */
+typedef struct __attribute__((packed))
+{
+    char magic[4];                      // "VCPT"
+    uint8_t version;                    // TRACE_VERSION
+    uint8_t entry_len;                  // sizeof(trace_entry_t)
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // of the traced node
+    uint32_t started_us;                // esp_timer_get_time when the trace was started, at boot
+} trace_header_t;
+
+typedef struct
+{
+    uint32_t sent;       // HELLOs broadcast, the one announcing a node which waits to join included
+    uint32_t suppressed; // HELLOs skipped because enough consistent ones were heard in the interval
+    uint32_t resets;     // inconsistencies which reset the hello interval to VCP_HELLO_IMIN
+} vcp_hello_stats_t;
+
+typedef struct
+{
+    uint32_t sent;                 // frames sent to the neighbor which have to be acknowledged
+    uint32_t retransmissions;      // including the fast retransmissions
+    uint32_t fast_retransmissions; // retransmitted because a frame sent later was acknowledged first
+    uint32_t failed;               // frames dropped after LINK_MAX_TRANSMISSIONS
+    uint32_t queue_full;           // frames refused because LINK_QUEUE frames were not acknowledged yet
+    uint32_t held;                 // retransmissions skipped because the sender still held the last one
+    uint32_t duplicates;           // frames received from the neighbor a second time
+    uint32_t srtt_us;              // smoothed round trip time, 0 before the first measurement
+    uint32_t rttvar_us;            // round trip time variation
+    uint32_t rto_us;               // current retransmission timeout
+    uint32_t messages;             // DATA messages sent to the neighbor
+    uint32_t bundled;              // DATA messages appended to a frame which was queued already
+} link_stats_t;
+
+typedef struct
+{
+    uint32_t fragments;    // fragments sent for the first time
+    uint32_t resent;       // fragments sent again because the destination missed them
+    uint32_t timeouts;     // stream timeouts without an acknowledgement
+    uint32_t acks;         // STREAM_ACKs sent as destination
+    uint32_t out_of_order; // fragments buffered because one in front of them was missing
+    uint32_t duplicates;   // fragments received a second time
+    uint32_t completed;    // transfers acknowledged completely (source) or received completely (destination)
+    uint32_t failed;       // transfers given up
+} vcp_stream_stats_t;
+
+/* Start of the payload of a perf DATA message, the rest of the payload is filler */
+typedef struct __attribute__((packed))
+{
+    uint32_t generator; // random id of the generator run, sequence numbers restart with it
+    uint32_t seq;       // messages of the run routed before this one
+    int64_t sent_at;    // us, esp_timer_get_time of the generator when it created the message
+} vcp_perf_header_t;
+
+typedef struct
+{
+    vcp_position_t to;
+    uint16_t rate; // messages per second, 0 stops the generator
+    uint8_t payload_len;
+} vcp_perf_config_t;
+
+/* Generator of perf messages, sequence numbers seen by a sink */
+typedef struct
+{
+    uint32_t generator;
+    uint32_t first_seq;
+    uint32_t next_seq; // one after the highest one received
+    uint32_t received;
+} vcp_perf_source_t;
+
+typedef struct
+{
+    uint32_t generated;      // messages the generator of this node routed
+    uint32_t refused;        // messages which were due but not taken: no route or the link queue was full
+    uint32_t received;       // perf messages delivered to this node
+    uint32_t lost;           // sequence numbers missing between the first and the highest one of every generator
+    uint32_t generators;     // generators heard, at most VCP_PERF_SOURCES of them are tracked for the loss
+    uint64_t bytes;          // payload bytes received
+    uint32_t goodput;        // payload bytes per second from the first to the last received message
+    uint32_t latency_p50_us; // percentiles of the latency sample
+    uint32_t latency_p99_us;
+    uint32_t latency_max_us;
+} vcp_perf_stats_t;
+
 typedef struct
 {
     char *receive_tag;
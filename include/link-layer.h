@@ -0,0 +1,74 @@
+/*
+ * link-layer.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the hop-by-hop reliability of the virtual cord protocol. Unicast DATA, UPDATE, FRAGMENT and
+ * STREAM_ACK messages get a sequence number of the neighbor they are sent to and are kept until that neighbor
+ * acknowledges them. Up to LINK_WINDOW of them per neighbor are in flight at the same time, up to LINK_QUEUE are kept.
+ * Neighbors are addressed by their index in the neighbor table (neighbor-table.h) together with the MAC address the
+ * caller read with it, the link layer never reads the table. The link state of an index is reset when another
+ * neighbor takes it over. A node which cannot forward a frame refuses it (link_refuse), the sender keeps
+ * it and backs off.
+ * DATA messages are appended to the newest frame queued for the neighbor as long as it was not sent yet (DATA_BUNDLE),
+ * so a neighbor which cannot keep up gets fewer and fuller frames.
+ * A received frame which is forwarded unchanged is taken over as it is (link_forward) instead of being encoded again.
+ * All functions run in the vcp task only, the control task asks it to drop the link state of removed neighbors.
+ *
+ */
+
+#ifndef LINK_LAYER_H
+#define LINK_LAYER_H
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+
+/* Frame waiting for its (first) transmission or its ACK, frame is a buffer of the packet pool or NULL if the slot is
+ * free */
+typedef struct
+{
+    uint8_t *frame;
+    uint8_t len;
+    uint8_t transmissions;
+    uint8_t records; // DATA messages in the frame, 0 for the other types
+    uint16_t seq;
+    uint32_t order;   // increases with every transmission to the neighbor
+    int64_t sent_at;  // us, last transmission
+    int64_t timeout;  // us, the retransmission timeout runs from here, restarted without a transmission
+    int64_t due;      // us, the first transmission waits for more DATA messages until then
+    int64_t accepted; // us, the first message of the frame was handed to the link layer
+    int64_t charged;  // us, the budgets in frame have been aged up to here
+    int64_t deadline; // us, earliest deadline of the messages in the frame (sender order), 0 for UPDATEs
+} link_frame_t;
+
+typedef struct
+{
+    bool used;
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN]; // neighbor the state belongs to
+    /* sender */
+    uint16_t next_seq;
+    uint16_t base; // oldest sequence number which is not acknowledged yet, the window starts here
+    uint32_t order;
+    link_frame_t queue[LINK_QUEUE]; // frame with sequence number s in queue[s % LINK_QUEUE]
+    /* receiver */
+    bool rx_synced;       // rx_next is known, set by the first frame received from the neighbor
+    bool ack_pending;     // a frame was received since the last ACK
+    uint16_t rx_next;     // all sequence numbers before it were received
+    uint32_t rx_received; // bit i: rx_next + 1 + i was received
+    link_stats_t stats;
+} link_state_t;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_link_layer(void);
+bool link_sequenced(uint8_t);
+esp_err_t link_send(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+esp_err_t link_forward(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *, uint8_t *, uint8_t);
+bool link_receive(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+void link_refuse(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], uint16_t);
+void link_handle_ack(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+void link_send_acks(void);
+void link_retransmit(void);
+void link_forget(int8_t, const uint8_t[ESP_NOW_ETH_ALEN]);
+void link_get_stats(int8_t, const uint8_t[ESP_NOW_ETH_ALEN], link_stats_t *);
+
+#endif
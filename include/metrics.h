@@ -0,0 +1,23 @@
+/*
+ * metrics.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the runtime metrics of the node (counters, histograms and high water marks, see config.h).
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_metrics(void);
+void metrics_count(uint8_t, uint8_t);
+void metrics_malformed(void);
+void metrics_latency(uint8_t, int64_t);
+void metrics_watch_task(uint8_t, TaskHandle_t);
+void metrics_snapshot(metrics_snapshot_t *);
+void metrics_dump(void);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * neighbor-table.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the neighbor table of the virtual cord protocol.
+ * A neighbor keeps its index in neighbors[] as long as it is in the table. The table keeps the indices sorted by cord
+ * position for nearest predecessor/successor queries in O(log n) and a hash index of the MAC addresses.
+ * Positions must only be changed with neighbor_set_position, the other fields can be written directly. Neighbors which
+ * were not heard from for VCP_NEIGHBOR_TIMEOUT are returned by neighbor_expire, which is called once per
+ * VCP_NEIGHBOR_TICK. The link estimate of a neighbor is fed with neighbor_rssi and neighbor_send_status.
+ *
+ */
+
+#ifndef NEIGHBOR_TABLE_H
+#define NEIGHBOR_TABLE_H
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+extern vcp_neighbor_data_t neighbors[VCP_MAX_NEIGHBORS];
+extern uint8_t neighbors_len;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_neighbor_table(void);
+int8_t neighbor_add(const uint8_t[ESP_NOW_ETH_ALEN]);
+void neighbor_remove(int8_t);
+void neighbor_heard(int8_t);
+uint8_t neighbor_expire(int8_t[VCP_MAX_NEIGHBORS]);
+void neighbor_set_position(int8_t, vcp_position_t);
+int8_t neighbor_at(uint8_t);
+int8_t neighbor_find_addr(const uint8_t[ESP_NOW_ETH_ALEN]);
+int8_t neighbor_find_pos(vcp_position_t);
+int8_t neighbor_nearest_predecessor(vcp_position_t);
+int8_t neighbor_nearest_successor(vcp_position_t);
+void neighbor_rssi(int8_t, int16_t, int8_t);
+void neighbor_send_status(int8_t, uint16_t, bool);
+uint16_t neighbor_link_cost(int8_t);
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * packet-pool.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the preallocated pool of ESP-NOW frame buffers.
+ * A buffer is handed on from owner to owner: receiver_callback -> receive ring -> vcp task for received frames and
+ * vcp task -> traffic classes of the sender -> send_data_task for outgoing frames. A forwarded frame goes from the vcp
+ * task to the link layer, which keeps it until the next hop acknowledges it and shares it with the sender
+ * (packet_ref) instead of handing it a copy. Every owner gives the buffer back with packet_free, the last one returns
+ * it to the pool. A buffer with more than one owner (packet_shared) must not be written.
+ *
+ */
+
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_packet_pool(void);
+void *packet_alloc(void);
+void packet_ref(void *);
+void packet_free(void *);
+bool packet_shared(const void *);
+void packet_pool_get_stats(packet_pool_stats_t *);
+
+#endif
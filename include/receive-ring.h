@@ -0,0 +1,39 @@
+/*
+ * receive-ring.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the lock-free single producer, single consumer ring which hands received frames from the
+ * ESP-NOW receive callback (WiFi task) to the vcp task.
+ *
+ */
+
+#ifndef RECEIVE_RING_H
+#define RECEIVE_RING_H
+
+#include <stdatomic.h>
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#if (RECEIVER_RING_SIZE & (RECEIVER_RING_SIZE - 1)) != 0
+#error "RECEIVER_RING_SIZE has to be a power of two"
+#endif
+
+/* The indices run freely and are reduced modulo RECEIVER_RING_SIZE, head - tail is the number of waiting frames. head
+ * is only written by the producer and tail only by the consumer, the slot between them is handed over by the release
+ * store of the index and the acquire load on the other side. The counters belong to the producer. */
+typedef struct
+{
+    q_receive_data_t slots[RECEIVER_RING_SIZE];
+    atomic_uint_fast32_t head; // next slot the producer writes
+    atomic_uint_fast32_t tail; // next slot the consumer reads
+    receive_ring_stats_t stats;
+} receive_ring_t;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void receive_ring_init(receive_ring_t *);
+bool receive_ring_push(receive_ring_t *, const q_receive_data_t *);
+bool receive_ring_pop(receive_ring_t *, q_receive_data_t *);
+void receive_ring_get_stats(receive_ring_t *, receive_ring_stats_t *);
+
+#endif
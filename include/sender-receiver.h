@@ -13,9 +13,27 @@
 #define SENDER_RECEIVER_H
 
 /* --------------------------------------------- variables and constants --------------------------------------------- */
-extern QueueHandle_t receiver_queue;
-extern QueueHandle_t sender_queue;
+#define PEER_SLOTS (ESPNOW_MAX_PEERS - 1) // the broadcast peer stays in the peer list
+
+/* Slot of the ESP-NOW peer list, the slot used least recently is given to the next unknown unicast destination */
+typedef struct
+{
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint32_t last_used; // value of the use counter at the last unicast, 0 if the slot is free
+    uint8_t in_flight;  // frames handed to esp_now_send whose send callback is still pending, the slot is kept
+} peer_slot_t;
+
+/* Frame waiting in a traffic class for the send task */
+typedef struct
+{
+    esp_now_data_t data;
+    int64_t queued_at; // us
+} sender_entry_t;
+
+extern receive_ring_t receive_ring; // filled by the receive callback, emptied by the vcp task
 extern QueueHandle_t sender_error_queue;
+extern SemaphoreHandle_t sender_window;
+extern TaskHandle_t queue_consumer_task; // notified whenever something is put into receive_ring or sender_error_queue
 
 extern uint8_t broadcast_mac[ESP_NOW_ETH_ALEN];
 extern const error_tags_t TAGS;
@@ -23,7 +41,13 @@ extern const error_tags_t TAGS;
 /* ----------------------------------------------- function definition ----------------------------------------------- */
 esp_err_t init_sender_receiver(void);
 esp_now_data_t parse_data(q_receive_data_t *);
+esp_err_t sender_enqueue(const esp_now_data_t *);
+void sender_get_class_stats(uint8_t, traffic_class_stats_t *);
 void deinit_sender_receiver(void);
 void print_esp_now_data_t(esp_now_data_t *);
+void peer_forget(const uint8_t *);
+void receiver_get_ring_stats(receive_ring_stats_t *);
+uint8_t sender_status_high_water(void);
+void peer_cache_get_stats(peer_cache_stats_t *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+ * stream.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the stream transfers of the virtual cord protocol: payloads larger than one ESP-NOW frame are cut
+ * into FRAGMENT messages, which are routed like DATA and pipelined over the hops of the path, and put together again
+ * in order at the destination. The destination acknowledges the fragments end to end with STREAM_ACK messages.
+ * vcp_stream_send (vcp.h) may be called by any task, everything else runs in the vcp task only.
+ *
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+
+typedef struct
+{
+    vcp_position_t to;
+    const uint8_t *data;
+    uint32_t len;
+} stream_request_t;
+
+/* Transfer of this node, fragment i starts at data + i * VCP_STREAM_FRAGMENT_LEN */
+typedef struct
+{
+    bool used;
+    uint16_t id;
+    vcp_position_t to;
+    const uint8_t *data;
+    uint32_t len;
+    uint16_t fragments;
+    uint16_t acked;      // all fragments before it were acknowledged by the destination
+    uint16_t next;       // first fragment which was never sent
+    uint32_t selective;  // bit i: fragment acked + 1 + i was acknowledged
+    uint32_t resent;     // bit i: fragment acked + i was sent again since the last timeout
+    uint8_t timeouts;    // in a row
+    int64_t progress_at; // us, start or last STREAM_ACK which acknowledged something new
+} stream_tx_t;
+
+typedef struct
+{
+    uint8_t len;
+    uint8_t data[VCP_STREAM_FRAGMENT_LEN];
+} stream_fragment_t;
+
+/* Transfer to this node, only the fragments which arrived before a missing one are buffered */
+typedef struct
+{
+    bool used;
+    uint16_t id;
+    vcp_position_t source;
+    uint32_t total_len;
+    uint16_t fragments;
+    uint16_t next;     // all fragments before it were handed to the receive callback
+    uint32_t received; // bit i: fragment next + 1 + i is in the reorder buffer
+    uint8_t unacked;   // fragments handed on since the last STREAM_ACK
+    int64_t last_at;   // us, last fragment
+    stream_fragment_t reorder[VCP_STREAM_WINDOW]; // fragment i in reorder[i % VCP_STREAM_WINDOW]
+} stream_rx_t;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_stream(void);
+void stream_poll(void);
+void stream_receive(const vcp_message_t *);
+void stream_handle_ack(const vcp_message_t *);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * trace.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the packet trace of the node, a ring of the last received and sent frames (see config.h).
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+void init_trace(void);
+uint32_t trace_record(int64_t, const uint8_t *, const uint8_t *, uint8_t, uint8_t);
+void trace_decide(uint32_t, uint8_t);
+void trace_header(trace_header_t *);
+uint32_t trace_export(trace_entry_t *, uint32_t, uint32_t *);
+void trace_dump(void);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * vcp-message.h
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the wire format of the virtual cord protocol messages.
+ * vcp_encode writes a message directly into a transmit buffer, vcp_decode reads it directly from the receive buffer.
+ * Neither of them allocates memory. DATA messages for the same next hop are packed into one frame with
+ * vcp_bundle_append and read back one by one with vcp_bundle_next. vcp_budget_elapsed ages the latency budgets of the
+ * DATA messages in an encoded frame, vcp_set_seq gives a received frame the sequence number of the next hop.
+ *
+ */
+
+#ifndef VCP_MESSAGE_H
+#define VCP_MESSAGE_H
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+esp_err_t vcp_encode(const vcp_message_t *, uint8_t *, uint8_t *);
+esp_err_t vcp_decode(const uint8_t *, uint8_t, vcp_message_t *);
+esp_err_t vcp_bundle_append(uint8_t *, uint8_t *, const vcp_message_t *);
+bool vcp_bundle_next(const vcp_message_t *, uint8_t *, vcp_message_t *);
+void vcp_budget_elapsed(uint8_t *, uint8_t, uint32_t);
+void vcp_set_seq(uint8_t *, uint16_t);
+
+#endif
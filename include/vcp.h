@@ -15,25 +15,92 @@
 
 /*
  * Data structure which stores the virtual and physical positions relevant for routing.
- * The successor and predecessor neighbors are saved as an index from 0 to ESPNOW_MAX_PEERS - 1. For example the physical
- * address of the successor neighbor can be accessed with neighbors[i_successor].mac_addr.
+ * The successor and predecessor neighbors are saved as an index from 0 to VCP_MAX_NEIGHBORS - 1 into the neighbor table
+ * (neighbor-table.h). For example the physical address of the successor neighbor can be accessed with
+ * neighbors[i_successor].mac_addr.
  */
 typedef struct
 {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
-    float position;
-    float successor;
-    float predecessor;
+    vcp_position_t position;
+    vcp_position_t successor;
+    vcp_position_t predecessor;
+    _Atomic uint32_t last_heard; // ms, last frame received from the neighbor, wraps after 49 days
+    _Atomic int16_t rssi;      // 1/16 dBm, smoothed RSSI of the frames received from the neighbor, 0 before the first
+    _Atomic uint16_t delivery; // smoothed share of the unicasts to the neighbor its MAC acknowledged, UINT16_MAX for all
 } vcp_neighbor_data_t;
 
 typedef struct
 {
-    float position;
+    vcp_position_t position;
     int8_t i_successor;
     int8_t i_predecessor;
 }vcp_vnode_data_t;
 
+/*
+ * Entry of the route cache: messages for a position from low to high (inclusive) are sent to the neighbor i_next_hop,
+ * -1 marks an unused entry. last_used orders the entries for replacement.
+ */
+typedef struct
+{
+    vcp_position_t low;
+    vcp_position_t high;
+    int8_t i_next_hop;
+    uint32_t last_used;
+} vcp_route_data_t;
+
+/*
+ * DATA messages of up to VCP_DATA_MAX_LEN bytes, the callback is called by the vcp task for every DATA message for this
+ * node. data points into the received frame and is only valid until the callback returns.
+ */
+typedef void (*vcp_data_receive_cb_t)(vcp_position_t source, const uint8_t *data, uint8_t len);
+
+/*
+ * Stream transfers (stream.c), both callbacks are called by the vcp task.
+ * The receive callback gets the transfer in order, one fragment at a time: offset is the position of data in the
+ * transfer of total_len bytes, the transfer is complete when offset + len == total_len. The sent callback gets the
+ * buffer of the finished transfer back, status is ESP_OK when the destination received all of it.
+ */
+typedef void (*vcp_stream_receive_cb_t)(vcp_position_t source, uint16_t stream, uint32_t offset, const uint8_t *data,
+                                        uint8_t len, uint32_t total_len);
+typedef void (*vcp_stream_sent_cb_t)(const uint8_t *data, uint32_t len, esp_err_t status);
+
+/*
+ * Metrics of other nodes, the callback is called by the vcp task for every METRICS message which answers a request of
+ * this node: data holds len bytes of the metrics_snapshot_t of the node at source from offset on, which is total_len
+ * bytes long. A lost request or answer is not repeated, the caller asks again.
+ */
+typedef void (*vcp_metrics_cb_t)(vcp_position_t source, uint16_t offset, const uint8_t *data, uint8_t len,
+                                 uint16_t total_len);
+
+extern _Atomic vcp_position_t own_position; // written by the control task
+
 /* ----------------------------------------------- function definition ----------------------------------------------- */
 void init_vcp(void);
+void vcp_get_route_cache_stats(vcp_route_cache_stats_t *);
+void vcp_get_hello_stats(vcp_hello_stats_t *);
+esp_err_t vcp_route(const vcp_message_t *);
+
+/* DATA messages without copies: the payload is written into the buffer of vcp_data_alloc, which is the frame the
+ * message is sent in. vcp_data_send takes the buffer over on ESP_OK, otherwise it stays with the caller, who sends it
+ * again or gives it back with vcp_data_free */
+void vcp_data_register(vcp_data_receive_cb_t);
+uint8_t *vcp_data_alloc(void);
+void vcp_data_free(uint8_t *);
+esp_err_t vcp_data_send(vcp_position_t, uint8_t *, uint8_t, uint16_t);
+
+/* Stream transfers (stream.c): data has to stay valid until the sent callback returned it */
+void vcp_stream_register(vcp_stream_receive_cb_t, vcp_stream_sent_cb_t);
+esp_err_t vcp_stream_send(vcp_position_t, const uint8_t *, uint32_t);
+void vcp_get_stream_stats(vcp_stream_stats_t *);
+
+/* Metrics over the cord, the own ones are read with metrics_snapshot (metrics.h) */
+void vcp_metrics_register(vcp_metrics_cb_t);
+esp_err_t vcp_metrics_request(vcp_position_t, uint16_t);
+
+/* Perf mode (VCP_PERF in config.h), generator and sink of timestamped DATA messages */
+esp_err_t vcp_perf_start(vcp_position_t, uint16_t, uint8_t);
+esp_err_t vcp_perf_stop(void);
+void vcp_perf_get_stats(vcp_perf_stats_t *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,610 @@
+/*
+ * link-layer.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the hop-by-hop acknowledgements and retransmissions of the virtual cord protocol.
+ * - sender: a frame is encoded once into a buffer of the packet pool which is kept until it is acknowledged, a frame
+ *   received for another node is taken over and only gets the sequence number of the next hop (cut-through). Every
+ *   (re)transmission shares the buffer with the sender, which releases it once ESP-NOW copied it, the frame is never
+ *   copied. Frames behind the window are sent as soon as the ACKs move the window on. Frames are retransmitted when
+ *   the retransmission timeout of the neighbor expires or right away when a frame sent later was acknowledged first,
+ *   ESP-NOW does not reorder frames. A frame whose last transmission still waits in the sender is not sent again.
+ * - receiver: duplicates are filtered with the sequence numbers, the frames are handed on in the order they arrive.
+ *   All frames received from a neighbor while the vcp task empties the receive ring are acknowledged with one ACK,
+ *   which goes to the control class of the sender and overtakes the DATA frames. Frames the node cannot forward are
+ *   refused (not acknowledged), so that the neighbor keeps them and backs off instead of filling the channel with
+ *   frames which would be dropped.
+ * - aggregation: a DATA message for a neighbor whose newest queued frame is a DATA or DATA_BUNDLE frame which was
+ *   not sent yet is appended to that frame instead of taking a sequence number of its own. The frame is sent when it
+ *   is due (LINK_AGGREGATE_DEADLINE after it was created) and inside the window, a full frame right away.
+ * - deadlines: the sender orders frames carrying DATA messages by their deadline, the time the frame was created plus
+ *   the smallest latency budget of its messages. Every transmission takes the age of the frame off its budgets, so
+ *   the next hop gets what is left of them.
+ * ACKs are the only frames a node sends back to its upstream neighbor, under load they collide with the frames the
+ * node two hops upstream sends to the same neighbor (hidden terminals).
+ * The retransmission timeout follows RFC 6298: RTO = SRTT + 4 * RTTVAR, backed off on every timeout. Round trip times
+ * are only measured for frames which were sent once and whose timeout never expired (Karn's algorithm).
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "receive-ring.h"
+#include "sender-receiver.h"
+#include "packet-pool.h"
+#include "vcp-message.h"
+#include "vcp.h"
+#include "link-layer.h"
+#include "metrics.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+NODE_STATE static link_state_t links[VCP_MAX_NEIGHBORS];
+NODE_STATE static TimerHandle_t retransmit_timer;
+NODE_STATE static int64_t timer_deadline; // us, when the retransmission timer fires if it is active
+
+_Static_assert(LINK_WINDOW <= 32, "the selective ACK covers 32 frames");
+_Static_assert(LINK_QUEUE >= LINK_WINDOW && (LINK_QUEUE & (LINK_QUEUE - 1)) == 0,
+               "LINK_QUEUE has to be a power of two (sequence numbers wrap around) and at least LINK_WINDOW");
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* Wakes up the vcp task, called by the timer service task */
+static void retransmit_timer_callback(TimerHandle_t timer)
+{
+    xTaskNotify(queue_consumer_task, VCP_NOTIFY_RETRANSMIT, eSetBits);
+}
+
+/* Makes sure that the retransmission timer fires at deadline (us) at the latest. Firing too early is harmless,
+ * link_retransmit checks all frames and restarts the timer for the next timeout */
+static void arm_timer(int64_t deadline)
+{
+    int64_t tick = portTICK_PERIOD_MS * 1000;
+    TickType_t ticks;
+
+    if (xTimerIsTimerActive(retransmit_timer) != pdFALSE && timer_deadline <= deadline)
+    {
+        return;
+    }
+    ticks = (deadline - esp_timer_get_time() + tick - 1) / tick;
+    timer_deadline = deadline;
+    xTimerChangePeriod(retransmit_timer, ticks > 0 ? ticks : 1, 0);
+}
+
+static void reset_link(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN])
+{
+    link_state_t *l = &links[n];
+
+    for (int q = 0; q < LINK_QUEUE; q++)
+    {
+        if (l->queue[q].frame != NULL)
+        {
+            packet_free(l->queue[q].frame);
+        }
+    }
+    memset(l, 0, sizeof(link_state_t));
+    l->used = true;
+    memcpy(l->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    // a restarted node must not continue with the sequence numbers its neighbors still expect
+    l->next_seq = esp_random();
+    l->base = l->next_seq;
+    l->stats.rto_us = LINK_RTO_INITIAL * 1000;
+}
+
+/* Returns the link state of neighbor n, mac_addr is its address as the caller read it together with n from the
+ * neighbor table. The state is reset if the index belonged to another neighbor before */
+static link_state_t *link_of(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN])
+{
+    if (!links[n].used || memcmp(links[n].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) != 0)
+    {
+        reset_link(n, mac_addr);
+    }
+    return &links[n];
+}
+
+/* Returns the absolute deadline of a message handed to the link layer at now */
+static int64_t deadline_of(const vcp_message_t *msg, int64_t now)
+{
+    uint16_t budget = msg->type == VCP_DATA && msg->data.budget > 0 ? msg->data.budget : TRAFFIC_DEFAULT_BUDGET;
+
+    return now + budget * 1000LL;
+}
+
+/* Hands frame f to the sender, f stays in the queue until it is acknowledged. The sender shares the buffer, nobody
+ * else holds it (see retransmit), so the budgets are aged in place */
+static esp_err_t transmit(link_state_t *l, link_frame_t *f)
+{
+    esp_now_data_t data = {.transmit_type = TRANSMIT_TYPE_UNICAST};
+    uint32_t elapsed;
+
+    f->transmissions++;
+    f->order = ++l->order;
+    f->sent_at = esp_timer_get_time();
+    f->timeout = f->sent_at;
+    arm_timer(f->timeout + l->stats.rto_us);
+
+    elapsed = f->records > 0 ? (f->sent_at - f->charged) / 1000 : 0;
+    if (elapsed > 0)
+    {
+        vcp_budget_elapsed(f->frame, f->len, elapsed);
+        f->charged += elapsed * 1000;
+    }
+    packet_ref(f->frame);
+    data.payload = f->frame;
+    data.payload_length = f->len;
+    memcpy(data.mac_addr, l->mac_addr, ESP_NOW_ETH_ALEN);
+    // UPDATEs maintain the cord, everything else the link layer sends is data
+    data.traffic_class = f->deadline == 0 ? TRAFFIC_CLASS_CONTROL : TRAFFIC_CLASS_DATA;
+    data.deadline = f->deadline;
+
+    // the retransmission timer sends a dropped frame again
+    return sender_enqueue(&data);
+}
+
+/* Sends f again or drops it after LINK_MAX_TRANSMISSIONS, returns true if it was sent */
+static bool retransmit(link_state_t *l, link_frame_t *f)
+{
+    if (packet_shared(f->frame))
+    {
+        // the sender still holds the last transmission, it was not on the air yet: a second copy would only take
+        // airtime, the timeout starts again instead
+        f->timeout = esp_timer_get_time();
+        arm_timer(f->timeout + l->stats.rto_us);
+        l->stats.held++;
+        return false;
+    }
+    if (f->transmissions >= LINK_MAX_TRANSMISSIONS)
+    {
+        ESP_LOGE(TAGS.send_tag, "Frame %u not acknowledged after %d transmissions, dropping it", f->seq,
+                 LINK_MAX_TRANSMISSIONS);
+        metrics_count(f->frame[1], METRICS_DROP); // type of the vcp_header_t
+        packet_free(f->frame);
+        f->frame = NULL;
+        l->stats.failed++;
+        return false;
+    }
+    l->stats.retransmissions++;
+    transmit(l, f);
+    return true;
+}
+
+/* Moves the window past the acknowledged frames and sends the due frames inside it */
+static void slide_window(link_state_t *l)
+{
+    int64_t now = esp_timer_get_time();
+
+    while (l->base != l->next_seq && l->queue[l->base % LINK_QUEUE].frame == NULL)
+    {
+        l->base++;
+    }
+    for (uint16_t s = l->base; s != l->next_seq && (uint16_t)(s - l->base) < LINK_WINDOW; s++)
+    {
+        link_frame_t *f = &l->queue[s % LINK_QUEUE];
+        if (f->frame == NULL || f->transmissions > 0)
+        {
+            continue;
+        }
+        if (f->due > now)
+        {
+            arm_timer(f->due);
+            continue;
+        }
+        transmit(l, f);
+    }
+}
+
+/* Appends the DATA message msg to the newest frame queued for l if that one collects DATA messages and was not sent
+ * yet. Returns false if msg needs a frame of its own, the newest frame is full then and sent as soon as possible */
+static bool aggregate(link_state_t *l, const vcp_message_t *msg)
+{
+    link_frame_t *f = &l->queue[(uint16_t)(l->next_seq - 1) % LINK_QUEUE];
+    int64_t deadline;
+
+    if (msg->type != VCP_DATA || l->base == l->next_seq || f->frame == NULL || f->transmissions > 0 ||
+        f->records == 0)
+    {
+        return false;
+    }
+    if (vcp_bundle_append(f->frame, &f->len, msg) != ESP_OK)
+    {
+        f->due = 0;
+        return false;
+    }
+    deadline = deadline_of(msg, esp_timer_get_time());
+    f->deadline = deadline < f->deadline ? deadline : f->deadline;
+    f->records++;
+    l->stats.messages++;
+    l->stats.bundled++;
+    return true;
+}
+
+static void update_rto(link_state_t *l, uint32_t rtt)
+{
+    uint32_t rto;
+
+    if (l->stats.srtt_us == 0)
+    {
+        l->stats.srtt_us = rtt > 0 ? rtt : 1;
+        l->stats.rttvar_us = rtt / 2;
+    }
+    else
+    {
+        uint32_t err = l->stats.srtt_us > rtt ? l->stats.srtt_us - rtt : rtt - l->stats.srtt_us;
+        l->stats.rttvar_us = (3 * l->stats.rttvar_us + err) / 4;
+        l->stats.srtt_us = (7 * l->stats.srtt_us + rtt) / 8;
+    }
+
+    rto = l->stats.srtt_us + 4 * l->stats.rttvar_us;
+    rto = rto < LINK_RTO_MIN * 1000 ? LINK_RTO_MIN * 1000 : rto;
+    l->stats.rto_us = rto > LINK_RTO_MAX * 1000 ? LINK_RTO_MAX * 1000 : rto;
+}
+
+/* Sends one ACK for everything received from the neighbor of l so far */
+static void send_ack(link_state_t *l)
+{
+    vcp_message_t ack = {.type = VCP_ACK};
+    esp_now_data_t data = {.transmit_type = TRANSMIT_TYPE_UNICAST};
+
+    l->ack_pending = false;
+
+    ack.ack.cumulative = l->rx_next;
+    ack.ack.selective = l->rx_received;
+    data.payload = packet_alloc();
+    if (data.payload == NULL)
+    {
+        // the neighbor retransmits and gets the ACK later
+        ESP_LOGE(TAGS.send_tag, "Packet pool exhausted, could not create ACK");
+        return;
+    }
+    vcp_encode(&ack, data.payload, &data.payload_length);
+    memcpy(data.mac_addr, l->mac_addr, ESP_NOW_ETH_ALEN);
+    // ACKs overtake the queued DATA frames, waiting behind them would only make the neighbor retransmit
+    data.traffic_class = TRAFFIC_CLASS_CONTROL;
+    sender_enqueue(&data);
+}
+
+/* Returns true for the sequenced message types which maintain the cord, they go to the control class of the sender */
+static bool link_control(uint8_t type)
+{
+    return type == VCP_UPDATE_SUCCESSOR || type == VCP_UPDATE_PREDECESSOR;
+}
+
+/* Returns true for the message types which are sent with a sequence number and acknowledged hop by hop */
+bool link_sequenced(uint8_t type)
+{
+    return type == VCP_DATA || type == VCP_UPDATE_SUCCESSOR || type == VCP_UPDATE_PREDECESSOR ||
+           type == VCP_FRAGMENT || type == VCP_STREAM_ACK || type == VCP_DATA_BUNDLE || type == VCP_METRICS_REQUEST ||
+           type == VCP_METRICS;
+}
+
+void init_link_layer(void)
+{
+    memset(links, 0, sizeof(links));
+    retransmit_timer = xTimerCreate("link_retransmit", pdMS_TO_TICKS(LINK_RTO_INITIAL), pdFALSE, NULL,
+                                    retransmit_timer_callback);
+    if (retransmit_timer == NULL)
+    {
+        ESP_LOGE(TAGS.send_tag, "Could not create retransmission timer");
+    }
+}
+
+/* Puts the frame of msg, which got the next sequence number of l already, into the queue slot f and sends it if the
+ * window allows it */
+static void enqueue(link_state_t *l, link_frame_t *f, const vcp_message_t *msg)
+{
+    f->seq = l->next_seq++;
+    f->transmissions = 0;
+    f->records = msg->type == VCP_DATA;
+    f->accepted = esp_timer_get_time();
+    f->charged = f->accepted;
+    f->due = f->records > 0 ? f->accepted + LINK_AGGREGATE_DEADLINE * 1000 : 0;
+    f->deadline = link_control(msg->type) ? 0 : deadline_of(msg, f->accepted);
+    l->stats.sent++;
+    l->stats.messages += f->records;
+
+    // once the frame is in the queue, it is not lost anymore if the first transmission fails
+    slide_window(l);
+}
+
+/* Sends msg to neighbor n with the next sequence number of n, a DATA message may share the frame (and sequence number)
+ * of the DATA messages queued before it. The message is encoded into a buffer which is kept until n acknowledges it,
+ * ESP_ERR_NO_MEM is returned if the queue of n is full or the packet pool is exhausted */
+esp_err_t link_send(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], const vcp_message_t *msg)
+{
+    link_state_t *l = link_of(n, mac_addr);
+    link_frame_t *f = &l->queue[l->next_seq % LINK_QUEUE];
+    vcp_message_t sequenced = *msg;
+    esp_err_t err;
+
+    if (aggregate(l, msg))
+    {
+        return ESP_OK;
+    }
+    if (f->frame != NULL)
+    {
+        // the frame LINK_QUEUE sequence numbers back was not acknowledged yet
+        l->stats.queue_full++;
+        return ESP_ERR_NO_MEM;
+    }
+    f->frame = packet_alloc();
+    if (f->frame == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    sequenced.seq = l->next_seq;
+    err = vcp_encode(&sequenced, f->frame, &f->len);
+    if (err != ESP_OK)
+    {
+        packet_free(f->frame);
+        f->frame = NULL;
+        return err;
+    }
+    enqueue(l, f, msg);
+    return ESP_OK;
+}
+
+/* Sends msg, which was decoded from frame (len bytes, a buffer of the packet pool), on to neighbor n like link_send,
+ * but without encoding it again: frame itself is queued with the next sequence number of n. On ESP_OK the link layer
+ * owns frame, a DATA message which joined the frame queued before it was copied and frame is freed already. On
+ * ESP_ERR_NO_MEM (the queue of n is full) frame is left untouched */
+esp_err_t link_forward(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], const vcp_message_t *msg, uint8_t *frame,
+                       uint8_t len)
+{
+    link_state_t *l = link_of(n, mac_addr);
+    link_frame_t *f = &l->queue[l->next_seq % LINK_QUEUE];
+
+    if (aggregate(l, msg))
+    {
+        packet_free(frame);
+        return ESP_OK;
+    }
+    if (f->frame != NULL)
+    {
+        l->stats.queue_full++;
+        return ESP_ERR_NO_MEM;
+    }
+    vcp_set_seq(frame, l->next_seq);
+    f->frame = frame;
+    f->len = len;
+    enqueue(l, f, msg);
+    return ESP_OK;
+}
+
+/* Records that msg was received from neighbor n. Returns false for duplicates, which are acknowledged again but must
+ * not be handled a second time */
+bool link_receive(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], const vcp_message_t *msg)
+{
+    link_state_t *l = link_of(n, mac_addr);
+    int16_t d;
+    bool more;
+
+    l->ack_pending = true;
+    if (!l->rx_synced)
+    {
+        l->rx_synced = true;
+        l->rx_next = msg->seq;
+    }
+
+    d = (int16_t)(msg->seq - l->rx_next);
+    if (d > 0 && d <= 32)
+    {
+        if (l->rx_received & (1u << (d - 1)))
+        {
+            l->stats.duplicates++;
+            return false;
+        }
+        l->rx_received |= 1u << (d - 1);
+        return true;
+    }
+    if (d < 0 && d >= -LINK_WINDOW)
+    {
+        // the ACK got lost, the sender never has older frames in flight
+        l->stats.duplicates++;
+        return false;
+    }
+    if (d != 0)
+    {
+        // far away from what was expected: the neighbor restarted
+        l->rx_next = msg->seq;
+        l->rx_received = 0;
+    }
+
+    // seq == rx_next, move on to the next sequence number which was not received yet
+    do
+    {
+        more = l->rx_received & 1;
+        l->rx_received >>= 1;
+        l->rx_next++;
+    } while (more);
+    return true;
+}
+
+/* Takes back the reception of the frame with sequence number seq from neighbor n, link_receive returned true for it.
+ * Used when there is no room to forward the frame: it is not acknowledged, so n keeps it and backs off instead of
+ * sending more frames which would be dropped here */
+void link_refuse(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], uint16_t seq)
+{
+    link_state_t *l = link_of(n, mac_addr);
+    int16_t d = (int16_t)(seq - l->rx_next);
+    int k;
+
+    if (d >= 0)
+    {
+        // only recorded in the bitmap
+        l->rx_received &= d > 0 && d <= 32 ? ~(1u << (d - 1)) : UINT32_MAX;
+        return;
+    }
+    if (d < -32)
+    {
+        return;
+    }
+    // rx_next moved past seq, the k frames in between were received
+    k = -d - 1;
+    l->rx_received = (k < 31 ? l->rx_received << (k + 1) : 0) | ((1u << k) - 1);
+    l->rx_next = seq;
+}
+
+/* Removes the frames acknowledged by the ACK msg from neighbor n from the queue, retransmits the frames which were
+ * sent before an acknowledged one and sends the frames the window moved over */
+void link_handle_ack(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], const vcp_message_t *msg)
+{
+    link_state_t *l = link_of(n, mac_addr);
+    int64_t now = esp_timer_get_time();
+    uint32_t newest = 0;
+    bool acked;
+    int16_t d;
+
+    for (int q = 0; q < LINK_QUEUE; q++)
+    {
+        link_frame_t *f = &l->queue[q];
+        if (f->frame == NULL || f->transmissions == 0)
+        {
+            continue;
+        }
+        d = (int16_t)(f->seq - msg->ack.cumulative);
+        acked = d < 0 || (d > 0 && d <= 32 && (msg->ack.selective & (1u << (d - 1))));
+        if (!acked)
+        {
+            continue;
+        }
+        if (f->transmissions == 1 && f->timeout == f->sent_at)
+        {
+            // sent once and the timeout never expired (Karn's algorithm)
+            update_rto(l, now - f->sent_at);
+        }
+        newest = f->order > newest ? f->order : newest;
+        packet_free(f->frame);
+        f->frame = NULL;
+    }
+
+    for (int q = 0; q < LINK_QUEUE; q++)
+    {
+        link_frame_t *f = &l->queue[q];
+        if (f->frame != NULL && f->transmissions > 0 && f->order < newest && retransmit(l, f))
+        {
+            l->stats.fast_retransmissions++;
+        }
+    }
+    slide_window(l);
+}
+
+/* Sends one ACK to every neighbor which sent frames since its last ACK */
+void link_send_acks(void)
+{
+    for (int n = 0; n < VCP_MAX_NEIGHBORS; n++)
+    {
+        if (links[n].used && links[n].ack_pending)
+        {
+            send_ack(&links[n]);
+        }
+    }
+}
+
+/* Called when the retransmission timer fired, also sends the frames which became due. Like TCP, only the oldest frame
+ * whose timeout expired is sent again, its ACK tells which of the others are missing (fast retransmission). Sending
+ * all of them at once would occupy the channel for long and most of the time the reason was a lost ACK. The timeout
+ * is backed off by a random factor between 1.5 and 2, so that neighbors which lost frames at the same time do not
+ * retransmit in lockstep */
+void link_retransmit(void)
+{
+    int64_t now = esp_timer_get_time(), next = INT64_MAX;
+
+    for (int n = 0; n < VCP_MAX_NEIGHBORS; n++)
+    {
+        link_state_t *l = &links[n];
+        uint32_t rto = l->stats.rto_us;
+        link_frame_t *oldest = NULL;
+
+        if (!l->used)
+        {
+            continue;
+        }
+        for (int q = 0; q < LINK_QUEUE; q++)
+        {
+            link_frame_t *f = &l->queue[q];
+            if (f->frame == NULL || f->transmissions == 0 || f->timeout + rto > now)
+            {
+                continue;
+            }
+            if (oldest == NULL || f->order < oldest->order)
+            {
+                oldest = f;
+            }
+            // restarts the timeout of the frame without sending it, sent_at stays the time of the transmission
+            f->timeout = now;
+        }
+        if (oldest != NULL)
+        {
+            rto += rto / 2 + esp_random() % (rto / 2 + 1);
+            l->stats.rto_us = rto > LINK_RTO_MAX * 1000 ? LINK_RTO_MAX * 1000 : rto;
+            retransmit(l, oldest);
+        }
+        slide_window(l);
+        for (int q = 0; q < LINK_QUEUE; q++)
+        {
+            link_frame_t *f = &l->queue[q];
+            if (f->frame != NULL && f->transmissions > 0 && f->timeout + l->stats.rto_us < next)
+            {
+                next = f->timeout + l->stats.rto_us;
+            }
+            else if (f->frame != NULL && f->transmissions == 0 && f->due > now && f->due < next &&
+                     (uint16_t)(f->seq - l->base) < LINK_WINDOW)
+            {
+                next = f->due;
+            }
+        }
+    }
+
+    xTimerStop(retransmit_timer, 0);
+    if (next != INT64_MAX)
+    {
+        arm_timer(next);
+    }
+}
+
+/* Drops the link state of neighbor n with MAC address mac_addr, which was removed from the neighbor table, together
+ * with its queued frames. Nothing is dropped if another neighbor took the index over already */
+void link_forget(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN])
+{
+    if (!links[n].used || memcmp(links[n].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) != 0)
+    {
+        return;
+    }
+    for (int q = 0; q < LINK_QUEUE; q++)
+    {
+        if (links[n].queue[q].frame != NULL)
+        {
+            packet_free(links[n].queue[q].frame);
+        }
+    }
+    memset(&links[n], 0, sizeof(link_state_t));
+}
+
+/* Copies the counters and round trip time estimates of neighbor n with address mac_addr */
+void link_get_stats(int8_t n, const uint8_t mac_addr[ESP_NOW_ETH_ALEN], link_stats_t *stats)
+{
+    if (links[n].used && memcmp(links[n].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+    {
+        *stats = links[n].stats;
+    }
+    else
+    {
+        memset(stats, 0, sizeof(link_stats_t));
+    }
+}
@@ -29,8 +29,11 @@
 
 /* -------------------------------------------------- own includes --------------------------------------------------- */
 #include "config.h"
+#include "receive-ring.h"
 #include "sender-receiver.h"
 #include "vcp.h"
+#include "metrics.h"
+#include "trace.h"
 
 /* ----------------------------------------------- function definition ----------------------------------------------- */
 static void init_wifi(void);
@@ -60,6 +63,9 @@ void app_main()
 
     // initiliaze the wifi-functionality of the esp32
     init_wifi();
+    // the metrics and the packet trace are recorded from the start of the tasks on
+    init_metrics();
+    init_trace();
     // initialize sender and receiver and the vcp protocol
     init_sender_receiver();
     // initialize the vcp algorithm
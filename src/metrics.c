@@ -0,0 +1,147 @@
+/*
+ * metrics.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the runtime metrics of the node. Recording is a single increment of a plain counter, so it stays
+ * on in production. Two tasks record, each into its own counters:
+ * - the send task: METRICS_TX of every type and the histogram of METRICS_STAGE_SEND (sender_dequeue)
+ * - the vcp task: all other counters, METRICS_DROP also for the frames the link layer gives up, which it retransmits
+ *   in the vcp task as well, and malformed
+ * The control task records nothing, its UPDATEs are sent by the vcp task and its HELLOs are counted by the send task.
+ * A counter is a 32-bit word, so a reader in another task sees either value, a snapshot may be one event behind. The
+ * high water marks of the queues, the pool, the heap and the stacks are kept by their owners and only collected by
+ * metrics_snapshot.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_now.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "receive-ring.h"
+#include "sender-receiver.h"
+#include "packet-pool.h"
+#include "vcp.h"
+#include "metrics.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define DUMP_BYTES_PER_LINE 32
+
+NODE_STATE static uint32_t messages[VCP_MESSAGE_TYPES][METRICS_COUNTERS];
+NODE_STATE static uint32_t malformed;
+NODE_STATE static uint32_t latency[METRICS_STAGES][METRICS_BUCKETS];
+NODE_STATE static TaskHandle_t tasks[METRICS_TASKS];
+NODE_STATE static int64_t started_at; // us
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* Called before any task which records metrics is started */
+void init_metrics(void)
+{
+    memset(messages, 0, sizeof(messages));
+    malformed = 0;
+    memset(latency, 0, sizeof(latency));
+    memset(tasks, 0, sizeof(tasks));
+    started_at = esp_timer_get_time();
+}
+
+/* Counts a message of type, counter is one of METRICS_RX, METRICS_TX, METRICS_FORWARD and METRICS_DROP */
+void metrics_count(uint8_t type, uint8_t counter)
+{
+    if (type < VCP_MESSAGE_TYPES)
+    {
+        messages[type][counter]++;
+    }
+}
+
+void metrics_malformed(void)
+{
+    malformed++;
+}
+
+/* Adds a latency of us microseconds to the histogram of stage */
+void metrics_latency(uint8_t stage, int64_t us)
+{
+    int bucket = 0;
+
+    if (us >= 32)
+    {
+        // 2^(bucket + 4) <= us < 2^(bucket + 5)
+        bucket = us >= (16LL << (METRICS_BUCKETS - 1)) ? METRICS_BUCKETS - 1 : 27 - __builtin_clz((uint32_t)us);
+    }
+    latency[stage][bucket]++;
+}
+
+/* The snapshot reports the stack high water mark of the task */
+void metrics_watch_task(uint8_t task, TaskHandle_t handle)
+{
+    tasks[task] = handle;
+}
+
+void metrics_snapshot(metrics_snapshot_t *snapshot)
+{
+    receive_ring_stats_t ring;
+    traffic_class_stats_t classes;
+    packet_pool_stats_t pool;
+
+    memset(snapshot, 0, sizeof(metrics_snapshot_t));
+    snapshot->version = METRICS_VERSION;
+    snapshot->position = atomic_load_explicit(&own_position, memory_order_relaxed);
+    snapshot->uptime_ms = (esp_timer_get_time() - started_at) / 1000;
+    memcpy(snapshot->messages, messages, sizeof(messages));
+    snapshot->malformed = malformed;
+    memcpy(snapshot->latency, latency, sizeof(latency));
+
+    receiver_get_ring_stats(&ring);
+    snapshot->ring_dropped = ring.dropped;
+    snapshot->ring_high_water = ring.high_water;
+    for (uint8_t c = 0; c < TRAFFIC_CLASSES; c++)
+    {
+        sender_get_class_stats(c, &classes);
+        snapshot->class_high_water[c] = classes.high_water;
+    }
+    snapshot->status_high_water = sender_status_high_water();
+    packet_pool_get_stats(&pool);
+    snapshot->pool_high_water = pool.high_water;
+
+    snapshot->free_heap = esp_get_free_heap_size();
+    snapshot->min_free_heap = esp_get_minimum_free_heap_size();
+    for (uint8_t t = 0; t < METRICS_TASKS; t++)
+    {
+        snapshot->stack_free[t] = tasks[t] != NULL ? uxTaskGetStackHighWaterMark(tasks[t]) : 0;
+    }
+}
+
+/* Prints the snapshot as hex over the serial console, one "metrics <offset> <bytes>" line per DUMP_BYTES_PER_LINE
+ * bytes, so that a host tool can put it back together */
+void metrics_dump(void)
+{
+    metrics_snapshot_t snapshot;
+    const uint8_t *bytes = (const uint8_t *)&snapshot;
+    char line[2 * DUMP_BYTES_PER_LINE + 1];
+    int len;
+
+    metrics_snapshot(&snapshot);
+    for (int offset = 0; offset < sizeof(snapshot); offset += DUMP_BYTES_PER_LINE)
+    {
+        len = sizeof(snapshot) - offset < DUMP_BYTES_PER_LINE ? sizeof(snapshot) - offset : DUMP_BYTES_PER_LINE;
+        for (int i = 0; i < len; i++)
+        {
+            sprintf(&line[2 * i], "%02x", bytes[offset + i]);
+        }
+        printf("metrics %d %s\n", offset, line);
+    }
+}
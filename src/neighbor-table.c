@@ -0,0 +1,403 @@
+/*
+ * neighbor-table.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the neighbor table of the virtual cord protocol. The entries live in fixed slots (neighbors[]),
+ * two indices point into them:
+ * - sorted[]: the slots ordered by cord position, neighbors without a position (VCP_INITIAL) are at the end
+ * - mac_index[]: open addressing hash table with linear probing, keyed by MAC address
+ * - wheel[]: timing wheel of the expiry, every neighbor is in the slot of the tick its timeout expires in (doubly
+ *   linked through wheel_next[]/wheel_prev[]). Hearing from a neighbor only updates last_heard, the entry is moved
+ *   to its new slot when the wheel reaches the old one. So every tick looks at one slot only.
+ * The control task writes the table, the vcp task reads it without a lock and retries if it was written meanwhile
+ * (see vcp.c), the lookups therefore stay within the arrays whatever they read. The vcp task itself only writes
+ * last_heard and the link estimate (neighbor_heard, neighbor_rssi, neighbor_send_status), which are atomic. The link
+ * estimate is only replaced if it still holds the value the vcp task read together with the index, so a sample never
+ * lands on a neighbor the control task put into the slot meanwhile.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_now.h"
+#include "esp_timer.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "vcp.h"
+#include "neighbor-table.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+NODE_STATE vcp_neighbor_data_t neighbors[VCP_MAX_NEIGHBORS];
+NODE_STATE uint8_t neighbors_len;
+
+NODE_STATE static int8_t sorted[VCP_MAX_NEIGHBORS];
+NODE_STATE static int8_t mac_index[VCP_MAC_INDEX_SIZE]; // slot or -1
+NODE_STATE static bool slot_used[VCP_MAX_NEIGHBORS];
+NODE_STATE static int8_t wheel[VCP_NEIGHBOR_WHEEL_SLOTS]; // first neighbor of the slot or -1
+NODE_STATE static int8_t wheel_next[VCP_MAX_NEIGHBORS];
+NODE_STATE static int8_t wheel_prev[VCP_MAX_NEIGHBORS]; // -1 for the first neighbor of a slot
+NODE_STATE static uint8_t wheel_slot[VCP_MAX_NEIGHBORS]; // VCP_NEIGHBOR_WHEEL_SLOTS if not in the wheel
+NODE_STATE static int64_t wheel_tick; // last tick the wheel handled
+
+_Static_assert((VCP_MAC_INDEX_SIZE & (VCP_MAC_INDEX_SIZE - 1)) == 0 && VCP_MAC_INDEX_SIZE >= 2 * VCP_MAX_NEIGHBORS,
+               "VCP_MAC_INDEX_SIZE has to be a power of two and at least twice VCP_MAX_NEIGHBORS");
+_Static_assert(VCP_MAX_NEIGHBORS <= INT8_MAX, "neighbors are addressed with int8_t");
+_Static_assert(VCP_NEIGHBOR_TIMEOUT / VCP_NEIGHBOR_TICK < VCP_NEIGHBOR_WHEEL_SLOTS,
+               "the timing wheel has to reach every timeout without wrapping around");
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* FNV-1a */
+static uint32_t mac_hash(const uint8_t mac[ESP_NOW_ETH_ALEN])
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+    {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    return h & (VCP_MAC_INDEX_SIZE - 1);
+}
+
+/* Rank of the first of the first len sorted neighbors whose position is not smaller than p */
+static uint8_t lower_bound(vcp_position_t p, uint8_t len)
+{
+    uint8_t lo = 0, hi = len, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (neighbors[sorted[mid]].position < p)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Rank of the first neighbor whose position is larger than p */
+static uint8_t upper_bound(vcp_position_t p)
+{
+    uint8_t lo = 0, hi = neighbors_len, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (neighbors[sorted[mid]].position <= p)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Removes slot n from sorted[], the table has to contain it */
+static void unlink_sorted(int8_t n)
+{
+    uint8_t r = lower_bound(neighbors[n].position, neighbors_len);
+
+    while (sorted[r] != n)
+    {
+        r++;
+    }
+    memmove(&sorted[r], &sorted[r + 1], (neighbors_len - r - 1) * sizeof(sorted[0]));
+}
+
+/* Inserts slot n into sorted[], which holds neighbors_len - 1 entries at this point */
+static void link_sorted(int8_t n)
+{
+    uint8_t r = lower_bound(neighbors[n].position, neighbors_len - 1);
+
+    memmove(&sorted[r + 1], &sorted[r], (neighbors_len - 1 - r) * sizeof(sorted[0]));
+    sorted[r] = n;
+}
+
+/* Milliseconds since neighbor n was heard from, now_ms is esp_timer_get_time() / 1000. The unsigned difference stays
+ * right when the stamp wraps around */
+static uint32_t heard_ago(int8_t n, int64_t now_ms)
+{
+    return (uint32_t)now_ms - atomic_load_explicit(&neighbors[n].last_heard, memory_order_relaxed);
+}
+
+/* Puts neighbor n into the slot of the tick its timeout expires in, at least the next one */
+static void wheel_insert(int8_t n)
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    int64_t tick = (now_ms - heard_ago(n, now_ms) + VCP_NEIGHBOR_TIMEOUT) / VCP_NEIGHBOR_TICK;
+    uint8_t slot = (tick > wheel_tick ? tick : wheel_tick + 1) % VCP_NEIGHBOR_WHEEL_SLOTS;
+
+    wheel_slot[n] = slot;
+    wheel_prev[n] = -1;
+    wheel_next[n] = wheel[slot];
+    if (wheel[slot] != -1)
+    {
+        wheel_prev[wheel[slot]] = n;
+    }
+    wheel[slot] = n;
+}
+
+static void wheel_unlink(int8_t n)
+{
+    if (wheel_slot[n] == VCP_NEIGHBOR_WHEEL_SLOTS)
+    {
+        return;
+    }
+    if (wheel_prev[n] != -1)
+    {
+        wheel_next[wheel_prev[n]] = wheel_next[n];
+    }
+    else
+    {
+        wheel[wheel_slot[n]] = wheel_next[n];
+    }
+    if (wheel_next[n] != -1)
+    {
+        wheel_prev[wheel_next[n]] = wheel_prev[n];
+    }
+}
+
+void init_neighbor_table(void)
+{
+    neighbors_len = 0;
+    memset(mac_index, -1, sizeof(mac_index));
+    memset(slot_used, 0, sizeof(slot_used));
+    memset(wheel, -1, sizeof(wheel));
+    wheel_tick = esp_timer_get_time() / 1000 / VCP_NEIGHBOR_TICK;
+}
+
+/* Returns the index of the neighbor with the given MAC address, a new neighbor without positions is added if it is
+ * not known yet. Returns -1 if the table is full */
+int8_t neighbor_add(const uint8_t mac[ESP_NOW_ETH_ALEN])
+{
+    int8_t n = neighbor_find_addr(mac);
+    uint32_t h;
+
+    if (n != -1)
+    {
+        return n;
+    }
+    if (neighbors_len == VCP_MAX_NEIGHBORS)
+    {
+        return -1;
+    }
+
+    for (n = 0; slot_used[n]; n++)
+        ;
+    slot_used[n] = true;
+    memcpy(neighbors[n].mac_addr, mac, ESP_NOW_ETH_ALEN);
+    neighbors[n].position = VCP_INITIAL;
+    neighbors[n].successor = VCP_INITIAL;
+    neighbors[n].predecessor = VCP_INITIAL;
+    atomic_store_explicit(&neighbors[n].last_heard, (uint32_t)(esp_timer_get_time() / 1000), memory_order_relaxed);
+    atomic_store_explicit(&neighbors[n].rssi, 0, memory_order_relaxed);
+    // until the first send status only the RSSI counts
+    atomic_store_explicit(&neighbors[n].delivery, UINT16_MAX, memory_order_relaxed);
+    wheel_insert(n);
+
+    // VCP_INITIAL is the largest position, so the new neighbor goes to the end
+    sorted[neighbors_len++] = n;
+
+    for (h = mac_hash(mac); mac_index[h] != -1; h = (h + 1) & (VCP_MAC_INDEX_SIZE - 1))
+        ;
+    mac_index[h] = n;
+
+    return n;
+}
+
+/* Removes neighbor n, the indices of the other neighbors stay valid */
+void neighbor_remove(int8_t n)
+{
+    uint32_t i, j, k;
+
+    if (n < 0 || n >= VCP_MAX_NEIGHBORS || !slot_used[n])
+    {
+        return;
+    }
+
+    unlink_sorted(n);
+    wheel_unlink(n);
+    neighbors_len--;
+    slot_used[n] = false;
+
+    // backward shift deletion keeps every probe sequence free of holes
+    for (i = mac_hash(neighbors[n].mac_addr); mac_index[i] != n; i = (i + 1) & (VCP_MAC_INDEX_SIZE - 1))
+        ;
+    mac_index[i] = -1;
+    for (j = (i + 1) & (VCP_MAC_INDEX_SIZE - 1); mac_index[j] != -1; j = (j + 1) & (VCP_MAC_INDEX_SIZE - 1))
+    {
+        k = mac_hash(neighbors[mac_index[j]].mac_addr);
+        // the entry at j may stay if its home k lies cyclically in (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+        {
+            continue;
+        }
+        mac_index[i] = mac_index[j];
+        mac_index[j] = -1;
+        i = j;
+    }
+}
+
+/* Records that a frame of neighbor n was received, O(1): the timing wheel catches up when it reaches the old slot.
+ * Called by the vcp task while the control task may read the stamp in neighbor_expire */
+void neighbor_heard(int8_t n)
+{
+    atomic_store_explicit(&neighbors[n].last_heard, (uint32_t)(esp_timer_get_time() / 1000), memory_order_relaxed);
+}
+
+/* Moves the timing wheel on to the current tick. The neighbors in the slots it passes whose timeout expired are stored
+ * in expired (the caller removes them with neighbor_remove), the others go to the slot of their new timeout. Returns
+ * the number of expired neighbors */
+uint8_t neighbor_expire(int8_t expired[VCP_MAX_NEIGHBORS])
+{
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    int64_t tick = now_ms / VCP_NEIGHBOR_TICK;
+    uint8_t count = 0;
+    int8_t n, next;
+
+    // a slot is never more than one round ahead, one round covers all of them
+    if (tick - wheel_tick > VCP_NEIGHBOR_WHEEL_SLOTS)
+    {
+        wheel_tick = tick - VCP_NEIGHBOR_WHEEL_SLOTS;
+    }
+    while (wheel_tick < tick)
+    {
+        uint8_t slot = ++wheel_tick % VCP_NEIGHBOR_WHEEL_SLOTS;
+
+        n = wheel[slot];
+        wheel[slot] = -1;
+        for (; n != -1; n = next)
+        {
+            next = wheel_next[n];
+            if (heard_ago(n, now_ms) >= VCP_NEIGHBOR_TIMEOUT)
+            {
+                // stays out of the wheel until neighbor_remove
+                wheel_slot[n] = VCP_NEIGHBOR_WHEEL_SLOTS;
+                expired[count++] = n;
+            }
+            else
+            {
+                wheel_insert(n);
+            }
+        }
+    }
+    return count;
+}
+
+void neighbor_set_position(int8_t n, vcp_position_t position)
+{
+    if (neighbors[n].position == position)
+    {
+        return;
+    }
+    unlink_sorted(n);
+    neighbors[n].position = position;
+    link_sorted(n);
+}
+
+/* Index of the neighbor with the given rank in cord order, rank < neighbors_len */
+int8_t neighbor_at(uint8_t rank)
+{
+    return sorted[rank];
+}
+
+/* Returns the index of the neighbor with the given MAC address or -1 if it is unknown */
+int8_t neighbor_find_addr(const uint8_t mac[ESP_NOW_ETH_ALEN])
+{
+    uint32_t h = mac_hash(mac);
+    int8_t n;
+
+    // the index is never full, so the probing ends at a free entry; the bound only matters for a reader which sees
+    // the index while it is written
+    for (int i = 0; i < VCP_MAC_INDEX_SIZE; i++, h = (h + 1) & (VCP_MAC_INDEX_SIZE - 1))
+    {
+        n = mac_index[h];
+        if (n == -1 || memcmp(neighbors[n].mac_addr, mac, ESP_NOW_ETH_ALEN) == 0)
+        {
+            return n;
+        }
+    }
+    return -1;
+}
+
+/* Returns the index of a neighbor at position p or -1 if there is none */
+int8_t neighbor_find_pos(vcp_position_t p)
+{
+    uint8_t r = lower_bound(p, neighbors_len);
+
+    if (p == VCP_INITIAL || r == neighbors_len || neighbors[sorted[r]].position != p)
+    {
+        return -1;
+    }
+    return sorted[r];
+}
+
+/* Returns the index of the neighbor with the largest position smaller than p or -1 if there is none */
+int8_t neighbor_nearest_predecessor(vcp_position_t p)
+{
+    uint8_t r = lower_bound(p, neighbors_len);
+
+    return r == 0 ? -1 : sorted[r - 1];
+}
+
+/* Returns the index of the neighbor with the smallest position larger than p or -1 if there is none */
+int8_t neighbor_nearest_successor(vcp_position_t p)
+{
+    uint8_t r = upper_bound(p);
+
+    if (r == neighbors_len || neighbors[sorted[r]].position == VCP_INITIAL)
+    {
+        return -1;
+    }
+    return sorted[r];
+}
+
+/* Smooths the RSSI of a frame received from neighbor n into its link estimate, the first frame sets it. old is the
+ * estimate read together with n, nothing changes if the entry holds another value now */
+void neighbor_rssi(int8_t n, int16_t old, int8_t rssi)
+{
+    int16_t sample = rssi * 16;
+    int16_t smoothed = old == 0 ? sample : old + (sample - old) / LINK_ESTIMATE_WEIGHT;
+
+    atomic_compare_exchange_strong_explicit(&neighbors[n].rssi, &old, smoothed, memory_order_relaxed,
+                                            memory_order_relaxed);
+}
+
+/* Smooths the send status of a unicast to neighbor n (acknowledged by its MAC or not) into its delivery ratio. old is
+ * the ratio read together with n, nothing changes if the entry holds another value now */
+void neighbor_send_status(int8_t n, uint16_t old, bool delivered)
+{
+    int32_t sample = delivered ? UINT16_MAX : 0;
+    uint16_t smoothed = old + (sample - (int32_t)old) / LINK_ESTIMATE_WEIGHT;
+
+    atomic_compare_exchange_strong_explicit(&neighbors[n].delivery, &old, smoothed, memory_order_relaxed,
+                                            memory_order_relaxed);
+}
+
+/* Returns the link cost of neighbor n in LINK_COST_UNIT per expected transmission, see config.h */
+uint16_t neighbor_link_cost(int8_t n)
+{
+    uint16_t delivery = atomic_load_explicit(&neighbors[n].delivery, memory_order_relaxed);
+    int16_t rssi = atomic_load_explicit(&neighbors[n].rssi, memory_order_relaxed);
+    uint32_t cost = LINK_COST_UNIT * UINT16_MAX / (delivery > UINT16_MAX / LINK_MAX_ETX ? delivery
+                                                                                      : UINT16_MAX / LINK_MAX_ETX);
+
+    if (rssi != 0 && rssi < LINK_RSSI_WEAK * 16)
+    {
+        cost += (LINK_RSSI_WEAK * 16 - rssi) * LINK_COST_UNIT / (16 * LINK_RSSI_DB_PER_TX);
+    }
+    return cost;
+}
@@ -0,0 +1,163 @@
+/*
+ * packet-pool.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the preallocated pool of ESP-NOW frame buffers, so that receiving, forwarding and sending
+ * messages does not touch the heap. Buffers are taken from the receive callback as well as from the tasks, therefore
+ * the free list and the reference counts are protected by a spinlock.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_now.h"
+#include "freertos/FreeRTOS.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "packet-pool.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+typedef struct
+{
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} packet_buffer_t;
+
+NODE_STATE static packet_buffer_t buffers[PACKET_POOL_SIZE];
+NODE_STATE static uint8_t free_list[PACKET_POOL_SIZE]; // stack of the indices of the free buffers
+NODE_STATE static uint8_t free_len;
+NODE_STATE static uint8_t refs[PACKET_POOL_SIZE]; // owners of the buffer, 0 if it is free
+NODE_STATE static packet_pool_stats_t stats;
+
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static const char *pool_tag = "packet_pool";
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+void init_packet_pool(void)
+{
+    portENTER_CRITICAL(&pool_lock);
+    for (int i = 0; i < PACKET_POOL_SIZE; i++)
+    {
+        free_list[i] = PACKET_POOL_SIZE - 1 - i;
+        refs[i] = 0;
+    }
+    free_len = PACKET_POOL_SIZE;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+/* Returns a buffer of ESP_NOW_MAX_DATA_LEN bytes or NULL if all buffers are in use, never blocks */
+void *packet_alloc(void)
+{
+    uint8_t i;
+
+    portENTER_CRITICAL(&pool_lock);
+    if (free_len == 0)
+    {
+        stats.exhausted++;
+        portEXIT_CRITICAL(&pool_lock);
+        return NULL;
+    }
+    i = free_list[--free_len];
+    refs[i] = 1;
+    stats.allocs++;
+    stats.in_use++;
+    if (stats.in_use > stats.high_water)
+    {
+        stats.high_water = stats.in_use;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    return buffers[i].data;
+}
+
+/* Returns the index of buffer in the pool or -1 if it is not one of its buffers */
+static int index_of(const void *buffer)
+{
+    int i = (const packet_buffer_t *)buffer - buffers;
+
+    if (i < 0 || i >= PACKET_POOL_SIZE || (const void *)buffers[i].data != buffer)
+    {
+        ESP_LOGE(pool_tag, "Buffer is not part of the pool");
+        return -1;
+    }
+    return i;
+}
+
+/* Adds an owner to a buffer obtained from packet_alloc, which gives it back with packet_free as well */
+void packet_ref(void *buffer)
+{
+    int i = index_of(buffer);
+
+    if (i == -1)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&pool_lock);
+    if (refs[i] == 0)
+    {
+        portEXIT_CRITICAL(&pool_lock);
+        ESP_LOGE(pool_tag, "Buffer %d is free, it cannot be shared", i);
+        return;
+    }
+    refs[i]++;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+/* Gives a buffer obtained from packet_alloc back to the pool once its last owner freed it, NULL is ignored */
+void packet_free(void *buffer)
+{
+    int i;
+
+    if (buffer == NULL)
+    {
+        return;
+    }
+    i = index_of(buffer);
+    if (i == -1)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&pool_lock);
+    if (refs[i] == 0)
+    {
+        portEXIT_CRITICAL(&pool_lock);
+        ESP_LOGE(pool_tag, "Buffer %d freed twice", i);
+        return;
+    }
+    if (--refs[i] == 0)
+    {
+        free_list[free_len++] = i;
+        stats.in_use--;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+/* Returns true if more than one owner holds buffer, nobody may write it then */
+bool packet_shared(const void *buffer)
+{
+    int i = index_of(buffer);
+    bool shared;
+
+    if (i == -1)
+    {
+        return false;
+    }
+    portENTER_CRITICAL(&pool_lock);
+    shared = refs[i] > 1;
+    portEXIT_CRITICAL(&pool_lock);
+    return shared;
+}
+
+void packet_pool_get_stats(packet_pool_stats_t *result)
+{
+    portENTER_CRITICAL(&pool_lock);
+    *result = stats;
+    portEXIT_CRITICAL(&pool_lock);
+}
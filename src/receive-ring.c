@@ -0,0 +1,76 @@
+/*
+ * receive-ring.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the lock-free single producer, single consumer ring of received frames. The receive callback
+ * runs in the WiFi task, it must never wait for the vcp task: a full ring drops the new frame and counts it instead.
+ * The slots only carry the descriptor of a frame, the frame itself stays in its packet pool buffer, whose ownership
+ * moves to the consumer with the slot.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_now.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "receive-ring.h"
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* Empties the ring, neither side may use it at the same time */
+void receive_ring_init(receive_ring_t *ring)
+{
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    ring->stats = (receive_ring_stats_t){0};
+}
+
+/* Producer side, copies the frame descriptor into the next free slot. Returns false and counts the drop if the ring is
+ * full, the caller still owns the buffer of the frame then. Never blocks. */
+bool receive_ring_push(receive_ring_t *ring, const q_receive_data_t *frame)
+{
+    uint_fast32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint_fast32_t waiting = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (waiting == RECEIVER_RING_SIZE)
+    {
+        ring->stats.dropped++;
+        return false;
+    }
+    ring->slots[head % RECEIVER_RING_SIZE] = *frame;
+    // publishes the slot, the consumer reads it only after it saw the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    ring->stats.pushed++;
+    if (waiting + 1 > ring->stats.high_water)
+    {
+        ring->stats.high_water = waiting + 1;
+    }
+    return true;
+}
+
+/* Consumer side, takes the oldest frame out of the ring. Returns false if the ring is empty. */
+bool receive_ring_pop(receive_ring_t *ring, q_receive_data_t *frame)
+{
+    uint_fast32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+    {
+        return false;
+    }
+    *frame = ring->slots[tail % RECEIVER_RING_SIZE];
+    // the slot is copied out, the producer may reuse it
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void receive_ring_get_stats(receive_ring_t *ring, receive_ring_stats_t *result)
+{
+    *result = ring->stats; // plain counters of the producer, a report may be one frame behind
+}
@@ -6,6 +6,9 @@
     *
     * This file contains the code for sending and receiving data via ESP-NOW.
     * The data will be but in a queue and processed by another task
+    * Received frames go through the lock-free receive ring (receive-ring.c), the callbacks never wait for the vcp task.
+    * Frames to send wait in one of the traffic classes (config.h): the control class is served first, but never more
+    * than TRAFFIC_CONTROL_BURST frames in a row while DATA frames wait, the DATA frames earliest deadline first. A full class drops a frame instead of blocking the vcp task.
     *
 */
 /* --------------------------------------------------- external libs --------------------------------------------------- */
@@ -33,12 +36,35 @@
 
 /* -------------------------------------------------- own includes --------------------------------------------------- */
 #include "config.h"
+#include "receive-ring.h"
 #include "sender-receiver.h"
+#include "packet-pool.h"
+#include "metrics.h"
+#include "trace.h"
 
 /* --------------------------------------------- variables and constants --------------------------------------------- */
-QueueHandle_t receiver_queue;
-QueueHandle_t sender_queue;
-QueueHandle_t sender_error_queue;
+NODE_STATE receive_ring_t receive_ring;
+NODE_STATE QueueHandle_t sender_error_queue;
+NODE_STATE SemaphoreHandle_t sender_window; // one token per frame that may be in flight
+NODE_STATE TaskHandle_t queue_consumer_task;
+NODE_STATE static uint8_t status_high_water; // most send statuses waiting in the sender_error_queue at the same time
+
+NODE_STATE static sender_entry_t control_class[SENDER_CONTROL_QUEUE_SIZE]; // ring buffer in FIFO order
+NODE_STATE static uint8_t control_head;
+NODE_STATE static uint8_t control_len;
+NODE_STATE static sender_entry_t data_class[SENDER_DATA_QUEUE_SIZE]; // in sending order
+NODE_STATE static uint8_t data_len;
+NODE_STATE static uint8_t control_burst; // control frames sent in a row while DATA frames waited
+NODE_STATE static SemaphoreHandle_t sender_pending; // one token per frame in the traffic classes
+NODE_STATE static traffic_class_stats_t class_stats[TRAFFIC_CLASSES];
+static portMUX_TYPE class_lock = portMUX_INITIALIZER_UNLOCKED;
+
+NODE_STATE static peer_slot_t peer_slots[PEER_SLOTS];
+NODE_STATE static uint32_t peer_clock;        // use counter, incremented on every unicast
+NODE_STATE static SemaphoreHandle_t peer_lock; // peer_slots are used by the sender task and the vcp task
+static portMUX_TYPE flight_lock = portMUX_INITIALIZER_UNLOCKED; // in_flight and the MAC of a slot, send callback
+NODE_STATE static peer_cache_stats_t peer_stats;
+_Static_assert(PEER_SLOTS > SENDER_IN_FLIGHT_WINDOW, "peer_acquire needs a slot without frames in flight");
 
 uint8_t broadcast_mac[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 const error_tags_t TAGS = {"espnow_receiver", "espnow_sender"};
@@ -46,28 +72,47 @@ const error_tags_t TAGS = {"espnow_receiver", "espnow_sender"};
 /* ----------------------------------------------- function definition ----------------------------------------------- */
 static void sender_error_callback(const uint8_t *mac_addr, esp_now_send_status_t status);
 static void receiver_callback(const esp_now_recv_info_t *info, const uint8_t *data, int len);
-static void add_peer(uint8_t *mac_addr, bool encrypt);
+static esp_err_t add_peer(const uint8_t *mac_addr, bool encrypt);
+static esp_err_t peer_acquire(const uint8_t *mac_addr);
+static void peer_release(const uint8_t *mac_addr);
+static void sender_dequeue(esp_now_data_t *data);
 
-/* Callback function which is called everytime data is sent via ESP-NOW, the function puts the data into a queue for further processing */
+/* Callback function which is called everytime data is sent via ESP-NOW, the function releases the in-flight slot of
+ * the frame and puts the status into a queue for further processing */
 static void sender_error_callback(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
     q_send_error_data_t sender_error_data;
+    UBaseType_t waiting;
 
     if (mac_addr == NULL)
     {
         ESP_LOGE(TAGS.send_tag, "MAC address is NULL");
+        xSemaphoreGive(sender_window);
         return;
     }
+    // the frame is done, the next one can be sent right away
+    peer_release(mac_addr);
+    xSemaphoreGive(sender_window);
+
     memcpy(sender_error_data.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
     sender_error_data.status = status;
 
-    if (xQueueSend(sender_error_queue, &sender_error_data, ESPNOW_QUEUE_TIMEOUT) != pdTRUE)
+    // the status only feeds the link estimate, losing one is better than stalling the WiFi task
+    if (xQueueSend(sender_error_queue, &sender_error_data, 0) != pdTRUE)
     {
         ESP_LOGE(TAGS.send_tag, "Queue send error");
+        return;
+    }
+    waiting = uxQueueMessagesWaiting(sender_error_queue);
+    status_high_water = waiting > status_high_water ? waiting : status_high_water;
+    if (queue_consumer_task != NULL)
+    {
+        xTaskNotify(queue_consumer_task, VCP_NOTIFY_SEND_STATUS, eSetBits);
     }
 }
 
-/* Callback function for receiving data via ESP-NOW, the data is put into a queue for further processing */
+/* Callback function for receiving data via ESP-NOW, the data is put into the receive ring for further processing. It
+ * runs in the WiFi task and never blocks: without a free buffer or a free slot in the ring the frame is dropped. */
 static void receiver_callback(const esp_now_recv_info_t *info, const uint8_t *data, int len)
 {
     q_receive_data_t receive_data;
@@ -80,71 +125,292 @@ static void receiver_callback(const esp_now_recv_info_t *info, const uint8_t *da
     }
 
     memcpy(receive_data.mac_addr, sender_mac, ESP_NOW_ETH_ALEN);
-    receive_data.data = (uint8_t *)malloc(len);
+    receive_data.data = packet_alloc();
 
     if (receive_data.data == NULL)
     {
-        ESP_LOGE(TAGS.receive_tag, "Memory allocation error");
+        ESP_LOGE(TAGS.receive_tag, "Packet pool exhausted, dropping frame");
         return;
     }
 
     memcpy(receive_data.data, data, len);
     receive_data.data_len = len;
     receive_data.rssi = info->rx_ctrl->rssi;
+    receive_data.received_at = esp_timer_get_time();
 
-    if (xQueueSend(receiver_queue, &receive_data, ESPNOW_QUEUE_TIMEOUT) != pdTRUE)
+    if (!receive_ring_push(&receive_ring, &receive_data))
     {
-        ESP_LOGE(TAGS.receive_tag, "Receiving data queue error");
-        free(receive_data.data);
+        // counted by the ring, logging every frame would slow the WiFi task down even more
+        packet_free(receive_data.data);
+    }
+    else if (queue_consumer_task != NULL)
+    {
+        xTaskNotify(queue_consumer_task, VCP_NOTIFY_RECEIVE, eSetBits);
     }
 }
 
-static void add_peer(uint8_t *mac_addr, bool encrypt)
+static esp_err_t add_peer(const uint8_t *mac_addr, bool encrypt)
 {
-    if (esp_now_is_peer_exist(mac_addr) == false)
+    esp_now_peer_info_t peer;
+
+    memset(&peer, 0, sizeof(esp_now_peer_info_t));
+    peer.channel = ESPNOW_WIFI_CHANNEL;
+    peer.ifidx = ESPNOW_WIFI_IF;
+    peer.encrypt = encrypt;
+    if (encrypt)
     {
-        esp_now_peer_info_t *peer = malloc(sizeof(esp_now_peer_info_t));
-        if (peer == NULL)
+        memcpy(peer.lmk, ESPNOW_LMK, ESP_NOW_KEY_LEN);
+    }
+    memcpy(peer.peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    return esp_now_add_peer(&peer);
+}
+
+/* Makes sure the destination of a unicast is in the ESP-NOW peer list and counts the frame as in flight to it, the
+ * caller sends the frame right away (or calls peer_release if it can't). The neighbor table holds far more neighbors
+ * than ESP-NOW has peer slots, so peers are installed on their first unicast and the peer which was not used for the
+ * longest time is deleted when all slots are taken. A peer with frames in flight is never deleted: ESP-NOW would
+ * report their send status for a peer it does not know anymore. Receiving does not need a peer entry. */
+static esp_err_t peer_acquire(const uint8_t *mac_addr)
+{
+    uint8_t evicted[ESP_NOW_ETH_ALEN];
+    bool evict = false;
+    int slot = -1;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(peer_lock, portMAX_DELAY);
+    peer_clock++;
+    portENTER_CRITICAL(&flight_lock);
+    for (int i = 0; i < PEER_SLOTS; i++)
+    {
+        if (peer_slots[i].last_used != 0 && memcmp(peer_slots[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
         {
-            ESP_LOGE(TAGS.receive_tag, "Malloc peer information fail");
-            esp_now_deinit();
-            vTaskDelete(NULL);
+            peer_slots[i].last_used = peer_clock;
+            peer_slots[i].in_flight++;
+            portEXIT_CRITICAL(&flight_lock);
+            peer_stats.hits++;
+            xSemaphoreGive(peer_lock);
+            return ESP_OK;
         }
-        memset(peer, 0, sizeof(esp_now_peer_info_t));
-        peer->channel = ESPNOW_WIFI_CHANNEL;
-        peer->ifidx = ESPNOW_WIFI_IF;
-        peer->encrypt = encrypt;
-        if (encrypt)
+        if (peer_slots[i].in_flight == 0 && (slot == -1 || peer_slots[i].last_used < peer_slots[slot].last_used))
         {
-            memcpy(peer->lmk, ESPNOW_LMK, ESP_NOW_KEY_LEN);
+            slot = i;
         }
-        memcpy(peer->peer_addr, mac_addr, ESP_NOW_ETH_ALEN);
-        ESP_ERROR_CHECK(esp_now_add_peer(peer));
-        ESP_LOGI(TAGS.receive_tag, "See peer for the first time and add it to my list.");
-        free(peer);
+    }
+    // PEER_SLOTS > SENDER_IN_FLIGHT_WINDOW, there is always a slot without frames in flight
+    if (peer_slots[slot].last_used != 0)
+    {
+        memcpy(evicted, peer_slots[slot].mac_addr, ESP_NOW_ETH_ALEN);
+        peer_slots[slot].last_used = 0;
+        evict = true;
+    }
+    portEXIT_CRITICAL(&flight_lock);
+
+    if (evict)
+    {
+        esp_now_del_peer(evicted);
+        peer_stats.evictions++;
+    }
+    err = add_peer(mac_addr, false);
+    if (err == ESP_OK)
+    {
+        portENTER_CRITICAL(&flight_lock);
+        memcpy(peer_slots[slot].mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+        peer_slots[slot].last_used = peer_clock;
+        peer_slots[slot].in_flight = 1;
+        portEXIT_CRITICAL(&flight_lock);
+        peer_stats.installs++;
     }
     else
     {
-        ESP_LOGI(TAGS.receive_tag, "Already known peer.");
+        peer_stats.failed++;
+    }
+    xSemaphoreGive(peer_lock);
+    return err;
+}
+
+/* The send status of a frame arrived (or the frame was not sent), the peer may be deleted again when it has no more
+ * frames in flight. Called by the send callback, so it only takes the spinlock */
+static void peer_release(const uint8_t *mac_addr)
+{
+    portENTER_CRITICAL(&flight_lock);
+    for (int i = 0; i < PEER_SLOTS; i++)
+    {
+        if (peer_slots[i].last_used != 0 && peer_slots[i].in_flight > 0 &&
+            memcmp(peer_slots[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            peer_slots[i].in_flight--;
+            break;
+        }
     }
+    portEXIT_CRITICAL(&flight_lock);
 }
 
-/* Function which decodes the data sent over ESP-NOW and checks if the data is valid using CRC algorithm */
+/* Deletes the peer of a neighbor which is gone, its slot is free for the next unicast destination */
+void peer_forget(const uint8_t *mac_addr)
+{
+    xSemaphoreTake(peer_lock, portMAX_DELAY);
+    for (int i = 0; i < PEER_SLOTS; i++)
+    {
+        if (peer_slots[i].last_used != 0 && memcmp(peer_slots[i].mac_addr, mac_addr, ESP_NOW_ETH_ALEN) == 0)
+        {
+            esp_now_del_peer(peer_slots[i].mac_addr);
+            portENTER_CRITICAL(&flight_lock);
+            peer_slots[i].last_used = 0;
+            peer_slots[i].in_flight = 0;
+            portEXIT_CRITICAL(&flight_lock);
+            break;
+        }
+    }
+    xSemaphoreGive(peer_lock);
+}
+
+void receiver_get_ring_stats(receive_ring_stats_t *result)
+{
+    receive_ring_get_stats(&receive_ring, result);
+}
+
+uint8_t sender_status_high_water(void)
+{
+    return status_high_water;
+}
+
+void peer_cache_get_stats(peer_cache_stats_t *result)
+{
+    *result = peer_stats; // plain counters, a report may be one unicast behind
+}
+
+/* Function which decodes the data sent over ESP-NOW and checks if the data is valid using CRC algorithm.
+ * The result takes over the pool buffer of the received message, its payload has to be given back with packet_free. */
 esp_now_data_t parse_data(q_receive_data_t *received_message)
 {
     esp_now_data_t result;
 
-    add_peer(received_message->mac_addr, false);
-
     result.payload_length = received_message->data_len;
-    result.payload = malloc(result.payload_length);
+    result.payload = received_message->data;
     memcpy(result.mac_addr, received_message->mac_addr, ESP_NOW_ETH_ALEN);
-    memcpy(result.payload, received_message->data, result.payload_length);
 
     return result;
 }
 
-/* Task to send data via ESP-NOW Grabs data from the sender_queue and sends it via ESP-NOW */
+/* Puts a frame into its traffic class, the send task owns its buffer from now on. Never blocks: a full class drops a
+ * frame (see config.h) and gives its buffer back to the packet pool. Returns ESP_ERR_NO_MEM if that was data itself */
+esp_err_t sender_enqueue(const esp_now_data_t *data)
+{
+    sender_entry_t entry = {.data = *data, .queued_at = esp_timer_get_time()};
+    uint8_t *dropped = NULL;
+    bool added = true;
+    uint8_t waiting;
+    int i;
+
+    portENTER_CRITICAL(&class_lock);
+    class_stats[data->traffic_class].queued++;
+    if (data->traffic_class == TRAFFIC_CLASS_CONTROL)
+    {
+        if (control_len == SENDER_CONTROL_QUEUE_SIZE)
+        {
+            // the oldest frame makes room, a newer HELLO or ACK says the same or more
+            dropped = control_class[control_head].data.payload;
+            control_head = (control_head + 1) % SENDER_CONTROL_QUEUE_SIZE;
+            control_len--;
+            added = false;
+        }
+        control_class[(control_head + control_len++) % SENDER_CONTROL_QUEUE_SIZE] = entry;
+    }
+    else
+    {
+        // earliest deadline first, but never ahead of a frame for the same neighbor: the link layer relies on ESP-NOW
+        // sending the frames for a neighbor in the order it handed them over
+        for (i = data_len; i > 0 && data_class[i - 1].data.deadline > data->deadline &&
+                           memcmp(data_class[i - 1].data.mac_addr, data->mac_addr, ESP_NOW_ETH_ALEN) != 0;
+             i--)
+            ;
+        if (data_len == SENDER_DATA_QUEUE_SIZE && i == data_len)
+        {
+            // the new frame would be sent last
+            dropped = data->payload;
+            added = false;
+        }
+        else
+        {
+            if (data_len == SENDER_DATA_QUEUE_SIZE)
+            {
+                dropped = data_class[--data_len].data.payload;
+                added = false;
+            }
+            memmove(&data_class[i + 1], &data_class[i], (data_len - i) * sizeof(sender_entry_t));
+            data_class[i] = entry;
+            data_len++;
+        }
+    }
+    if (dropped != NULL)
+    {
+        class_stats[data->traffic_class].dropped++;
+    }
+    waiting = data->traffic_class == TRAFFIC_CLASS_CONTROL ? control_len : data_len;
+    if (waiting > class_stats[data->traffic_class].high_water)
+    {
+        class_stats[data->traffic_class].high_water = waiting;
+    }
+    portEXIT_CRITICAL(&class_lock);
+
+    if (dropped != NULL)
+    {
+        packet_free(dropped);
+    }
+    if (added)
+    {
+        xSemaphoreGive(sender_pending);
+    }
+    return dropped == data->payload ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+/* Takes the next frame to send out of the traffic classes, the caller holds a token of sender_pending */
+static void sender_dequeue(esp_now_data_t *data)
+{
+    sender_entry_t entry;
+    traffic_class_stats_t *stats;
+    int64_t now = esp_timer_get_time();
+    uint32_t residence;
+
+    portENTER_CRITICAL(&class_lock);
+    if (control_len > 0 && (data_len == 0 || control_burst < TRAFFIC_CONTROL_BURST))
+    {
+        control_burst = data_len > 0 ? control_burst + 1 : 0;
+        entry = control_class[control_head];
+        control_head = (control_head + 1) % SENDER_CONTROL_QUEUE_SIZE;
+        control_len--;
+    }
+    else
+    {
+        control_burst = 0;
+        entry = data_class[0];
+        memmove(&data_class[0], &data_class[1], --data_len * sizeof(sender_entry_t));
+    }
+    stats = &class_stats[entry.data.traffic_class];
+    residence = now - entry.queued_at;
+    stats->residence_sum_us += residence;
+    stats->residence_max_us = residence > stats->residence_max_us ? residence : stats->residence_max_us;
+    stats->late += entry.data.traffic_class == TRAFFIC_CLASS_DATA && now > entry.data.deadline;
+    portEXIT_CRITICAL(&class_lock);
+
+    metrics_latency(METRICS_STAGE_SEND, residence);
+
+    *data = entry.data;
+}
+
+void sender_get_class_stats(uint8_t traffic_class, traffic_class_stats_t *result)
+{
+    portENTER_CRITICAL(&class_lock);
+    *result = class_stats[traffic_class];
+    portEXIT_CRITICAL(&class_lock);
+}
+
+/* Task to send data via ESP-NOW Grabs data from the traffic classes and sends it via ESP-NOW
+ *
+ * Up to SENDER_IN_FLIGHT_WINDOW frames are handed to ESP-NOW at the same time, every send callback releases the slot
+ * of its frame. The task blocks while the window is full or no frame waits. The destination of a unicast is
+ * installed as peer right before its frame is sent (see peer_acquire).
+ */
 static void send_data_task(void *pvParameters)
 {
 
@@ -152,40 +418,64 @@ static void send_data_task(void *pvParameters)
 
     while (true)
     {
-        // User-specific delay befor sending the next message
-        vTaskDelay(SENDER_TASK_DELAY_MS / portTICK_PERIOD_MS);
+        xSemaphoreTake(sender_window, portMAX_DELAY);
 
-        if (uxQueueMessagesWaiting(sender_queue) > 0)
+        if (xSemaphoreTake(sender_pending, portMAX_DELAY) == pdPASS)
         {
-            if (xQueueReceive(sender_queue, &esp_now_data, portMAX_DELAY) == pdPASS)
+            sender_dequeue(&esp_now_data);
+            if (esp_now_data.transmit_type == TRANSMIT_TYPE_UNICAST && peer_acquire(esp_now_data.mac_addr) != ESP_OK)
             {
-                if (esp_now_send(esp_now_data.mac_addr, (uint8_t *)esp_now_data.payload, esp_now_data.payload_length) != ESP_OK)
+                ESP_LOGE(TAGS.send_tag, "Error adding the peer of a unicast, dropping the frame");
+                xSemaphoreGive(sender_window);
+            }
+            else if (esp_now_send(esp_now_data.mac_addr, esp_now_data.payload, esp_now_data.payload_length) != ESP_OK)
+            {
+                ESP_LOGE(TAGS.send_tag, "Error sending message using esp-now");
+                // there will be no send callback for this frame
+                if (esp_now_data.transmit_type == TRANSMIT_TYPE_UNICAST)
                 {
-                    ESP_LOGE(TAGS.send_tag, "Error sending message using esp-now");
+                    peer_release(esp_now_data.mac_addr);
                 }
+                xSemaphoreGive(sender_window);
+                trace_record(esp_timer_get_time(), esp_now_data.mac_addr, esp_now_data.payload,
+                             esp_now_data.payload_length, TRACE_SEND_FAILED);
+            }
+            else
+            {
+                metrics_count(esp_now_data.payload[1], METRICS_TX); // type of the vcp_header_t
+                trace_record(esp_timer_get_time(), esp_now_data.mac_addr, esp_now_data.payload,
+                             esp_now_data.payload_length, TRACE_SENT);
             }
+            // esp_now_send has copied the frame, the buffer is not needed anymore
+            packet_free(esp_now_data.payload);
+        }
+        else
+        {
+            xSemaphoreGive(sender_window);
         }
     }
 }
 
 esp_err_t init_sender_receiver(void)
 {
+    TaskHandle_t send_task;
 
-    receiver_queue = xQueueCreate(RECEIVER_QUEUE_SIZE, sizeof(q_receive_data_t));
+    init_packet_pool();
 
-    if (receiver_queue == NULL)
-    {
-        ESP_LOGE(TAGS.receive_tag, "Error creating receiver queue");
-        return ESP_FAIL;
-    }
+    receive_ring_init(&receive_ring);
 
-    sender_queue = xQueueCreate(SENDER_QUEUE_SIZE, sizeof(esp_now_data_t));
+    sender_pending = xSemaphoreCreateCounting(SENDER_CONTROL_QUEUE_SIZE + SENDER_DATA_QUEUE_SIZE, 0);
 
-    if (sender_queue == NULL)
+    if (sender_pending == NULL)
     {
-        ESP_LOGE(TAGS.send_tag, "Error creating sender queue");
+        ESP_LOGE(TAGS.send_tag, "Error creating sender classes");
         return ESP_FAIL;
     }
+    control_head = 0;
+    control_len = 0;
+    data_len = 0;
+    memset(class_stats, 0, sizeof(class_stats));
+    status_high_water = 0;
 
     sender_error_queue = xQueueCreate(SENDER_ERROR_QUEUE_SIZE, sizeof(q_send_error_data_t));
 
@@ -195,22 +485,41 @@ esp_err_t init_sender_receiver(void)
         return ESP_FAIL;
     }
 
+    sender_window = xSemaphoreCreateCounting(SENDER_IN_FLIGHT_WINDOW, SENDER_IN_FLIGHT_WINDOW);
+
+    if (sender_window == NULL)
+    {
+        ESP_LOGE(TAGS.send_tag, "Error creating sender window");
+        return ESP_FAIL;
+    }
+
+    peer_lock = xSemaphoreCreateMutex();
+
+    if (peer_lock == NULL)
+    {
+        ESP_LOGE(TAGS.send_tag, "Error creating peer lock");
+        return ESP_FAIL;
+    }
+
     ESP_ERROR_CHECK(esp_now_init());
     ESP_ERROR_CHECK(esp_now_register_send_cb(sender_error_callback));
     ESP_ERROR_CHECK(esp_now_register_recv_cb(receiver_callback));
     ESP_ERROR_CHECK(esp_now_set_pmk((uint8_t *)ESPNOW_PMK));
 
-    add_peer(broadcast_mac, false);
+    ESP_ERROR_CHECK(add_peer(broadcast_mac, false));
 
-    xTaskCreate(send_data_task, "send_data_task", 2048, NULL, 5, NULL);
+    xTaskCreate(send_data_task, "send_data_task", 2048, NULL, 5, &send_task);
+    metrics_watch_task(METRICS_TASK_SEND, send_task);
 
     return ESP_OK;
 }
 
 void deinit_sender_receiver(void)
 {
-    vSemaphoreDelete(sender_queue);
+    vSemaphoreDelete(sender_pending);
     vSemaphoreDelete(sender_error_queue);
-    vSemaphoreDelete(receiver_queue);
+    vSemaphoreDelete(sender_window);
+    vSemaphoreDelete(peer_lock);
+    memset(peer_slots, 0, sizeof(peer_slots));
     esp_now_deinit();
 }
\ No newline at end of file
@@ -0,0 +1,467 @@
+/*
+ * stream.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the stream transfers of the virtual cord protocol.
+ * - source: the payload stays in the buffer of the caller, a fragment is encoded straight from it whenever it is sent.
+ *   Up to VCP_STREAM_WINDOW fragments are sent without waiting for the destination, so that all hops of the path
+ *   forward fragments at the same time. The link layer refuses fragments a hop cannot forward, the fragments then wait
+ *   in the link queue of the hop before it. A fragment the link layer could not take is sent when the vcp task runs
+ *   the next time.
+ * - destination: fragments are handed to the receive callback in order. Fragments arriving before a missing one wait
+ *   in the reorder buffer of the transfer, which holds a whole window, so that nothing the source may send is dropped.
+ *   A STREAM_ACK tells the source which fragments arrived: every VCP_STREAM_ACK_EVERY fragments, when a gap opens or
+ *   is filled, for duplicates and at the end of the transfer.
+ * A gap alone does not make the source send anything again, most gaps are only fragments the link layer of a hop
+ * retransmitted after later ones. Fragments are lost when the link layer gives up on a hop or when the route changes
+ * under the transfer: when nothing new was acknowledged for VCP_STREAM_TIMEOUT, the source sends the oldest missing
+ * fragment and the ones the last STREAM_ACK reported missing again.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "receive-ring.h"
+#include "sender-receiver.h"
+#include "vcp.h"
+#include "stream.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+NODE_STATE static QueueHandle_t stream_queue; // stream_request_t from vcp_stream_send
+NODE_STATE static TimerHandle_t stream_timer;
+NODE_STATE static stream_tx_t tx[VCP_STREAM_TX];
+NODE_STATE static stream_rx_t rx[VCP_STREAM_RX];
+NODE_STATE static uint16_t next_id;
+NODE_STATE static vcp_stream_stats_t stream_stats;
+NODE_STATE static vcp_stream_receive_cb_t receive_cb;
+NODE_STATE static vcp_stream_sent_cb_t sent_cb;
+
+_Static_assert(VCP_STREAM_WINDOW <= 32, "the selective STREAM_ACK covers 32 fragments");
+_Static_assert(VCP_STREAM_FRAGMENT_LEN > 0 && VCP_STREAM_FRAGMENT_LEN <= UINT8_MAX, "payload_len is a uint8_t");
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+
+/* Wakes up the vcp task, called by the timer service task */
+static void stream_timer_callback(TimerHandle_t timer)
+{
+    xTaskNotify(queue_consumer_task, VCP_NOTIFY_STREAM, eSetBits);
+}
+
+static uint16_t fragments_of(uint32_t len)
+{
+    return (len + VCP_STREAM_FRAGMENT_LEN - 1) / VCP_STREAM_FRAGMENT_LEN;
+}
+
+static uint8_t fragment_len(uint32_t total_len, uint16_t index)
+{
+    uint32_t left = total_len - (uint32_t)index * VCP_STREAM_FRAGMENT_LEN;
+
+    return left < VCP_STREAM_FRAGMENT_LEN ? left : VCP_STREAM_FRAGMENT_LEN;
+}
+
+/* Encodes fragment index of t straight from the buffer of the caller and routes it towards the destination */
+static esp_err_t send_fragment(stream_tx_t *t, uint16_t index)
+{
+    vcp_message_t msg = {.type = VCP_FRAGMENT};
+
+    msg.data.recipient = t->to;
+    msg.data.source = atomic_load_explicit(&own_position, memory_order_relaxed);
+    msg.data.stream.id = t->id;
+    msg.data.stream.index = index;
+    msg.data.stream.total_len = t->len;
+    msg.data.payload = t->data + (uint32_t)index * VCP_STREAM_FRAGMENT_LEN;
+    msg.data.payload_len = fragment_len(t->len, index);
+    return vcp_route(&msg);
+}
+
+/* Sends the fragments of t which were never sent and fit into the window */
+static void send_pending(stream_tx_t *t)
+{
+    while (t->next < t->fragments && t->next - t->acked < VCP_STREAM_WINDOW)
+    {
+        if (send_fragment(t, t->next) != ESP_OK)
+        {
+            // tried again when the vcp task runs the next time
+            return;
+        }
+        t->next++;
+        stream_stats.fragments++;
+    }
+}
+
+/* Sends fragment acked + i of t again unless that was done since the last timeout */
+static void resend(stream_tx_t *t, int i)
+{
+    if (t->resent & (1u << i))
+    {
+        return;
+    }
+    if (send_fragment(t, t->acked + i) == ESP_OK)
+    {
+        t->resent |= 1u << i;
+        stream_stats.resent++;
+    }
+}
+
+/* Sends the oldest fragment of t which was not acknowledged and the ones in front of a fragment which was again */
+static void resend_missing(stream_tx_t *t)
+{
+    int highest;
+
+    if (t->acked == t->next)
+    {
+        return;
+    }
+    for (highest = 31; highest >= 0 && !(t->selective & (1u << highest)); highest--)
+    {
+    }
+    for (int i = 0; i == 0 || i <= highest; i++)
+    {
+        if (i == 0 || !(t->selective & (1u << (i - 1))))
+        {
+            resend(t, i);
+        }
+    }
+}
+
+static void finish(stream_tx_t *t, esp_err_t status)
+{
+    t->used = false;
+    if (status == ESP_OK)
+    {
+        stream_stats.completed++;
+    }
+    else
+    {
+        ESP_LOGE(TAGS.send_tag, "Stream %u to position %" PRIu32 " failed after %u of %u fragments", t->id, t->to,
+                 t->acked, t->fragments);
+        stream_stats.failed++;
+    }
+    if (sent_cb != NULL)
+    {
+        sent_cb(t->data, t->len, status);
+    }
+}
+
+/* Tells the source of r which fragments arrived */
+static void send_ack(stream_rx_t *r)
+{
+    vcp_message_t msg = {.type = VCP_STREAM_ACK};
+
+    msg.data.recipient = r->source;
+    msg.data.source = atomic_load_explicit(&own_position, memory_order_relaxed);
+    msg.data.stream.id = r->id;
+    msg.data.stream.index = r->next;
+    msg.data.stream.selective = r->received;
+    r->unacked = 0;
+    stream_stats.acks++;
+    if (vcp_route(&msg) != ESP_OK)
+    {
+        // the source sends a fragment again and gets the STREAM_ACK later
+        ESP_LOGE(TAGS.send_tag, "Could not acknowledge stream %u", r->id);
+    }
+}
+
+/* Returns the transfer the fragment msg belongs to. A new transfer takes a free slot or replaces the transfer which
+ * is complete or idle for the longest time, NULL if all slots are busy */
+static stream_rx_t *rx_of(const vcp_message_t *msg)
+{
+    int64_t now = esp_timer_get_time();
+    stream_rx_t *r = NULL;
+
+    for (int i = 0; i < VCP_STREAM_RX; i++)
+    {
+        if (rx[i].used && rx[i].id == msg->data.stream.id && rx[i].source == msg->data.source)
+        {
+            return &rx[i];
+        }
+    }
+    for (int i = 0; i < VCP_STREAM_RX; i++)
+    {
+        stream_rx_t *c = &rx[i];
+        if (c->used && c->next < c->fragments && now - c->last_at < VCP_STREAM_RX_IDLE * 1000LL)
+        {
+            continue;
+        }
+        if (r == NULL || (r->used && (!c->used || c->last_at < r->last_at)))
+        {
+            r = c;
+        }
+    }
+    if (r == NULL)
+    {
+        return NULL;
+    }
+    if (r->used && r->next < r->fragments)
+    {
+        ESP_LOGE(TAGS.receive_tag, "Giving up stream %u from position %" PRIu32 ", nothing received for %d ms", r->id,
+                 r->source, VCP_STREAM_RX_IDLE);
+        stream_stats.failed++;
+    }
+    r->used = true;
+    r->id = msg->data.stream.id;
+    r->source = msg->data.source;
+    r->total_len = msg->data.stream.total_len;
+    r->fragments = fragments_of(r->total_len);
+    r->next = 0;
+    r->received = 0;
+    r->unacked = 0;
+    return r;
+}
+
+static void deliver(stream_rx_t *r, uint16_t index, const uint8_t *data, uint8_t len)
+{
+    if (receive_cb != NULL)
+    {
+        receive_cb(r->source, r->id, (uint32_t)index * VCP_STREAM_FRAGMENT_LEN, data, len, r->total_len);
+    }
+}
+
+void init_stream(void)
+{
+    memset(tx, 0, sizeof(tx));
+    memset(rx, 0, sizeof(rx));
+    memset(&stream_stats, 0, sizeof(stream_stats));
+    next_id = esp_random();
+    stream_queue = xQueueCreate(VCP_STREAM_QUEUE_SIZE, sizeof(stream_request_t));
+    stream_timer = xTimerCreate("vcp_stream", pdMS_TO_TICKS(VCP_STREAM_TICK), pdTRUE, NULL, stream_timer_callback);
+    if (stream_queue == NULL || stream_timer == NULL)
+    {
+        ESP_LOGE(TAGS.send_tag, "Could not create stream queue or timer");
+    }
+}
+
+/* Registers the callbacks of the application, either may be NULL */
+void vcp_stream_register(vcp_stream_receive_cb_t on_receive, vcp_stream_sent_cb_t on_sent)
+{
+    receive_cb = on_receive;
+    sent_cb = on_sent;
+}
+
+/* Sends len bytes of data to the node at position to. The transfer waits in the stream queue until the vcp task takes
+ * it, ESP_ERR_NO_MEM is returned if the queue is full */
+esp_err_t vcp_stream_send(vcp_position_t to, const uint8_t *data, uint32_t len)
+{
+    stream_request_t request = {.to = to, .data = data, .len = len};
+
+    if (data == NULL || len == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > (uint32_t)UINT16_MAX * VCP_STREAM_FRAGMENT_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (stream_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xQueueSend(stream_queue, &request, 0) != pdTRUE)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotify(queue_consumer_task, VCP_NOTIFY_STREAM, eSetBits);
+    return ESP_OK;
+}
+
+/* Starts the requested transfers there is room for, handles the timeouts and sends the fragments which are due.
+ * Called whenever the vcp task ran, the stream timer keeps it running while transfers are active */
+void stream_poll(void)
+{
+    int64_t now = esp_timer_get_time();
+    stream_request_t request;
+    bool active = false;
+
+    for (int i = 0; i < VCP_STREAM_TX; i++)
+    {
+        stream_tx_t *t = &tx[i];
+
+        if (!t->used && atomic_load_explicit(&own_position, memory_order_relaxed) != VCP_INITIAL &&
+            xQueueReceive(stream_queue, &request, 0) == pdTRUE)
+        {
+            memset(t, 0, sizeof(stream_tx_t));
+            t->used = true;
+            t->id = next_id++;
+            t->to = request.to;
+            t->data = request.data;
+            t->len = request.len;
+            t->fragments = fragments_of(request.len);
+            t->progress_at = now;
+        }
+        if (!t->used)
+        {
+            continue;
+        }
+
+        if (now - t->progress_at >= ((int64_t)VCP_STREAM_TIMEOUT * 1000) << t->timeouts)
+        {
+            stream_stats.timeouts++;
+            if (++t->timeouts > VCP_STREAM_MAX_TIMEOUTS)
+            {
+                finish(t, ESP_ERR_TIMEOUT);
+                continue;
+            }
+            t->progress_at = now;
+            t->resent = 0;
+            resend_missing(t);
+        }
+        send_pending(t);
+        active = true;
+    }
+
+    if (active && xTimerIsTimerActive(stream_timer) == pdFALSE)
+    {
+        xTimerStart(stream_timer, 0);
+    }
+    else if (!active && xTimerIsTimerActive(stream_timer) != pdFALSE)
+    {
+        xTimerStop(stream_timer, 0);
+    }
+}
+
+/* Handles a FRAGMENT addressed to this node */
+void stream_receive(const vcp_message_t *msg)
+{
+    uint16_t index = msg->data.stream.index;
+    stream_rx_t *r;
+    uint32_t total_len = msg->data.stream.total_len;
+    int32_t d;
+    bool more;
+
+    if (total_len == 0 || total_len > (uint32_t)UINT16_MAX * VCP_STREAM_FRAGMENT_LEN ||
+        index >= fragments_of(total_len) || msg->data.payload_len != fragment_len(total_len, index))
+    {
+        ESP_LOGE(TAGS.receive_tag, "Dropping malformed fragment %u of stream %u", index, msg->data.stream.id);
+        return;
+    }
+    r = rx_of(msg);
+    if (r == NULL)
+    {
+        // not acknowledged, the source tries again later
+        ESP_LOGE(TAGS.receive_tag, "No room for stream %u from position %" PRIu32, msg->data.stream.id,
+                 msg->data.source);
+        return;
+    }
+    r->last_at = esp_timer_get_time();
+
+    d = (int32_t)index - r->next;
+    if (d < 0 || (d > 0 && d <= 32 && (r->received & (1u << (d - 1)))))
+    {
+        // the source did not get the STREAM_ACK in time
+        stream_stats.duplicates++;
+        send_ack(r);
+        return;
+    }
+    if (d >= VCP_STREAM_WINDOW)
+    {
+        ESP_LOGE(TAGS.receive_tag, "Fragment %u of stream %u is outside of the window", index, r->id);
+        return;
+    }
+    if (d > 0)
+    {
+        stream_fragment_t *f = &r->reorder[index % VCP_STREAM_WINDOW];
+        bool gap = r->received == 0;
+
+        memcpy(f->data, msg->data.payload, msg->data.payload_len);
+        f->len = msg->data.payload_len;
+        r->received |= 1u << (d - 1);
+        stream_stats.out_of_order++;
+        if (gap)
+        {
+            // the source learns about the missing fragment right away
+            send_ack(r);
+        }
+        return;
+    }
+
+    // index == next, hand it on together with the buffered fragments behind it
+    deliver(r, index, msg->data.payload, msg->data.payload_len);
+    do
+    {
+        more = r->received & 1;
+        r->received >>= 1;
+        r->next++;
+        r->unacked++;
+        if (more)
+        {
+            deliver(r, r->next, r->reorder[r->next % VCP_STREAM_WINDOW].data,
+                    r->reorder[r->next % VCP_STREAM_WINDOW].len);
+        }
+    } while (more);
+
+    if (r->next == r->fragments)
+    {
+        stream_stats.completed++;
+        send_ack(r);
+    }
+    else if (r->unacked >= VCP_STREAM_ACK_EVERY || r->received != 0)
+    {
+        send_ack(r);
+    }
+}
+
+/* Handles a STREAM_ACK addressed to this node: slides the window of the transfer, sends the fragments reported
+ * missing and the ones which entered the window */
+void stream_handle_ack(const vcp_message_t *msg)
+{
+    uint16_t cumulative = msg->data.stream.index;
+    uint32_t selective;
+    stream_tx_t *t = NULL;
+    int32_t d;
+
+    for (int i = 0; i < VCP_STREAM_TX; i++)
+    {
+        if (tx[i].used && tx[i].id == msg->data.stream.id && tx[i].to == msg->data.source)
+        {
+            t = &tx[i];
+        }
+    }
+    d = t == NULL ? -1 : (int32_t)cumulative - t->acked;
+    if (d < 0 || cumulative > t->next)
+    {
+        // unknown transfer or older than what is known already
+        return;
+    }
+
+    selective = (d >= 32 ? 0 : t->selective >> d) | msg->data.stream.selective;
+    if (d > 0 || selective != t->selective)
+    {
+        t->timeouts = 0;
+        t->progress_at = esp_timer_get_time();
+    }
+    t->resent = d >= 32 ? 0 : t->resent >> d;
+    t->acked = cumulative;
+    t->selective = selective;
+
+    if (t->acked == t->fragments)
+    {
+        finish(t, ESP_OK);
+        return;
+    }
+
+    send_pending(t);
+}
+
+/* Copies the stream counters of this node */
+void vcp_get_stream_stats(vcp_stream_stats_t *stats)
+{
+    *stats = stream_stats;
+}
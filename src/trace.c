@@ -0,0 +1,131 @@
+/*
+ * trace.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the packet trace of the node: the vcp task records every received frame together with what it
+ * did with it, the send task every frame it hands to esp_now_send. Both write into the same ring, a writer claims its
+ * slot with one atomic increment of next and fills it without any lock, so recording is a few stores and a copy of
+ * TRACE_HEAD_LEN bytes. A reader may see an entry which is being overwritten, the trace is a diagnostic aid.
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "trace.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#if (TRACE_ENTRIES & (TRACE_ENTRIES - 1)) != 0
+#error "TRACE_ENTRIES has to be a power of two"
+#endif
+
+NODE_STATE static trace_entry_t entries[TRACE_ENTRIES];
+NODE_STATE static atomic_uint_fast32_t next; // runs freely, the slot is next modulo TRACE_ENTRIES
+NODE_STATE static uint32_t started_us;
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+static void print_hex(const char *, const void *, size_t);
+
+/* Called before any task which records frames is started */
+void init_trace(void)
+{
+    memset(entries, 0, sizeof(entries));
+    atomic_store_explicit(&next, 0, memory_order_relaxed);
+    started_us = (uint32_t)esp_timer_get_time();
+}
+
+/* Records the frame of len bytes received from or sent to mac_addr at time at (us), decision is one of TRACE_*.
+ * Returns the number of the entry for trace_decide */
+uint32_t trace_record(int64_t at, const uint8_t *mac_addr, const uint8_t *frame, uint8_t len, uint8_t decision)
+{
+    uint32_t number = (uint32_t)atomic_fetch_add_explicit(&next, 1, memory_order_relaxed);
+    trace_entry_t *e = &entries[number & (TRACE_ENTRIES - 1)];
+    uint8_t head = len < TRACE_HEAD_LEN ? len : TRACE_HEAD_LEN;
+
+    e->time_us = (uint32_t)at;
+    memcpy(e->mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+    e->len = len;
+    e->decision = decision;
+    memcpy(e->head, frame, head);
+    memset(&e->head[head], 0, TRACE_HEAD_LEN - head);
+    return number;
+}
+
+/* Replaces the decision of entry number, so that a received frame can be recorded before it is handled: a forwarded
+ * frame is changed or handed on by the time the node knows what it did with it */
+void trace_decide(uint32_t number, uint8_t decision)
+{
+    entries[number & (TRACE_ENTRIES - 1)].decision = decision;
+}
+
+/* Fills the header a trace file of this node starts with */
+void trace_header(trace_header_t *header)
+{
+    memcpy(header->magic, "VCPT", sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->entry_len = sizeof(trace_entry_t);
+    esp_wifi_get_mac(ESPNOW_WIFI_IF, header->mac_addr);
+    header->started_us = started_us;
+}
+
+/*
+ * Copies up to max entries, oldest first, from the entry cursor points at on into out and moves cursor behind them.
+ * Entries which were overwritten since the last call are skipped. Starting with *cursor == 0 and calling again with
+ * the same cursor exports every entry once, as long as less than TRACE_ENTRIES are recorded in between.
+ * Returns the number of entries copied.
+ */
+uint32_t trace_export(trace_entry_t *out, uint32_t max, uint32_t *cursor)
+{
+    uint32_t end = (uint32_t)atomic_load_explicit(&next, memory_order_acquire);
+    uint32_t copied = 0;
+
+    if (end - *cursor > TRACE_ENTRIES)
+    {
+        *cursor = end - TRACE_ENTRIES;
+    }
+    while (*cursor != end && copied < max)
+    {
+        out[copied++] = entries[*cursor & (TRACE_ENTRIES - 1)];
+        (*cursor)++;
+    }
+    return copied;
+}
+
+/* Prints the trace over the serial console: a "trace-header <bytes>" line and one "trace <bytes>" line per entry,
+ * oldest first, the bytes in hex. host/replay.c reads these lines as well as trace files */
+void trace_dump(void)
+{
+    trace_header_t header;
+    trace_entry_t entry;
+    uint32_t cursor = 0;
+
+    trace_header(&header);
+    print_hex("trace-header", &header, sizeof(header));
+    while (trace_export(&entry, 1, &cursor) == 1)
+    {
+        print_hex("trace", &entry, sizeof(entry));
+    }
+}
+
+static void print_hex(const char *tag, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    char line[2 * sizeof(trace_entry_t) + 1];
+
+    for (size_t i = 0; i < len; i++)
+    {
+        sprintf(&line[2 * i], "%02x", bytes[i]);
+    }
+    line[2 * len] = '\0';
+    printf("%s %s\n", tag, line);
+}
@@ -0,0 +1,422 @@
+/*
+ * vcp-message.c
+ *
+ * Lecture: Network Embedded Systems
+ * Authors: Giuseppe Boccia, Julio Cesar Espinoza Andrea, Tim Schmid
+ *
+ * This file contains the encoder and decoder of the virtual cord protocol messages (layout see config.h).
+ * Fields are not aligned inside the frame, so positions and sequence numbers are assembled byte by byte (little
+ * endian).
+ *
+ */
+
+/* --------------------------------------------------- external libs --------------------------------------------------- */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_now.h"
+
+/* -------------------------------------------------- own includes --------------------------------------------------- */
+#include "config.h"
+#include "vcp-message.h"
+
+/* --------------------------------------------- variables and constants --------------------------------------------- */
+#define RECORD_HEADER_LEN (2 * sizeof(vcp_position_t) + sizeof(uint16_t) + sizeof(uint8_t)) // record without payload
+#define DATA_BUDGET_OFFSET (sizeof(vcp_header_t) + sizeof(uint16_t) + 2 * sizeof(vcp_position_t))
+
+_Static_assert(DATA_BUDGET_OFFSET + sizeof(uint16_t) == VCP_DATA_HEADER_LEN, "VCP_DATA_HEADER_LEN is the DATA header");
+
+/* ----------------------------------------------- function definition ----------------------------------------------- */
+static inline uint8_t *put_position(uint8_t *p, vcp_position_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + sizeof(vcp_position_t);
+}
+
+static inline const uint8_t *get_position(const uint8_t *p, vcp_position_t *value)
+{
+    *value = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    return p + sizeof(vcp_position_t);
+}
+
+static inline uint8_t *put_seq(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + sizeof(uint16_t);
+}
+
+static inline const uint8_t *get_seq(const uint8_t *p, uint16_t *value)
+{
+    *value = p[0] | (uint16_t)p[1] << 8;
+    return p + sizeof(uint16_t);
+}
+
+/* The budget field of a DATA message or record carries the perf flag in its highest bit */
+static inline uint8_t *put_budget(uint8_t *p, const vcp_message_t *msg)
+{
+    return put_seq(p, msg->data.budget | (msg->data.perf ? VCP_DATA_PERF_FLAG : 0));
+}
+
+static inline const uint8_t *get_budget(const uint8_t *p, vcp_message_t *msg)
+{
+    uint16_t field;
+
+    p = get_seq(p, &field);
+    msg->data.budget = field & VCP_DATA_MAX_BUDGET;
+    msg->data.perf = (field & VCP_DATA_PERF_FLAG) != 0;
+    return p;
+}
+
+/* Writes msg into frame, which has to hold ESP_NOW_MAX_DATA_LEN bytes, and stores the number of bytes used in len */
+esp_err_t vcp_encode(const vcp_message_t *msg, uint8_t *frame, uint8_t *len)
+{
+    vcp_header_t header = {.version = VCP_WIRE_VERSION, .type = msg->type};
+    uint8_t *p = frame + sizeof(vcp_header_t);
+
+    memcpy(frame, &header, sizeof(vcp_header_t));
+
+    switch (msg->type)
+    {
+    case VCP_HELLO:
+        p = put_position(p, msg->hello.position);
+        p = put_position(p, msg->hello.successor);
+        p = put_position(p, msg->hello.predecessor);
+        break;
+    case VCP_UPDATE_SUCCESSOR:
+    case VCP_UPDATE_PREDECESSOR:
+        p = put_seq(p, msg->seq);
+        p = put_position(p, msg->update.position);
+        break;
+    case VCP_CREATE_VIRTUAL_NODE:
+        p = put_position(p, msg->update.position);
+        break;
+    case VCP_DATA:
+        if (DATA_BUDGET_OFFSET + sizeof(uint16_t) + msg->data.payload_len > ESP_NOW_MAX_DATA_LEN)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p = put_seq(p, msg->seq);
+        p = put_position(p, msg->data.recipient);
+        p = put_position(p, msg->data.source);
+        p = put_budget(p, msg);
+        // a payload which was written into frame already (vcp_data_alloc) stays where it is
+        if (msg->data.payload != p)
+        {
+            memcpy(p, msg->data.payload, msg->data.payload_len);
+        }
+        p += msg->data.payload_len;
+        break;
+    case VCP_ACK:
+        p = put_seq(p, msg->ack.cumulative);
+        p = put_position(p, msg->ack.selective); // same size and byte order as a position
+        break;
+    case VCP_FRAGMENT:
+    case VCP_STREAM_ACK:
+        if (msg->type == VCP_FRAGMENT && msg->data.payload_len > VCP_STREAM_FRAGMENT_LEN)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p = put_seq(p, msg->seq);
+        p = put_position(p, msg->data.recipient);
+        p = put_position(p, msg->data.source);
+        p = put_seq(p, msg->data.stream.id);
+        p = put_seq(p, msg->data.stream.index);
+        if (msg->type == VCP_STREAM_ACK)
+        {
+            p = put_position(p, msg->data.stream.selective);
+            break;
+        }
+        p = put_position(p, msg->data.stream.total_len);
+        memcpy(p, msg->data.payload, msg->data.payload_len);
+        p += msg->data.payload_len;
+        break;
+    case VCP_METRICS_REQUEST:
+    case VCP_METRICS:
+        if (msg->type == VCP_METRICS && msg->data.payload_len > VCP_METRICS_PAGE_LEN)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p = put_seq(p, msg->seq);
+        p = put_position(p, msg->data.recipient);
+        p = put_position(p, msg->data.source);
+        p = put_seq(p, msg->data.stream.index);
+        if (msg->type == VCP_METRICS_REQUEST)
+        {
+            break;
+        }
+        p = put_seq(p, msg->data.stream.total_len);
+        memcpy(p, msg->data.payload, msg->data.payload_len);
+        p += msg->data.payload_len;
+        break;
+    case VCP_DATA_BUNDLE:
+        if (sizeof(vcp_header_t) + sizeof(uint16_t) + msg->data.payload_len > ESP_NOW_MAX_DATA_LEN)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p = put_seq(p, msg->seq);
+        memcpy(p, msg->data.payload, msg->data.payload_len);
+        p += msg->data.payload_len;
+        break;
+    case VCP_ERR:
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    *len = p - frame;
+    return ESP_OK;
+}
+
+/* Reads a message from frame without copying the DATA payload, msg is only valid as long as frame is */
+esp_err_t vcp_decode(const uint8_t *frame, uint8_t len, vcp_message_t *msg)
+{
+    vcp_header_t header;
+    const uint8_t *p = frame + sizeof(vcp_header_t);
+    uint8_t expected = sizeof(vcp_header_t);
+    uint16_t total;
+
+    if (len < sizeof(vcp_header_t))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, frame, sizeof(vcp_header_t));
+    if (header.version != VCP_WIRE_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    switch (header.type)
+    {
+    case VCP_HELLO:
+        expected += 3 * sizeof(vcp_position_t);
+        break;
+    case VCP_UPDATE_SUCCESSOR:
+    case VCP_UPDATE_PREDECESSOR:
+        expected += sizeof(uint16_t) + sizeof(vcp_position_t);
+        break;
+    case VCP_CREATE_VIRTUAL_NODE:
+        expected += sizeof(vcp_position_t);
+        break;
+    case VCP_DATA:
+        expected += 2 * sizeof(uint16_t) + 2 * sizeof(vcp_position_t);
+        break;
+    case VCP_ACK:
+        expected += sizeof(uint16_t) + sizeof(uint32_t);
+        break;
+    case VCP_FRAGMENT:
+    case VCP_STREAM_ACK:
+        expected += 3 * sizeof(uint16_t) + 3 * sizeof(vcp_position_t);
+        break;
+    case VCP_METRICS_REQUEST:
+        expected += 2 * sizeof(uint16_t) + 2 * sizeof(vcp_position_t);
+        break;
+    case VCP_METRICS:
+        expected += 3 * sizeof(uint16_t) + 2 * sizeof(vcp_position_t);
+        break;
+    case VCP_DATA_BUNDLE:
+        expected += sizeof(uint16_t) + RECORD_HEADER_LEN;
+        break;
+    case VCP_ERR:
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // only DATA, FRAGMENT, DATA_BUNDLE and METRICS are allowed to be longer than their fixed fields
+    if (len < expected || (len > expected && header.type != VCP_DATA && header.type != VCP_FRAGMENT &&
+                           header.type != VCP_DATA_BUNDLE && header.type != VCP_METRICS))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    msg->type = header.type;
+    switch (header.type)
+    {
+    case VCP_HELLO:
+        p = get_position(p, &msg->hello.position);
+        p = get_position(p, &msg->hello.successor);
+        p = get_position(p, &msg->hello.predecessor);
+        break;
+    case VCP_UPDATE_SUCCESSOR:
+    case VCP_UPDATE_PREDECESSOR:
+        p = get_seq(p, &msg->seq);
+        p = get_position(p, &msg->update.position);
+        break;
+    case VCP_CREATE_VIRTUAL_NODE:
+        p = get_position(p, &msg->update.position);
+        break;
+    case VCP_DATA:
+        p = get_seq(p, &msg->seq);
+        p = get_position(p, &msg->data.recipient);
+        p = get_position(p, &msg->data.source);
+        p = get_budget(p, msg);
+        msg->data.payload = p;
+        msg->data.payload_len = len - expected;
+        break;
+    case VCP_ACK:
+        p = get_seq(p, &msg->ack.cumulative);
+        p = get_position(p, &msg->ack.selective); // same size and byte order as a position
+        break;
+    case VCP_FRAGMENT:
+    case VCP_STREAM_ACK:
+        p = get_seq(p, &msg->seq);
+        p = get_position(p, &msg->data.recipient);
+        p = get_position(p, &msg->data.source);
+        p = get_seq(p, &msg->data.stream.id);
+        p = get_seq(p, &msg->data.stream.index);
+        if (header.type == VCP_STREAM_ACK)
+        {
+            p = get_position(p, &msg->data.stream.selective);
+            break;
+        }
+        p = get_position(p, &msg->data.stream.total_len);
+        msg->data.payload = p;
+        msg->data.payload_len = len - expected;
+        break;
+    case VCP_METRICS_REQUEST:
+    case VCP_METRICS:
+        p = get_seq(p, &msg->seq);
+        p = get_position(p, &msg->data.recipient);
+        p = get_position(p, &msg->data.source);
+        p = get_seq(p, &msg->data.stream.index);
+        if (header.type == VCP_METRICS_REQUEST)
+        {
+            break;
+        }
+        p = get_seq(p, &total);
+        msg->data.stream.total_len = total;
+        msg->data.payload = p;
+        msg->data.payload_len = len - expected;
+        break;
+    case VCP_DATA_BUNDLE:
+        p = get_seq(p, &msg->seq);
+        msg->data.payload = p;
+        msg->data.payload_len = frame + len - p;
+        // the records have to fill the frame exactly
+        for (uint8_t offset = 0; offset < msg->data.payload_len;)
+        {
+            if (msg->data.payload_len - offset < RECORD_HEADER_LEN ||
+                msg->data.payload_len - offset - RECORD_HEADER_LEN < p[offset + RECORD_HEADER_LEN - 1])
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            offset += RECORD_HEADER_LEN + p[offset + RECORD_HEADER_LEN - 1];
+        }
+        break;
+    default:
+        break;
+    }
+
+    return ESP_OK;
+}
+
+
+/* Appends the DATA message msg to frame, which holds len bytes of an encoded DATA or DATA_BUNDLE message. A DATA
+ * message is turned into a DATA_BUNDLE with one record first. Returns ESP_ERR_INVALID_SIZE if msg does not fit, frame
+ * is unchanged then */
+esp_err_t vcp_bundle_append(uint8_t *frame, uint8_t *len, const vcp_message_t *msg)
+{
+    vcp_header_t header;
+    uint8_t *p;
+    uint8_t first = sizeof(vcp_header_t) + sizeof(uint16_t); // first record
+
+    memcpy(&header, frame, sizeof(vcp_header_t));
+    if (msg->type != VCP_DATA || (header.type != VCP_DATA && header.type != VCP_DATA_BUNDLE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (*len + (header.type == VCP_DATA) + RECORD_HEADER_LEN + msg->data.payload_len > ESP_NOW_MAX_DATA_LEN)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (header.type == VCP_DATA)
+    {
+        // recipient, source and budget stay in place, the payload length goes in front of the payload
+        p = frame + first + 2 * sizeof(vcp_position_t) + sizeof(uint16_t);
+        memmove(p + 1, p, frame + *len - p);
+        *p = frame + *len - p;
+        (*len)++;
+        header.type = VCP_DATA_BUNDLE;
+        memcpy(frame, &header, sizeof(vcp_header_t));
+    }
+
+    p = frame + *len;
+    p = put_position(p, msg->data.recipient);
+    p = put_position(p, msg->data.source);
+    p = put_budget(p, msg);
+    *p++ = msg->data.payload_len;
+    memcpy(p, msg->data.payload, msg->data.payload_len);
+    *len = p + msg->data.payload_len - frame;
+    return ESP_OK;
+}
+
+/* Reads the record at offset of the decoded DATA_BUNDLE bundle into record as a DATA message and moves offset to the
+ * next one. Returns false after the last record. vcp_decode checked the records already */
+bool vcp_bundle_next(const vcp_message_t *bundle, uint8_t *offset, vcp_message_t *record)
+{
+    const uint8_t *p = bundle->data.payload + *offset;
+
+    if (*offset >= bundle->data.payload_len)
+    {
+        return false;
+    }
+    record->type = VCP_DATA;
+    record->seq = bundle->seq;
+    p = get_position(p, &record->data.recipient);
+    p = get_position(p, &record->data.source);
+    p = get_budget(p, record);
+    record->data.payload_len = *p++;
+    record->data.payload = p;
+    *offset += RECORD_HEADER_LEN + record->data.payload_len;
+    return true;
+}
+
+/* Replaces the sequence number of frame, an encoded message of a type link_sequenced accepts, so that a received frame
+ * can be sent on to the next hop as it is. Sequenced types carry it right behind the header */
+void vcp_set_seq(uint8_t *frame, uint16_t seq)
+{
+    put_seq(frame + sizeof(vcp_header_t), seq);
+}
+
+/* Takes ms off the latency budgets of the DATA messages in frame, an encoded DATA or DATA_BUNDLE message which
+ * vcp_decode accepted. A budget does not drop below 1 ms, so that the message keeps being one with a budget, the perf
+ * flag stays as it is */
+void vcp_budget_elapsed(uint8_t *frame, uint8_t len, uint32_t ms)
+{
+    vcp_header_t header;
+    uint8_t *p = frame + DATA_BUDGET_OFFSET;
+    uint8_t *end = frame + len;
+    uint16_t field, budget;
+
+    memcpy(&header, frame, sizeof(vcp_header_t));
+    if (header.type == VCP_DATA_BUNDLE)
+    {
+        // budget of the first record
+        p = frame + sizeof(vcp_header_t) + sizeof(uint16_t) + 2 * sizeof(vcp_position_t);
+    }
+    else if (header.type != VCP_DATA)
+    {
+        return;
+    }
+
+    while (p + sizeof(uint16_t) <= end)
+    {
+        get_seq(p, &field);
+        budget = field & VCP_DATA_MAX_BUDGET;
+        if (budget > 0)
+        {
+            put_seq(p, (field & VCP_DATA_PERF_FLAG) | (budget > ms ? budget - ms : 1));
+        }
+        if (header.type == VCP_DATA)
+        {
+            return;
+        }
+        // from the budget of a record to the budget of the next one
+        p += sizeof(uint16_t) + 1 + p[sizeof(uint16_t)] + 2 * sizeof(vcp_position_t);
+    }
+}
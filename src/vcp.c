@@ -14,6 +14,8 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include "esp_random.h"
 #include "esp_event.h"
 #include "esp_netif.h"
@@ -32,193 +34,561 @@
 
 /* -------------------------------------------------- own includes --------------------------------------------------- */
 #include "config.h"
+#include "receive-ring.h"
 #include "sender-receiver.h"
+#include "packet-pool.h"
+#include "vcp-message.h"
 #include "vcp.h"
+#include "neighbor-table.h"
+#include "link-layer.h"
+#include "stream.h"
+#include "metrics.h"
+#include "trace.h"
 
 /* --------------------------------------------- variables and constants --------------------------------------------- */
-float own_position;
-int8_t i_successor; // index of the successor in the neighbors array, -1 if no successor
-int8_t i_predecessor;
-uint8_t neighbors_len;
-vcp_neighbor_data_t neighbors[ESPNOW_MAX_PEERS];
-uint8_t virtual_nodes_len;
-vcp_vnode_data_t virtual_nodes[VCP_MAX_VIRTUAL_NODES];
+NODE_STATE _Atomic vcp_position_t own_position;
+NODE_STATE int8_t i_successor; // index of the successor in the neighbors array, -1 if no successor
+NODE_STATE int8_t i_predecessor;
+NODE_STATE uint8_t virtual_nodes_len;
+NODE_STATE vcp_vnode_data_t virtual_nodes[VCP_MAX_VIRTUAL_NODES];
+NODE_STATE static TaskHandle_t vcp_task_handle;     // data plane
+NODE_STATE static TaskHandle_t control_task_handle; // control plane
+NODE_STATE static QueueHandle_t control_queue;      // vcp_control_message_t from the vcp task
+NODE_STATE static QueueHandle_t link_requests;      // vcp_link_request_t from the control task
+NODE_STATE static atomic_uint_fast32_t table_seq;   // odd while the neighbor table or the cord state is written
+NODE_STATE static SemaphoreHandle_t table_lock;     // taken by the writers of the neighbor table
+NODE_STATE static atomic_uint_fast32_t route_epoch; // moved on by the control task when cached routes may be wrong
+NODE_STATE static uint32_t route_epoch_seen;        // epoch the route cache was filled in
+NODE_STATE static uint8_t own_mac[ESP_NOW_ETH_ALEN];
+NODE_STATE static TimerHandle_t hello_timer;
+NODE_STATE static TimerHandle_t expire_timer; // moves the timing wheel of the neighbor table on
+NODE_STATE static vcp_route_data_t route_cache[VCP_ROUTE_CACHE_SIZE];
+NODE_STATE static uint32_t route_clock; // incremented on every use of a route cache entry
+NODE_STATE static vcp_route_cache_stats_t route_stats;
+NODE_STATE static uint32_t hello_interval;  // ms, current Trickle interval, 0 before joining the cord
+NODE_STATE static uint32_t hello_rest;      // ms, from the send point to the end of the interval
+NODE_STATE static uint8_t hello_heard;      // consistent HELLOs heard in the interval
+NODE_STATE static uint8_t hello_suppressed; // own HELLOs suppressed in a row
+NODE_STATE static bool hello_fresh;         // first interval after a reset, the HELLO is not suppressed
+NODE_STATE static bool hello_sent_point;    // the send point of the interval passed, the timer waits for its end
+NODE_STATE static vcp_hello_stats_t hello_stats;
+NODE_STATE static QueueHandle_t metrics_requests; // METRICS_REQUESTs to send, filled by vcp_metrics_request
+NODE_STATE static vcp_metrics_cb_t metrics_cb;
+NODE_STATE static QueueHandle_t data_requests; // vcp_data_request_t from vcp_data_send
+NODE_STATE static vcp_data_receive_cb_t data_cb;
+NODE_STATE static uint8_t trace_decision; // what handling the current frame did, for the packet trace
+#if VCP_PERF
+NODE_STATE static QueueHandle_t perf_requests; // vcp_perf_config_t from vcp_perf_start and vcp_perf_stop
+NODE_STATE static TimerHandle_t perf_timer;
+NODE_STATE static vcp_perf_config_t perf_config; // of the generator, rate 0 while it does not run
+NODE_STATE static uint32_t perf_generator;
+NODE_STATE static int64_t perf_started_at; // us, the generator sends rate messages per second from here on
+NODE_STATE static uint32_t perf_attempted; // messages which were due since perf_started_at
+NODE_STATE static uint8_t perf_payload[VCP_PERF_MAX_PAYLOAD_LEN];
+NODE_STATE static vcp_perf_stats_t perf_stats; // counters, vcp_perf_get_stats computes the rest
+NODE_STATE static vcp_perf_source_t perf_sources[VCP_PERF_SOURCES];
+NODE_STATE static uint32_t perf_samples[VCP_PERF_SAMPLES]; // us, reservoir sample of the latencies
+NODE_STATE static uint32_t perf_sorted[VCP_PERF_SAMPLES];  // copy of the sample vcp_perf_get_stats sorts
+NODE_STATE static uint32_t perf_samples_seen;
+NODE_STATE static int64_t perf_first_at; // us, first and last perf message received
+NODE_STATE static int64_t perf_last_at;
+NODE_STATE static int64_t perf_reported_at;
+NODE_STATE static uint32_t perf_reported; // messages received at the last report
+#endif
 
 /* ----------------------------------------------- function definition ----------------------------------------------- */
 static void vcp_task(void *);
-static esp_err_t handle_vcp_message(esp_now_data_t);
+static void control_task(void *);
+static void hello_timer_callback(TimerHandle_t);
+static void expire_timer_callback(TimerHandle_t);
+static esp_err_t handle_vcp_message(uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *, esp_now_data_t *);
+static void handle_control_message(uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+static void handle_link_requests(void);
+static bool receive_link(uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+static void refuse_link(uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
 static void join_virtual_cord(void);
 
 /* Helpers for creating messages */
 static esp_err_t new_hello_message(void);
-static esp_err_t new_update_message(uint8_t, uint8_t[ESP_NOW_ETH_ALEN], float);
-static esp_err_t new_data_message(float, char[]);
-static esp_err_t new_create_virtual_node_message(uint8_t[ESP_NOW_ETH_ALEN], float);
-static esp_err_t create_message(vcp_message_data_t *, uint8_t, uint8_t[ESP_NOW_ETH_ALEN]);
+static esp_err_t new_update_message(uint8_t, uint8_t[ESP_NOW_ETH_ALEN], vcp_position_t);
+static esp_err_t new_create_virtual_node_message(uint8_t[ESP_NOW_ETH_ALEN], vcp_position_t);
+static esp_err_t create_message(const vcp_message_t *, uint8_t[ESP_NOW_ETH_ALEN]);
+static esp_err_t forward(const vcp_message_t *, esp_now_data_t *);
+static esp_err_t cut_through(const vcp_message_t *, esp_now_data_t *);
+static esp_err_t to_control_task(uint8_t[ESP_NOW_ETH_ALEN], const vcp_message_t *);
+static void add_neighbor_later(uint8_t[ESP_NOW_ETH_ALEN]);
+static esp_err_t to_vcp_task(const vcp_link_request_t *);
+static void send_metrics_requests(void);
+static void send_data_requests(void);
+static void deliver(const vcp_message_t *);
+static void answer_metrics_request(const vcp_message_t *);
 static esp_err_t to_sender_queue(esp_now_data_t *);
-static esp_err_t ack_message(uint8_t to[ESP_NOW_ETH_ALEN]);
+#if VCP_PERF
+static void perf_timer_callback(TimerHandle_t);
+static void perf_tick(void);
+static void perf_generate(void);
+static bool perf_receive(const vcp_message_t *);
+#endif
 
 /* Helpers for handling vcp functionality */
-static int8_t find_neighbor_pos(float);
-static int8_t find_neighbor_addr(uint8_t[ESP_NOW_ETH_ALEN]);
 static int cmp_mac_addr(uint8_t[ESP_NOW_ETH_ALEN], uint8_t[ESP_NOW_ETH_ALEN]);
-static float position(float, float);
+static vcp_position_t position(vcp_position_t, vcp_position_t);
+static vcp_position_t end_position(vcp_position_t, vcp_position_t);
+static vcp_position_t distance(vcp_position_t, vcp_position_t);
+static int8_t next_hop(vcp_position_t, uint8_t[ESP_NOW_ETH_ALEN]);
+static int8_t greedy_next_hop(vcp_position_t, vcp_position_t *, uint32_t *);
+static bool better_link(int8_t, int8_t);
+static void widen_gap(int8_t, int8_t, vcp_position_t *, vcp_position_t *);
+static void expire_neighbors(void);
+static void remove_neighbor(int8_t);
+
+/* Sharing the neighbor table between the control task and the vcp task */
+static void table_write_begin(void);
+static void table_write_end(void);
+static uint32_t table_read_begin(void);
+static bool table_read_retry(uint32_t);
+static int8_t table_find_addr(const uint8_t[ESP_NOW_ETH_ALEN]);
+static void table_heard(const uint8_t[ESP_NOW_ETH_ALEN], int8_t);
+static void table_send_status(const uint8_t[ESP_NOW_ETH_ALEN], bool);
+static bool table_full(void);
+static void routes_changed(void);
+
+/* Trickle hello timer */
+static void hello_start_interval(void);
+static void hello_reset(void);
+static void hello_expired(void);
+
+/* Route cache */
+static void init_route_cache(void);
+static int route_find(vcp_position_t);
+static bool route_insert(vcp_position_t, vcp_position_t, int8_t);
+static void route_bound(vcp_position_t, vcp_position_t, vcp_position_t *, vcp_position_t *);
+static void route_range(vcp_position_t, vcp_position_t *, vcp_position_t *);
+static void route_learn(uint8_t[ESP_NOW_ETH_ALEN], vcp_position_t);
+static void route_sync(uint32_t);
+static void route_flush(void);
 
 /* ----------------------------------------------- MAIN VCP Algorithm ----------------------------------------------- */
 
-/* This function is the main task for the vcp functionality - it gets scheduled by FreeRTOS
- *
- * Within the while loop the following stages will be processed:
- * - PHASE 1: Listening cycle --> Waits for x loop cycles for incoming hello messages and reacts accordingly (VCP_DISCOVERY_CYCLES)
- * - PHASE 2: Joins the cord
- * - Phase 3: Maintains cord position, sends/receives data, etc...
+/* This function is the data plane of the vcp functionality - it gets scheduled by FreeRTOS on VCP_DATA_CORE
  *
+ * The task sleeps until it gets notified by the receiver/sender callbacks, the link layer or the control task, then it
+ * processes everything that is pending: it acknowledges the received frames, forwards and delivers DATA, stream and
+ * metrics messages and hands HELLO, UPDATE and CREATE_VIRTUAL_NODE messages to the control task. The cord itself
+ * (PHASE 1: listening, PHASE 2: joining, PHASE 3: maintaining the position) is run by control_task.
  */
 static void vcp_task(void *pvParameters) {
     q_receive_data_t received_data;
     q_send_error_data_t send_error_data;
+    esp_now_data_t frame;
+    vcp_message_t msg;
+    esp_err_t err;
+    uint32_t notification;
+    int64_t handled_at;
+    uint32_t trace_entry;
 
-    uint8_t idle_count = VCP_DISCOVERY_CYCLES;
-    uint16_t hello_message_period = 0;
+    while (true) {
 
-    own_position = VCP_INITIAL;
-    i_successor = -1;
-    i_predecessor = -1;
-    neighbors_len = 0;
-    virtual_nodes_len = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notification, portMAX_DELAY);
 
-    while (true) {
+        if (notification & VCP_NOTIFY_LINK_REQUEST) {
+            handle_link_requests();
+        }
 
-        vTaskDelay(VCP_TASK_DELAY_MS / portTICK_PERIOD_MS);
-        hello_message_period += VCP_TASK_DELAY_MS;
+        if (notification & VCP_NOTIFY_RETRANSMIT) {
+            link_retransmit();
+        }
 
-        if (own_position == VCP_INITIAL && idle_count > 0) { // phase 1
-            idle_count--;
-        } else if (own_position == VCP_INITIAL && idle_count == 0) { // phase 2
-            join_virtual_cord();
-            printf("Trying to join virtual cord... %f\n", own_position);
+        if (notification & VCP_NOTIFY_METRICS) {
+            send_metrics_requests();
         }
 
-        // Phase 3 --> Uses an internal counter to send hello messages with a specific period
-        if (own_position != VCP_INITIAL && hello_message_period > VCP_HELLO_MESSAGE_PERIOD) {
-            if (new_hello_message() != ESP_OK) {
-                ESP_LOGE(TAGS.send_tag, "Could not create hello message");
-            }
-            hello_message_period = 0;
+        if (notification & VCP_NOTIFY_DATA) {
+            send_data_requests();
         }
 
-        // PHASE 3 --> Reacts to incoming messages
-        if (uxQueueMessagesWaiting(receiver_queue) > 0) {
-            if (xQueueReceive(receiver_queue, &received_data, portMAX_DELAY) == pdTRUE) {
-                if (handle_vcp_message(parse_data(&received_data)) != ESP_OK) {
+#if VCP_PERF
+        if (notification & VCP_NOTIFY_PERF) {
+            perf_tick();
+        }
+#endif
+
+        // PHASE 3 --> Reacts to all incoming messages, the notification only says that there is at least one
+        while (receive_ring_pop(&receive_ring, &received_data)) {
+            handled_at = esp_timer_get_time();
+            metrics_latency(METRICS_STAGE_RECEIVE, handled_at - received_data.received_at);
+            frame = parse_data(&received_data);
+            // any frame shows that the neighbor is still there
+            table_heard(frame.mac_addr, received_data.rssi);
+            // recorded before it is handled, a forwarded frame is taken over by the link layer
+            trace_entry = trace_record(received_data.received_at, frame.mac_addr, frame.payload, frame.payload_length,
+                                       TRACE_LINK);
+            err = vcp_decode(frame.payload, frame.payload_length, &msg);
+            if (err == ESP_OK) {
+                metrics_count(msg.type, METRICS_RX);
+                trace_decision = TRACE_LINK;
+            } else {
+                ESP_LOGE(TAGS.receive_tag, "Dropping malformed message: %s", esp_err_to_name(err));
+                metrics_malformed();
+                trace_decision = TRACE_MALFORMED;
+            }
+            if (err == ESP_OK && receive_link(frame.mac_addr, &msg)) {
+                trace_decision = TRACE_HANDLED; // forward() changes it
+                err = handle_vcp_message(frame.mac_addr, &msg, &frame);
+                if (err == ESP_ERR_NO_MEM) {
+                    // no room to forward it: not acknowledging it backs the neighbor off instead of wasting airtime
+                    refuse_link(frame.mac_addr, &msg);
+                    trace_decision = TRACE_REFUSED;
+                } else if (err != ESP_OK) {
                     ESP_LOGE(TAGS.send_tag, "Handling message failed");
+                    trace_decision = TRACE_DROPPED;
                 }
             }
+            trace_decide(trace_entry, trace_decision);
+            // NULL if the link layer took the frame over
+            packet_free(frame.payload);
+            metrics_latency(METRICS_STAGE_HANDLE, esp_timer_get_time() - handled_at);
         }
-
-        if (uxQueueMessagesWaiting(sender_error_queue) > 0) {
-            if (xQueueReceive(sender_error_queue, &send_error_data, portMAX_DELAY) != pdTRUE) {
+        // everything received from a neighbor in this round is acknowledged at once
+        link_send_acks();
+        // new stream transfers, their timeouts and the fragments which could not be sent before
+        stream_poll();
+
+        // the send status of every unicast feeds the link estimate of its neighbor
+        while (xQueueReceive(sender_error_queue, &send_error_data, 0) == pdTRUE) {
+            if (send_error_data.status != ESP_NOW_SEND_SUCCESS) {
                 ESP_LOGE(TAGS.receive_tag, "Sending error status: %d\n", send_error_data.status);
             }
+            table_send_status(send_error_data.mac_addr, send_error_data.status == ESP_NOW_SEND_SUCCESS);
         }
     }
 }
 
-/* Here the received message are being processed by a state machine and depending on the message type an according action will be performed*/
-static esp_err_t handle_vcp_message(esp_now_data_t msg) {
+/* This function is the control plane of the vcp functionality - it gets scheduled by FreeRTOS on VCP_CONTROL_CORE
+ *
+ * The task sleeps until the hello timer, the neighbor expiry or the vcp task with a control message wakes it up. The
+ * following stages will be processed:
+ * - PHASE 1: Listening --> Announces itself and reacts to incoming hello messages until the hello timer expires the first time (VCP_DISCOVERY_PERIOD)
+ * - PHASE 2: Joins the cord
+ * - Phase 3: Maintains cord position (hello messages on the Trickle timer, UPDATEs, expired neighbors)
+ * Everything it does with the neighbor table is done between table_write_begin and table_write_end.
+ */
+static void control_task(void *pvParameters) {
+    vcp_control_message_t control;
+    uint32_t notification;
+    bool joined;
+
+    // PHASE 1 --> The hello timer first expires after the discovery period
+    hello_timer = xTimerCreate("vcp_hello", pdMS_TO_TICKS(VCP_DISCOVERY_PERIOD), pdFALSE, NULL, hello_timer_callback);
+    if (hello_timer == NULL || xTimerStart(hello_timer, 0) != pdPASS) {
+        ESP_LOGE(TAGS.send_tag, "Could not start hello timer");
+        vTaskDelete(NULL);
+    }
+    expire_timer = xTimerCreate("vcp_expire", pdMS_TO_TICKS(VCP_NEIGHBOR_TICK), pdTRUE, NULL, expire_timer_callback);
+    if (expire_timer == NULL || xTimerStart(expire_timer, 0) != pdPASS) {
+        ESP_LOGE(TAGS.send_tag, "Could not start neighbor expiry timer");
+    }
+    // a hello without position: the neighbors reset their hello intervals, so that all of them are heard in time
+    if (new_hello_message() != ESP_OK) {
+        ESP_LOGE(TAGS.send_tag, "Could not create hello message");
+    }
+
+    while (true) {
+
+        xTaskNotifyWait(0, UINT32_MAX, &notification, portMAX_DELAY);
+
+        if (notification & VCP_NOTIFY_HELLO) {
+            table_write_begin();
+            joined = own_position != VCP_INITIAL;
+            if (!joined) { // phase 2
+                join_virtual_cord();
+                routes_changed();
+                if (own_position == VCP_INITIAL) {
+                    // tries again once the neighbors got positions
+                    xTimerChangePeriod(hello_timer, pdMS_TO_TICKS(VCP_DISCOVERY_PERIOD), 0);
+                } else {
+                    // the new position is announced right away, the Trickle timer starts with the shortest interval
+                    if (new_hello_message() != ESP_OK) {
+                        ESP_LOGE(TAGS.send_tag, "Could not create hello message");
+                    }
+                    hello_reset();
+                }
+            } else { // Phase 3 --> Sends hello messages on the Trickle timer
+                hello_expired();
+            }
+            table_write_end();
+            if (!joined) {
+                printf("Trying to join virtual cord... %" PRIu32 "\n", own_position);
+            }
+        }
+
+        if (notification & VCP_NOTIFY_EXPIRE) {
+            expire_neighbors();
+        }
+
+        while (xQueueReceive(control_queue, &control, 0) == pdTRUE) {
+            table_write_begin();
+            if (!control.add_neighbor) {
+                handle_control_message(control.mac_addr, &control.msg);
+            } else if (neighbor_add(control.mac_addr) == -1) {
+                ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of neighbors reached");
+            }
+            table_write_end();
+        }
+    }
+}
+
+/* Wakes up the control task, called by the timer service task */
+static void hello_timer_callback(TimerHandle_t timer) {
+    xTaskNotify(control_task_handle, VCP_NOTIFY_HELLO, eSetBits);
+}
+
+/* Wakes up the control task, called by the timer service task */
+static void expire_timer_callback(TimerHandle_t timer) {
+    xTaskNotify(control_task_handle, VCP_NOTIFY_EXPIRE, eSetBits);
+}
+
+/* Here the received message are being processed by a state machine and depending on the message type an according action will be performed
+ * frame is the received frame msg was decoded from, NULL for the records of a bundle. A message forwarded unchanged is
+ * sent on in frame itself, frame->payload is NULL then as the link layer owns the buffer. Everything else that is sent
+ * on is encoded into a new buffer.
+ * Messages which change the cord are handled by the control task, ESP_ERR_NO_MEM if it has too many waiting */
+static esp_err_t handle_vcp_message(uint8_t from[ESP_NOW_ETH_ALEN], const vcp_message_t *msg, esp_now_data_t *frame) {
+    vcp_position_t self = atomic_load_explicit(&own_position, memory_order_relaxed);
+    vcp_position_t recipient;
+    vcp_message_t record;
+    uint8_t offset = 0;
+    esp_err_t err;
+
+    switch (msg->type) {
+    case VCP_HELLO:
+    case VCP_UPDATE_SUCCESSOR:
+    case VCP_UPDATE_PREDECESSOR:
+    case VCP_CREATE_VIRTUAL_NODE:
+    case VCP_ERR:
+        return to_control_task(from, msg);
+    case VCP_DATA:
+        // If message is for me, deliver it, otherwise forward it towards the recipient
+        recipient = msg->data.recipient;
+        route_learn(from, msg->data.source);
+        if (recipient == self) {
+            deliver(msg);
+        } else {
+            // sent on as it is, with what is left of its latency budget
+            err = forward(msg, frame);
+            if (err == ESP_ERR_NO_MEM) {
+                // the caller refuses the message, the neighbor sends it again later
+                return err;
+            }
+        }
+        break;
+    case VCP_DATA_BUNDLE:
+        // handled record by record, the records for the next hops are aggregated again by the link layer
+        for (int i = 0; vcp_bundle_next(msg, &offset, &record); i++) {
+            metrics_count(VCP_DATA, METRICS_RX);
+            err = handle_vcp_message(from, &record, NULL);
+            if (err == ESP_ERR_NO_MEM && i == 0) {
+                // nothing was forwarded yet, the neighbor sends the whole bundle again later
+                return err;
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAGS.receive_tag, "Dropping the DATA messages of bundle %u from record %d on", msg->seq, i);
+                break;
+            }
+        }
+        break;
+    case VCP_FRAGMENT:
+    case VCP_STREAM_ACK:
+        route_learn(from, msg->data.source);
+        if (msg->data.recipient != self) {
+            // forwarded unchanged, the link layer gives it the sequence number of the next hop
+            return forward(msg, frame);
+        }
+        if (msg->type == VCP_FRAGMENT) {
+            stream_receive(msg);
+        } else {
+            stream_handle_ack(msg);
+        }
+        break;
+    case VCP_METRICS_REQUEST:
+    case VCP_METRICS:
+        route_learn(from, msg->data.source);
+        if (msg->data.recipient != self) {
+            return forward(msg, frame);
+        }
+        if (msg->type == VCP_METRICS_REQUEST) {
+            answer_metrics_request(msg);
+        } else if (metrics_cb != NULL) {
+            metrics_cb(msg->data.source, msg->data.stream.index, msg->data.payload, msg->data.payload_len,
+                       msg->data.stream.total_len);
+        }
+        break;
+    default:
+        printf("Received message of unknown type: %x\n", msg->type);
+        break;
+    }
+    return ESP_OK;
+}
+
+/* Handles a message handle_vcp_message handed to the control task, runs between table_write_begin and table_write_end */
+static void handle_control_message(uint8_t from[ESP_NOW_ETH_ALEN], const vcp_message_t *msg) {
     int8_t n;
-    float recipient;
+    uint8_t known = neighbors_len;
 
-    switch (msg.payload->type) {
+    switch (msg->type) {
     case VCP_HELLO:
-        n = find_neighbor_addr(msg.mac_addr);
-        if (n == -1) {
-            // add new neighbor
-            neighbors[neighbors_len].position = ((float *)(msg.payload->args))[0];
-            neighbors[neighbors_len].successor = ((float *)(msg.payload->args))[1];
-            neighbors[neighbors_len].predecessor = ((float *)(msg.payload->args))[2];
-            memcpy(neighbors[neighbors_len].mac_addr, msg.mac_addr, sizeof(msg.mac_addr));
+        if (msg->hello.position == VCP_INITIAL && neighbor_find_addr(from) == -1) {
+            // a node which waits to join is not a neighbor for routing yet, but it has to hear the hellos of all its
+            // neighbors before it joins
+            hello_reset();
+            break;
+        }
+        n = neighbor_add(from);
+        if (n != -1) {
+            // most hellos repeat what is known already, only changes invalidate cached routes
+            if (neighbors[n].position != msg->hello.position || neighbors[n].successor != msg->hello.successor ||
+                neighbors[n].predecessor != msg->hello.predecessor) {
+                neighbor_set_position(n, msg->hello.position);
+                neighbors[n].successor = msg->hello.successor;
+                neighbors[n].predecessor = msg->hello.predecessor;
+                routes_changed();
+                hello_reset();
+            } else if (neighbors_len != known) {
+                // a new neighbor, it does not know this node yet
+                hello_reset();
+            } else {
+                hello_heard++;
+            }
         } else {
-            // update existing neighbor
-            neighbors[n].position = ((float *)(msg.payload->args))[0];
-            neighbors[n].successor = ((float *)(msg.payload->args))[1];
-            neighbors[n].predecessor = ((float *)(msg.payload->args))[2];
+            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of neighbors reached");
         }
         break;
     case VCP_UPDATE_SUCCESSOR:
         // update my successor and my cord position
-        own_position = ((float *)(msg.payload->args))[0];
-        n = find_neighbor_addr(msg.mac_addr);
+        if (own_position != msg->update.position) {
+            own_position = msg->update.position;
+            routes_changed();
+        }
+        hello_reset();
+        // a new neighbor is added without positions, they will be updated by an hello message in the future
+        n = neighbor_add(from);
         if (n != -1) {
             i_successor = n;
         } else {
-            if (neighbors_len < ESPNOW_MAX_PEERS) {
-                // Initialize new neighbor, its pos, succ and pred will be updated by an hello message in the future
-                neighbors[neighbors_len].position = VCP_INITIAL;
-                neighbors[neighbors_len].successor = VCP_INITIAL;
-                neighbors[neighbors_len].predecessor = VCP_INITIAL;
-                memcpy(neighbors[neighbors_len].mac_addr, msg.mac_addr, sizeof(msg.mac_addr));
-                neighbors_len++;
-            } else {
-                ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of peers reached");
-            }
+            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of neighbors reached");
         }
         break;
     case VCP_UPDATE_PREDECESSOR:
         // update my predecessor and my cord position
-        own_position = ((float *)(msg.payload->args))[0];
-        n = find_neighbor_addr(msg.mac_addr);
+        if (own_position != msg->update.position) {
+            own_position = msg->update.position;
+            routes_changed();
+        }
+        hello_reset();
+        n = neighbor_add(from);
         if (n != -1) {
             i_predecessor = n;
         } else {
-            if (neighbors_len < ESPNOW_MAX_PEERS) {
-                // Initialize new neighbor, its pos, succ and pred will be updated by an hello message in the future
-                neighbors[neighbors_len].position = VCP_INITIAL;
-                neighbors[neighbors_len].successor = VCP_INITIAL;
-                neighbors[neighbors_len].predecessor = VCP_INITIAL;
-                memcpy(neighbors[neighbors_len].mac_addr, msg.mac_addr, sizeof(msg.mac_addr));
-                neighbors_len++;
-            } else {
-                ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of peers reached");
-            }
+            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of neighbors reached");
         }
         break;
     case VCP_CREATE_VIRTUAL_NODE:
         // adds neighbor and creates virtual node
-        if (neighbors_len < ESPNOW_MAX_PEERS) {
-            // Initialize new neighbor, its pos, succ and pred will be updated by an hello message in the future
-            neighbors[neighbors_len].position = VCP_INITIAL;
-            neighbors[neighbors_len].successor = VCP_INITIAL;
-            neighbors[neighbors_len].predecessor = VCP_INITIAL;
-            memcpy(neighbors[neighbors_len].mac_addr, msg.mac_addr, sizeof(msg.mac_addr));
-            neighbors_len++;
-        } else {
-            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of peers reached");
+        n = neighbor_add(from);
+        if (n == -1) {
+            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, max number of neighbors reached");
+            break;
+        }
+        if (virtual_nodes_len == VCP_MAX_VIRTUAL_NODES) {
+            ESP_LOGE(TAGS.receive_tag, "Can't create virtual node, max number of virtual nodes reached");
+            break;
         }
-        virtual_nodes[virtual_nodes_len].position = ((float *)(msg.payload->args))[0];
+        virtual_nodes[virtual_nodes_len].position = msg->update.position;
         virtual_nodes[virtual_nodes_len].i_successor = i_successor;
-        virtual_nodes[virtual_nodes_len].i_predecessor = neighbors_len - 1;
+        virtual_nodes[virtual_nodes_len].i_predecessor = n;
+        virtual_nodes_len++;
+        hello_reset();
 
-        break;
-    case VCP_DATA:
-        // If message is for me, print, otherwise forward to successor
-        recipient = ((float *)msg.payload->args)[0];
-        if (recipient == own_position) {
-            printf("Received data: %s\n", (char *)(msg.payload->args + 1));
-        } else {
-            new_data_message(recipient, (char *)(msg.payload->args + 1));
-        }
         break;
     case VCP_ERR:
         printf("Received error message\n");
         break;
     default:
-        printf("Received message of unknown type: %x\n", msg.payload->type);
         break;
     }
+}
+
+/* Hands a control message over to the control task. If too many wait an UPDATE is refused, so that the neighbor
+ * sends it again, other messages are dropped: the Trickle timer repeats a HELLO soon */
+static esp_err_t to_control_task(uint8_t from[ESP_NOW_ETH_ALEN], const vcp_message_t *msg) {
+    vcp_control_message_t control = {.add_neighbor = false};
+
+    memcpy(control.mac_addr, from, ESP_NOW_ETH_ALEN);
+    control.msg = *msg;
+    if (xQueueSend(control_queue, &control, 0) != pdTRUE) {
+        ESP_LOGE(TAGS.receive_tag, "Control queue full, message of type %x is not handled", msg->type);
+        return link_sequenced(msg->type) ? ESP_ERR_NO_MEM : ESP_FAIL;
+    }
+    xTaskNotify(control_task_handle, VCP_NOTIFY_CONTROL, eSetBits);
     return ESP_OK;
 }
 
+/* Asks the control task to add the sender of a sequenced frame which is not in the neighbor table yet. Nothing is
+ * lost if the control queue is full, the neighbor sends the frame again */
+static void add_neighbor_later(uint8_t from[ESP_NOW_ETH_ALEN]) {
+    vcp_control_message_t control = {.add_neighbor = true};
+
+    memcpy(control.mac_addr, from, ESP_NOW_ETH_ALEN);
+    if (xQueueSend(control_queue, &control, 0) == pdTRUE) {
+        xTaskNotify(control_task_handle, VCP_NOTIFY_CONTROL, eSetBits);
+    }
+}
+
+/* Link layer part of the reception: consumes ACKs, acknowledges messages with a sequence number and filters
+ * duplicates. Returns true if the message has to be handled */
+static bool receive_link(uint8_t from[ESP_NOW_ETH_ALEN], const vcp_message_t *msg) {
+    int8_t n;
+
+    // handed to the receive path locally (the host simulator injects its traffic like this), never sent over the air
+    if (cmp_mac_addr(from, own_mac) == 0) {
+        return true;
+    }
+
+    switch (msg->type) {
+    case VCP_ACK:
+        n = table_find_addr(from);
+        if (n != -1) {
+            link_handle_ack(n, from, msg);
+        }
+        return false;
+    default:
+        if (!link_sequenced(msg->type)) {
+            return true;
+        }
+        n = table_find_addr(from);
+        if (n == -1 && table_full()) {
+            ESP_LOGE(TAGS.receive_tag, "Can't add neighbor, message is neither acknowledged nor checked for duplicates");
+            return true;
+        }
+        if (n == -1) {
+            // the first frame of a new neighbor: the vcp task never writes the table, so the frame is not acknowledged
+            // and its retransmission finds the neighbor added by the control task
+            add_neighbor_later(from);
+            return false;
+        }
+        return link_receive(n, from, msg);
+    }
+}
+
+/* Takes back the reception of a message receive_link let through, it is not acknowledged and sent again */
+static void refuse_link(uint8_t from[ESP_NOW_ETH_ALEN], const vcp_message_t *msg) {
+    int8_t n = table_find_addr(from);
+
+    if (n != -1 && cmp_mac_addr(from, own_mac) != 0) {
+        link_refuse(n, from, msg->seq);
+    }
+}
+
 /*
  * ------------------------------------------------------------------
  * This function reviews the neighbors table to find its own cord position.
@@ -226,15 +596,18 @@ static esp_err_t handle_vcp_message(esp_now_data_t msg) {
  * Adapted from slides "08-routing.pdf" and VCP paper (2008).
  * When joining the cord, 5 cases are possible:
  *   0. I have no neighbors
- *   A. I am neighbor with node 0.0
- *   B. I am neighbor with node 1.0
+ *   A. I am neighbor with the node at VCP_START
+ *   B. I am neighbor with the node at VCP_END
  *   C. I am neighbor with 2 nodes that are neighbor with each other
  *   D. None of the previous ones ---> create virtual node
+ * If no position is left in the chosen gap the next case is tried, own_position stays VCP_INITIAL if all fail.
  * ------------------------------------------------------------------
  */
 static void join_virtual_cord() {
-    float new_neighbor_position;
-    float vnode_position;
+    vcp_position_t new_neighbor_position;
+    vcp_position_t vnode_position;
+    vcp_position_t successor;
+    vcp_position_t low, high;
     int8_t n;
 
     // CASE 0: I have no neighbors
@@ -243,55 +616,85 @@ static void join_virtual_cord() {
         return;
     }
 
-    // CASE A: I am neighbor with node 0.0
-    n = find_neighbor_pos(VCP_START);
+    // CASE A: I am neighbor with the node at VCP_START, it moves towards its successor
+    n = neighbor_find_pos(VCP_START);
     if (n != -1) {
-        own_position = VCP_START;
-        i_successor = n;
-        i_predecessor = -1;
         if (neighbors[n].successor == VCP_INITIAL) {
             new_neighbor_position = VCP_END;
         } else {
-            new_neighbor_position = position(own_position, neighbors[n].successor);
+            new_neighbor_position = end_position(neighbors[n].successor, VCP_START);
+        }
+        if (new_neighbor_position != VCP_INITIAL) {
+            own_position = VCP_START;
+            i_successor = n;
+            i_predecessor = -1;
+            neighbor_set_position(n, new_neighbor_position);
+            new_update_message(VCP_UPDATE_PREDECESSOR, neighbors[n].mac_addr, new_neighbor_position);
+            return;
         }
-        new_update_message(VCP_UPDATE_PREDECESSOR, neighbors[n].mac_addr, new_neighbor_position);
-        return;
     }
 
-    // CASE B: I am neighbor with node 1.0
-    n = find_neighbor_pos(VCP_END);
+    // CASE B: I am neighbor with the node at VCP_END, it moves towards its predecessor
+    n = neighbor_find_pos(VCP_END);
     if (n != -1) {
-        own_position = VCP_END;
-        i_successor = -1;
-        i_predecessor = n;
-        new_neighbor_position = position(neighbors[n].predecessor, VCP_END);
-        new_update_message(VCP_UPDATE_SUCCESSOR, neighbors[n].mac_addr, new_neighbor_position);
-        return;
+        if (neighbors[n].predecessor == VCP_INITIAL) {
+            new_neighbor_position = end_position(VCP_START, VCP_END);
+        } else {
+            new_neighbor_position = end_position(neighbors[n].predecessor, VCP_END);
+        }
+        if (new_neighbor_position != VCP_INITIAL) {
+            own_position = VCP_END;
+            i_successor = -1;
+            i_predecessor = n;
+            neighbor_set_position(n, new_neighbor_position);
+            new_update_message(VCP_UPDATE_SUCCESSOR, neighbors[n].mac_addr, new_neighbor_position);
+            return;
+        }
     }
 
     // CASE C: I am neighbor with 2 nodes that are neighbor with each other
-    for (int i = 0; i < neighbors_len; i++) {
-        for (int j = 0; j < neighbors_len; j++) {
-            if ((i != j) && (neighbors[i].predecessor == neighbors[j].position)) {
-                // neighbor j is predecessor to neighbor i
-                own_position = position(neighbors[j].position, neighbors[i].position);
-                i_predecessor = j;
-                i_successor = i;
-
-                new_update_message(VCP_UPDATE_SUCCESSOR, neighbors[j].mac_addr, neighbors[j].position);
-                new_update_message(VCP_UPDATE_PREDECESSOR, neighbors[i].mac_addr, neighbors[i].position);
-                return;
+    for (int r = 0; r < neighbors_len; r++) {
+        int8_t i = neighbor_at(r);
+        int8_t j = neighbors[i].predecessor == VCP_INITIAL ? -1 : neighbor_find_pos(neighbors[i].predecessor);
+
+        if (j != -1 && j != i && neighbors[j].position < neighbors[i].position) {
+            // neighbor j is predecessor to neighbor i
+            low = neighbors[j].position;
+            high = neighbors[i].position;
+            if (high - low < VCP_MIN_GAP) {
+                widen_gap(j, i, &low, &high);
+            }
+            own_position = position(low, high);
+            if (own_position == VCP_INITIAL) {
+                continue;
             }
+            // the table (and the order the loop walks) only changes once the node joins in this gap, the moved
+            // neighbor learns its new position from the UPDATE
+            neighbor_set_position(j, low);
+            neighbor_set_position(i, high);
+            i_predecessor = j;
+            i_successor = i;
+
+            new_update_message(VCP_UPDATE_SUCCESSOR, neighbors[j].mac_addr, low);
+            new_update_message(VCP_UPDATE_PREDECESSOR, neighbors[i].mac_addr, high);
+            return;
         }
     }
 
-    // CASE D: create virtual node
-    vnode_position = position(neighbors[0].position, neighbors[0].successor);
-    if (new_create_virtual_node_message(neighbors[0].mac_addr, vnode_position) != ESP_OK) {
+    // CASE D: create virtual node next to the neighbor with the lowest position, neighbors without one come last
+    n = neighbor_at(0);
+    if (neighbors[n].position == VCP_INITIAL) {
+        own_position = VCP_INITIAL;
+        return;
+    }
+    successor = neighbors[n].successor == VCP_INITIAL ? VCP_END : neighbors[n].successor;
+    vnode_position = position(neighbors[n].position, successor);
+    own_position = position(neighbors[n].position, vnode_position);
+    if (own_position == VCP_INITIAL) {
+        ESP_LOGE(TAGS.send_tag, "No free position next to neighbor %d", n);
+    } else if (new_create_virtual_node_message(neighbors[n].mac_addr, vnode_position) != ESP_OK) {
         ESP_LOGE(TAGS.send_tag, "Could not create virtual node message");
         own_position = VCP_INITIAL;
-    } else {
-        own_position = position(neighbors[0].position, vnode_position);
     }
     return;
 }
@@ -300,195 +703,1107 @@ static void join_virtual_cord() {
 
 /* Creates a the periodic hello message */
 static esp_err_t new_hello_message() {
-    vcp_message_data_t *msg;
-    uint8_t to[ESP_NOW_ETH_ALEN];
+    vcp_message_t msg = {.type = VCP_HELLO};
 
-    uint8_t payload_length = sizeof(uint8_t) + 3 * sizeof(float);
-    msg = (vcp_message_data_t *)malloc(payload_length);
+    msg.hello.position = own_position;
+    msg.hello.successor = VCP_INITIAL;
+    msg.hello.predecessor = VCP_INITIAL;
 
-    if (msg == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for hello message");
-        return ESP_FAIL;
+    if (i_successor != -1) {
+        msg.hello.successor = neighbors[i_successor].position;
     }
+    if (i_predecessor != -1) {
+        msg.hello.predecessor = neighbors[i_predecessor].position;
+    }
+    hello_stats.sent++;
+    return create_message(&msg, broadcast_mac);
+}
 
-    memset(msg, 0, payload_length);
+/* Creates a new update message, the vcp task hands it to the link layer */
+static esp_err_t new_update_message(uint8_t type, uint8_t to[ESP_NOW_ETH_ALEN], vcp_position_t new_position) {
+    vcp_link_request_t request = {.forget = -1, .msg = {.type = type}};
 
-    msg->type = VCP_HELLO;
+    request.msg.update.position = new_position;
+    memcpy(request.mac_addr, to, ESP_NOW_ETH_ALEN);
 
-    ((float *)msg->args)[0] = own_position;
-    ((float *)msg->args)[1] = VCP_INITIAL;
-    ((float *)msg->args)[2] = VCP_INITIAL;
+    return to_vcp_task(&request);
+}
 
-    if (i_successor != -1) {
-        ((float *)msg->args)[1] = neighbors[i_successor].position;
-    }
-    if (i_predecessor != -1) {
-        ((float *)msg->args)[2] = neighbors[i_predecessor].position;
+/* Hands a request of the control task over to the vcp task */
+static esp_err_t to_vcp_task(const vcp_link_request_t *request) {
+    if (xQueueSend(link_requests, request, 0) != pdTRUE) {
+        ESP_LOGE(TAGS.send_tag, "Link request queue full, could not send message of type %x", request->msg.type);
+        return ESP_ERR_NO_MEM;
     }
-    memcpy(to, broadcast_mac, sizeof(broadcast_mac));
-    return create_message(msg, payload_length, to);
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_LINK_REQUEST, eSetBits);
+    return ESP_OK;
 }
 
-static esp_err_t ack_message(uint8_t to[ESP_NOW_ETH_ALEN]) {
-    vcp_message_data_t *msg;
-    msg = (vcp_message_data_t *)malloc(sizeof(uint8_t));
+/* Sends the UPDATEs of the control task and drops the link state of the neighbors it removed, in the vcp task */
+static void handle_link_requests() {
+    vcp_link_request_t request;
 
-    if (msg == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for ack message");
-        return ESP_FAIL;
+    while (xQueueReceive(link_requests, &request, 0) == pdTRUE) {
+        if (request.forget != -1) {
+            link_forget(request.forget, request.mac_addr);
+        } else if (create_message(&request.msg, request.mac_addr) != ESP_OK) {
+            ESP_LOGE(TAGS.send_tag, "Could not create update message");
+        }
     }
+}
 
-    memset(msg, 0, sizeof(uint8_t));
-    msg->type = VCP_ACK;
+/* Routes a message for another node on, in the frame it was received in unless that is NULL, counts it as forwarded
+ * or, if there is no route, as dropped. ESP_ERR_NO_MEM is neither, the neighbor sends the message again */
+static esp_err_t forward(const vcp_message_t *msg, esp_now_data_t *frame) {
+    esp_err_t err = frame != NULL ? cut_through(msg, frame) : vcp_route(msg);
 
-    return create_message(msg, sizeof(uint8_t), to);
+    if (err == ESP_OK) {
+        metrics_count(msg->type, METRICS_FORWARD);
+        trace_decision = TRACE_FORWARDED;
+    } else if (err != ESP_ERR_NO_MEM) {
+        metrics_count(msg->type, METRICS_DROP);
+    }
+    return err;
 }
 
-/* Creates a new update message */
-static esp_err_t new_update_message(uint8_t type, uint8_t to[ESP_NOW_ETH_ALEN], float new_position) {
-    vcp_message_data_t *msg;
-    uint8_t payload_length = sizeof(uint8_t) + sizeof(float);
+/* Sends a DATA, FRAGMENT, STREAM_ACK or METRICS message to the next hop towards msg->data.recipient. ESP_ERR_NO_MEM
+ * means that the link to the next hop has no room for it right now */
+esp_err_t vcp_route(const vcp_message_t *msg) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+
+    if (next_hop(msg->data.recipient, mac_addr) == -1) {
+        ESP_LOGE(TAGS.send_tag, "No route to position %" PRIu32, msg->data.recipient);
+        return ESP_FAIL;
+    }
+    return create_message(msg, mac_addr);
+}
 
-    msg = (vcp_message_data_t *)malloc(payload_length);
+/* Like vcp_route, but hands frame, which holds msg encoded (the received frame or one of vcp_data_send), to the link
+ * layer instead of encoding msg into a new buffer: only its sequence number changes (cut-through). frame->payload is
+ * NULL once the link layer owns it */
+static esp_err_t cut_through(const vcp_message_t *msg, esp_now_data_t *frame) {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    esp_err_t err;
+    int8_t n;
 
-    if (msg == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for update position message");
+    if (next_hop(msg->data.recipient, mac_addr) == -1) {
+        ESP_LOGE(TAGS.send_tag, "No route to position %" PRIu32, msg->data.recipient);
         return ESP_FAIL;
     }
+    n = table_find_addr(mac_addr);
+    if (n == -1) {
+        ESP_LOGE(TAGS.send_tag, "Message of type %x is not addressed to a neighbor", msg->type);
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = link_forward(n, mac_addr, msg, frame->payload, frame->payload_length);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAGS.send_tag, "Could not forward message of type %x: %s", msg->type, esp_err_to_name(err));
+        return err;
+    }
+    frame->payload = NULL;
+    return ESP_OK;
+}
 
-    memset(msg, 0, payload_length);
+static esp_err_t new_create_virtual_node_message(uint8_t to[ESP_NOW_ETH_ALEN], vcp_position_t vnode_position) {
+    vcp_message_t msg = {.type = VCP_CREATE_VIRTUAL_NODE};
 
-    msg->type = type;
-    ((float *)msg->args)[0] = new_position;
+    msg.update.position = vnode_position;
 
-    return create_message(msg, sizeof(float), to);
+    return create_message(&msg, broadcast_mac);
 }
 
-/* Creates a new data message, this function contains the greedy routing mechanism */
-static esp_err_t new_data_message(float to, char content[]) {
-    vcp_message_data_t *msg;
-    uint8_t payload_length = sizeof(float) + strlen(content);
+/* Encodes the message into a buffer of the packet pool and wraps it into an esp_now_data_t in order to be processed
+ * by the sender_task. The buffer is handed over to the sender_task, which gives it back to the packet pool.
+ * DATA, UPDATE and stream messages are handed to the link layer instead, which retransmits them until they are
+ * acknowledged */
+static esp_err_t create_message(const vcp_message_t *msg, uint8_t to[ESP_NOW_ETH_ALEN]) {
+    esp_now_data_t sender_queue_data;
+    esp_err_t err;
     int8_t n;
 
-    // ARGS: first 4 bytes are the float, the rest is the content (string)
-    msg = (vcp_message_data_t *)malloc(payload_length);
-    if (msg == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for data message");
-        return ESP_FAIL;
+    // DATA, UPDATE and stream messages are acknowledged hop by hop, the link layer keeps them until then
+    if (link_sequenced(msg->type)) {
+        n = table_find_addr(to);
+        if (n == -1) {
+            ESP_LOGE(TAGS.send_tag, "Message of type %x is not addressed to a neighbor", msg->type);
+            return ESP_ERR_NOT_FOUND;
+        }
+        err = link_send(n, to, msg);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAGS.send_tag, "Could not send message of type %x: %s", msg->type, esp_err_to_name(err));
+        }
+        return err;
     }
 
-    memset(msg, 0, payload_length);
+    sender_queue_data.payload = packet_alloc();
 
-    msg->type = VCP_DATA;
+    if (sender_queue_data.payload == NULL) {
+        ESP_LOGE(TAGS.send_tag, "Packet pool exhausted, could not create message of type %x", msg->type);
+        return ESP_ERR_NO_MEM;
+    }
 
-    ((float *)msg->args)[0] = to;
-    strcpy((char *)(((float *)(msg->args)) + 1), content); // pointer hell but should work :_)
+    err = vcp_encode(msg, sender_queue_data.payload, &sender_queue_data.payload_length);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAGS.send_tag, "Could not encode message of type %x: %s", msg->type, esp_err_to_name(err));
+        packet_free(sender_queue_data.payload);
+        return err;
+    }
 
-    // if recipient is my neighbour, send it directly to him, otherwise send msg to successor
-    n = find_neighbor_pos(to);
-    if (n != -1) {
-        return create_message(msg, payload_length, neighbors[n].mac_addr);
+    if (cmp_mac_addr(to, broadcast_mac) == 0) {
+        sender_queue_data.transmit_type = TRANSMIT_TYPE_BROADCAST;
     } else {
-        if (own_position > neighbors[n].position) {
-            return create_message(msg, payload_length, neighbors[i_predecessor].mac_addr);
+        sender_queue_data.transmit_type = TRANSMIT_TYPE_UNICAST;
+    }
+
+    memcpy(sender_queue_data.mac_addr, to, ESP_NOW_ETH_ALEN);
+    return to_sender_queue(&sender_queue_data);
+}
+
+/* Copies the esp_now_data_t into the control class of the sender, its buffer is freed if that fails */
+static esp_err_t to_sender_queue(esp_now_data_t *esp_now_data) {
+    esp_now_data->traffic_class = TRAFFIC_CLASS_CONTROL;
+    return sender_enqueue(esp_now_data);
+}
+
+/*
+ * Returns the neighbor to send a message for position to, or -1 if there is none.
+ * Repeated destinations are answered by the route cache. Otherwise the greedy next hop is computed and cached for the
+ * whole range of positions it is the greedy next hop for. If no neighbor gets closer than this node, the message
+ * follows the cord towards the destination as long as the cord neighbor is closer to it; that fallback is not cached.
+ * A destination between this node and its cord neighbor is held by no node (any more), so there is no route to it:
+ * following the cord past it would only send the message back and forth between the two nodes.
+ */
+static int8_t next_hop(vcp_position_t to, uint8_t mac_addr[ESP_NOW_ETH_ALEN]) {
+    vcp_position_t self, reached = 0, low = 0, high = 0;
+    uint32_t seq, ties, epoch;
+    int8_t hop;
+    int slot;
+    bool greedy;
+
+    // the route cache only changes below, after the neighbor table was read consistently
+    do {
+        seq = table_read_begin();
+        epoch = (uint32_t)atomic_load_explicit(&route_epoch, memory_order_acquire);
+        self = atomic_load_explicit(&own_position, memory_order_relaxed);
+        ties = 0;
+        greedy = false;
+        // the cache is out of date if the epoch moved on, route_sync drops it below
+        slot = epoch == route_epoch_seen ? route_find(to) : -1;
+        if (slot != -1) {
+            hop = route_cache[slot].i_next_hop;
         } else {
-            return create_message(msg, payload_length, neighbors[i_successor].mac_addr);
+            hop = greedy_next_hop(to, &reached, &ties);
+            greedy = hop != -1 && self != VCP_INITIAL;
+            if (greedy) {
+                route_range(reached, &low, &high);
+            } else if (hop == -1) {
+                hop = to > self ? i_successor : i_predecessor;
+                if (hop != -1 && distance(neighbors[hop].position, to) >= distance(self, to)) {
+                    hop = -1;
+                }
+            }
+        }
+        if (hop != -1) {
+            memcpy(mac_addr, neighbors[hop].mac_addr, ESP_NOW_ETH_ALEN);
         }
+    } while (table_read_retry(seq));
+
+    route_sync(epoch);
+    if (slot != -1) {
+        route_cache[slot].last_used = ++route_clock;
+        route_stats.hits++;
+        return hop;
     }
+    route_stats.misses++;
+    route_stats.link_ties += ties;
+    if (greedy) {
+        route_insert(low, high, hop);
+    }
+    return hop;
 }
 
-static esp_err_t new_create_virtual_node_message(uint8_t to[ESP_NOW_ETH_ALEN], float vnode_position) {
-    vcp_message_data_t *msg;
-    uint8_t payload_length = sizeof(uint8_t) + sizeof(float);
-    msg = (vcp_message_data_t *)malloc(payload_length);
+/*
+ * Greedy routing: returns the neighbor which gets a message for position to closer than this node, or -1 if there is
+ * none. Every neighbor reaches its own position in one hop and its advertised cord neighbors (successor and predecessor
+ * from its HELLO) in two, as cord neighbors are physical neighbors. The neighbor which reaches the position closest to
+ * the destination is chosen, one hop wins ties. Among neighbors which reach the same position in two hops the one with
+ * the cheaper link (neighbor_link_cost) wins. The position it reaches is stored in reached, the ties the link broke
+ * are added to ties.
+ */
+static int8_t greedy_next_hop(vcp_position_t to, vcp_position_t *reached, uint32_t *ties) {
+    vcp_position_t best = distance(atomic_load_explicit(&own_position, memory_order_relaxed), to);
+    int8_t hop = -1, n;
+    bool two_hops = false;
 
-    if (msg == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for create virtual node message");
-        return ESP_FAIL;
+    // one hop: the neighbors right around the destination in the sorted table
+    n = neighbor_find_pos(to);
+    if (n != -1) {
+        *reached = to;
+        return n;
+    }
+    n = neighbor_nearest_predecessor(to);
+    if (n != -1 && distance(neighbors[n].position, to) < best) {
+        best = distance(neighbors[n].position, to);
+        *reached = neighbors[n].position;
+        hop = n;
+    }
+    n = neighbor_nearest_successor(to);
+    if (n != -1 && distance(neighbors[n].position, to) < best) {
+        best = distance(neighbors[n].position, to);
+        *reached = neighbors[n].position;
+        hop = n;
     }
 
-    memset(msg, 0, payload_length);
+    // two hops: the cord neighbors the neighbors advertised
+    for (int r = 0; r < neighbors_len; r++) {
+        n = neighbor_at(r);
+        if (neighbors[n].position == VCP_INITIAL) {
+            break;
+        }
+        if (neighbors[n].successor != VCP_INITIAL && distance(neighbors[n].successor, to) < best) {
+            best = distance(neighbors[n].successor, to);
+            *reached = neighbors[n].successor;
+            hop = n;
+            two_hops = true;
+        } else if (two_hops && neighbors[n].successor == *reached && better_link(n, hop)) {
+            hop = n;
+            (*ties)++;
+        }
+        if (neighbors[n].predecessor != VCP_INITIAL && distance(neighbors[n].predecessor, to) < best) {
+            best = distance(neighbors[n].predecessor, to);
+            *reached = neighbors[n].predecessor;
+            hop = n;
+            two_hops = true;
+        } else if (two_hops && neighbors[n].predecessor == *reached && better_link(n, hop)) {
+            hop = n;
+            (*ties)++;
+        }
+    }
+
+    return hop;
+}
+
+/* Returns whether the link to neighbor a is cheaper than the one to neighbor b */
+static bool better_link(int8_t a, int8_t b) {
+    return neighbor_link_cost(a) < neighbor_link_cost(b);
+}
+
+static vcp_position_t distance(vcp_position_t p1, vcp_position_t p2) {
+    return p1 > p2 ? p1 - p2 : p2 - p1;
+}
 
-    msg->type = VCP_CREATE_VIRTUAL_NODE;
-    ((float *)msg->args)[0] = vnode_position;
+/* Returns 0 if the two mac addresses are the same */
+static int cmp_mac_addr(uint8_t a1[ESP_NOW_ETH_ALEN], uint8_t a2[ESP_NOW_ETH_ALEN]) {
+    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++) {
+        if (a1[i] != a2[i]) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    return create_message(msg, sizeof(float), broadcast_mac);
+/* Returns the position in the middle between p1 and p2 (p1 < p2) or VCP_INITIAL if there is no free position left */
+static vcp_position_t position(vcp_position_t p1, vcp_position_t p2) {
+    if (p1 >= p2 || p2 - p1 < 2) {
+        return VCP_INITIAL;
+    }
+    return p1 + (p2 - p1) / 2;
 }
 
-/* Converts the vcp_message_data_t to esp_now_data_t in order to be processed by the sender_task */
-static esp_err_t create_message(vcp_message_data_t *msg, uint8_t args_length, uint8_t to[ESP_NOW_ETH_ALEN]) {
-    esp_now_data_t *sender_queue_data;
-    uint8_t payload_length = sizeof(esp_now_data_t);
+/* New position of the node at the end of the cord (VCP_START or VCP_END) when a joining node takes its place: VCP_INTERVAL
+ * away from its inner neighbor, or the middle of the gap if it is too small for that */
+static vcp_position_t end_position(vcp_position_t inner, vcp_position_t end) {
+    if (end > inner) {
+        return end - inner > 2 * VCP_INTERVAL ? inner + VCP_INTERVAL : position(inner, end);
+    }
+    return inner - end > 2 * VCP_INTERVAL ? inner - VCP_INTERVAL : position(end, inner);
+}
 
-    sender_queue_data = (esp_now_data_t *)malloc(payload_length);
+/*
+ * Local rebalancing: the gap between the neighbors j (predecessor) and i (successor) is smaller than VCP_MIN_GAP.
+ * One of them is moved into the middle of its other gap, whichever is larger, which adds half of that gap to the gap
+ * between j and i. The new positions are only stored in low (of j) and high (of i), the caller writes them into the
+ * table if the node joins in the gap, the neighbor learns its new position from the update message sent to it anyway.
+ */
+static void widen_gap(int8_t j, int8_t i, vcp_position_t *low, vcp_position_t *high) {
+    vcp_position_t below = 0, above = 0, moved;
 
-    if (sender_queue_data == NULL) {
-        ESP_LOGE(TAGS.send_tag, "Could not allocate memory for sender queue message");
-        return ESP_FAIL;
+    // the ends of the cord never move, they are found by their position
+    if (neighbors[j].position != VCP_START && neighbors[j].predecessor != VCP_INITIAL &&
+        neighbors[j].predecessor < neighbors[j].position) {
+        below = neighbors[j].position - neighbors[j].predecessor;
+    }
+    if (neighbors[i].position != VCP_END && neighbors[i].successor != VCP_INITIAL &&
+        neighbors[i].successor > neighbors[i].position) {
+        above = neighbors[i].successor - neighbors[i].position;
     }
 
-    sender_queue_data->payload_length = payload_length;
-    sender_queue_data->payload = msg;
+    if (below > 0 && below >= above) {
+        moved = position(neighbors[j].predecessor, neighbors[j].position);
+        if (moved != VCP_INITIAL) {
+            *low = moved;
+        }
+    } else if (above > 0) {
+        moved = position(neighbors[i].position, neighbors[i].successor);
+        if (moved != VCP_INITIAL) {
+            *high = moved;
+        }
+    }
+}
 
-    if (cmp_mac_addr(to, broadcast_mac) == 0) {
-        sender_queue_data->transmit_type = TRANSMIT_TYPE_BROADCAST;
+/* Removes the neighbors the timing wheel found silent for VCP_NEIGHBOR_TIMEOUT */
+static void expire_neighbors() {
+    int8_t expired[VCP_MAX_NEIGHBORS];
+    vcp_position_t lost[VCP_MAX_NEIGHBORS];
+    uint8_t lost_mac[VCP_MAX_NEIGHBORS][ESP_NOW_ETH_ALEN];
+    uint8_t count;
+
+    table_write_begin();
+    count = neighbor_expire(expired);
+    for (uint8_t i = 0; i < count; i++) {
+        lost[i] = neighbors[expired[i]].position;
+        memcpy(lost_mac[i], neighbors[expired[i]].mac_addr, ESP_NOW_ETH_ALEN);
+        remove_neighbor(expired[i]);
+    }
+    table_write_end();
+
+    // logging and the lock of the ESP-NOW peer list would keep the vcp task waiting for the end of the write
+    for (uint8_t i = 0; i < count; i++) {
+        ESP_LOGI(TAGS.receive_tag, "Neighbor %d at position %" PRIu32 " timed out, removed it", expired[i], lost[i]);
+        peer_forget(lost_mac[i]);
+    }
+}
+
+/*
+ * Removes neighbor n together with everything that refers to it: cached routes and, in the vcp task, the link state
+ * with its queued frames. A lost cord neighbor is replaced by the neighbor on the other side of it, if that one lost
+ * n as its cord neighbor too (it advertised n's position), otherwise greedy routing goes around the gap. The caller
+ * forgets the ESP-NOW peer.
+ */
+static void remove_neighbor(int8_t n) {
+    vcp_position_t lost = neighbors[n].position;
+    vcp_link_request_t forget = {.forget = n};
+    int8_t other;
+
+    routes_changed();
+    memcpy(forget.mac_addr, neighbors[n].mac_addr, ESP_NOW_ETH_ALEN);
+    to_vcp_task(&forget);
+    for (int v = 0; v < virtual_nodes_len; v++) {
+        virtual_nodes[v].i_successor = virtual_nodes[v].i_successor == n ? -1 : virtual_nodes[v].i_successor;
+        virtual_nodes[v].i_predecessor = virtual_nodes[v].i_predecessor == n ? -1 : virtual_nodes[v].i_predecessor;
+    }
+    neighbor_remove(n);
+
+    if (n == i_successor) {
+        other = neighbor_nearest_successor(own_position);
+        i_successor = -1;
+        if (other != -1 && lost != VCP_INITIAL && neighbors[other].predecessor == lost) {
+            i_successor = other;
+            new_update_message(VCP_UPDATE_PREDECESSOR, neighbors[other].mac_addr, neighbors[other].position);
+        }
+    }
+    if (n == i_predecessor) {
+        other = neighbor_nearest_predecessor(own_position);
+        i_predecessor = -1;
+        if (other != -1 && lost != VCP_INITIAL && neighbors[other].successor == lost) {
+            i_predecessor = other;
+            new_update_message(VCP_UPDATE_SUCCESSOR, neighbors[other].mac_addr, neighbors[other].position);
+        }
+    }
+    // the neighbors learn the new cord neighbors soon
+    hello_reset();
+}
+
+/* ------------------------------------------- Sharing the neighbor table ------------------------------------------- */
+
+/*
+ * The neighbor table, own_position, i_successor, i_predecessor and the virtual nodes are written by the control task
+ * only, the vcp task asks it to add the sender of the first sequenced frame of a new neighbor (add_neighbor_later).
+ * The control task takes table_lock and makes table_seq odd while it writes. The vcp task never takes a lock, it reads
+ * like a sequence lock: it reads table_seq, reads what it needs into local variables and starts over if table_seq was
+ * odd or changed in between. So the reads in such a loop must not change anything and must stay within their arrays
+ * whatever they read. The vcp task writes last_heard, an atomic millisecond stamp the control task reads for the
+ * expiry, and the link estimate, which only the vcp task reads.
+ * own_position is atomic as it is also needed outside of such a loop: there the vcp task loads it once per message, so
+ * a message is handled with one position, the one before or the one after a change of the control task.
+ * An index read like this may be taken over by another neighbor before it is used, the link layer notices that by
+ * the MAC address and the route cache is dropped (route_epoch) whenever a neighbor is removed.
+ */
+static void table_write_begin() {
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    atomic_fetch_add_explicit(&table_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void table_write_end() {
+    atomic_fetch_add_explicit(&table_seq, 1, memory_order_release);
+    xSemaphoreGive(table_lock);
+}
+
+/* Returns the sequence to pass to table_read_retry, waits while a write is in progress (on the other core) */
+static uint32_t table_read_begin() {
+    uint32_t seq;
+
+    while ((seq = (uint32_t)atomic_load_explicit(&table_seq, memory_order_acquire)) & 1) {
+    }
+    return seq;
+}
+
+/* Returns true if the table changed since table_read_begin returned seq, everything read since then is discarded */
+static bool table_read_retry(uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return (uint32_t)atomic_load_explicit(&table_seq, memory_order_relaxed) != seq;
+}
+
+/* neighbor_find_addr for the vcp task */
+static int8_t table_find_addr(const uint8_t mac_addr[ESP_NOW_ETH_ALEN]) {
+    uint32_t seq;
+    int8_t n;
+
+    do {
+        seq = table_read_begin();
+        n = neighbor_find_addr(mac_addr);
+    } while (table_read_retry(seq));
+    return n;
+}
+
+/* Records a frame received from mac_addr with rssi: the neighbor is still there and its link estimate gets the RSSI.
+ * The index and the old estimate are read together, so the estimate only changes if the slot still belongs to
+ * mac_addr (see neighbor_rssi) */
+static void table_heard(const uint8_t mac_addr[ESP_NOW_ETH_ALEN], int8_t rssi) {
+    uint32_t seq;
+    int16_t old = 0;
+    int8_t n;
+
+    do {
+        seq = table_read_begin();
+        n = neighbor_find_addr(mac_addr);
+        if (n != -1) {
+            old = atomic_load_explicit(&neighbors[n].rssi, memory_order_relaxed);
+        }
+    } while (table_read_retry(seq));
+    if (n != -1) {
+        neighbor_heard(n);
+        neighbor_rssi(n, old, rssi);
+    }
+}
+
+/* Feeds the send status of a unicast to mac_addr into the delivery ratio of the neighbor, like table_heard */
+static void table_send_status(const uint8_t mac_addr[ESP_NOW_ETH_ALEN], bool delivered) {
+    uint32_t seq;
+    uint16_t old = 0;
+    int8_t n;
+
+    do {
+        seq = table_read_begin();
+        n = neighbor_find_addr(mac_addr);
+        if (n != -1) {
+            old = atomic_load_explicit(&neighbors[n].delivery, memory_order_relaxed);
+        }
+    } while (table_read_retry(seq));
+    if (n != -1) {
+        neighbor_send_status(n, old, delivered);
+    }
+}
+
+/* Returns true if the neighbor table has no room for another neighbor */
+static bool table_full() {
+    uint32_t seq;
+    bool full;
+
+    do {
+        seq = table_read_begin();
+        full = neighbors_len == VCP_MAX_NEIGHBORS;
+    } while (table_read_retry(seq));
+    return full;
+}
+
+/* Called by the control task while it writes, whenever routes the vcp task cached may be wrong now */
+static void routes_changed() {
+    atomic_fetch_add_explicit(&route_epoch, 1, memory_order_relaxed);
+}
+
+/* ----------------------------------------------- Trickle hello timer ----------------------------------------------- */
+
+/* Starts a new hello interval of hello_interval ms, the timer expires at the send point first, which is chosen at
+ * random in the second half of the interval */
+static void hello_start_interval() {
+    uint32_t t = hello_interval / 2 + esp_random() % (hello_interval / 2);
+
+    hello_heard = 0;
+    hello_sent_point = false;
+    hello_rest = hello_interval - t;
+    xTimerChangePeriod(hello_timer, pdMS_TO_TICKS(t) > 0 ? pdMS_TO_TICKS(t) : 1, 0);
+}
+
+/* Called on every inconsistency: the neighbors have to learn about it soon, so the shortest interval starts again. An
+ * interval of VCP_HELLO_IMIN whose HELLO is still to come is kept */
+static void hello_reset() {
+    if (own_position == VCP_INITIAL) {
+        // the timer belongs to the discovery, the first interval starts after joining
+        return;
+    }
+    hello_fresh = true;
+    if (hello_interval == VCP_HELLO_IMIN && !hello_sent_point) {
+        return;
+    }
+    hello_stats.resets++;
+    hello_interval = VCP_HELLO_IMIN;
+    hello_start_interval();
+}
+
+/* Called when the hello timer expired after joining: sends the HELLO at the send point unless it is redundant, and
+ * doubles the interval at its end */
+static void hello_expired() {
+    if (hello_sent_point) {
+        hello_interval = hello_interval * 2 > (VCP_HELLO_IMIN << VCP_HELLO_DOUBLINGS)
+                             ? (VCP_HELLO_IMIN << VCP_HELLO_DOUBLINGS)
+                             : hello_interval * 2;
+        hello_start_interval();
+        return;
+    }
+
+    if (hello_fresh || hello_heard < VCP_HELLO_REDUNDANCY || hello_suppressed >= VCP_HELLO_MAX_SUPPRESSED) {
+        hello_suppressed = 0;
+        if (new_hello_message() != ESP_OK) {
+            ESP_LOGE(TAGS.send_tag, "Could not create hello message");
+        }
     } else {
-        sender_queue_data->transmit_type = TRANSMIT_TYPE_UNICAST;
+        hello_suppressed++;
+        hello_stats.suppressed++;
     }
+    hello_fresh = false;
+    hello_sent_point = true;
+    xTimerChangePeriod(hello_timer, pdMS_TO_TICKS(hello_rest) > 0 ? pdMS_TO_TICKS(hello_rest) : 1, 0);
+}
 
-    memcpy(sender_queue_data->mac_addr, to, ESP_NOW_ETH_ALEN);
-    return to_sender_queue(sender_queue_data);
+/* Copies the hello counters of this node */
+void vcp_get_hello_stats(vcp_hello_stats_t *stats) {
+    *stats = hello_stats;
 }
 
-/* Grabs the esp_now_data_t pointer and pushes it to the sender_queue */
-static esp_err_t to_sender_queue(esp_now_data_t *esp_now_data) {
+/* ----------------------------------------------- Route cache ----------------------------------------------- */
 
-    if (xQueueSend(sender_queue, esp_now_data, portMAX_DELAY) != pdTRUE) {
-        ESP_LOGE(TAGS.send_tag, "Could not send hello message");
-        return ESP_FAIL;
+/*
+ * The route cache maps ranges of destination positions to next hops, so that forwarding to a destination seen before
+ * is a single lookup instead of a scan of the neighbor table. There are two kinds of entries:
+ * - greedy: the range of positions for which the greedy next hop reaches the same position, i.e. all positions which
+ *   are strictly closer to that position than to any other position reachable in one or two hops (or to this node)
+ * - reverse path: the single position of the source of a DATA message, routed back to the neighbor it came from
+ * A lookup returns the narrowest matching entry, so reverse paths win over greedy ranges.
+ * The cache belongs to the vcp task. Whenever the control task changes the own position, a position in the neighbor
+ * table or removes a neighbor, it moves route_epoch on and the vcp task drops all entries before its next lookup.
+ * That happens while the cord forms or repairs itself, the HELLOs of a settled cord change nothing.
+ */
+static void init_route_cache() {
+    for (int i = 0; i < VCP_ROUTE_CACHE_SIZE; i++) {
+        route_cache[i].i_next_hop = -1;
     }
+    route_clock = 0;
+    memset(&route_stats, 0, sizeof(route_stats));
+    atomic_store_explicit(&route_epoch, 0, memory_order_relaxed);
+    route_epoch_seen = 0;
+}
 
-    return ESP_OK;
+/* Returns the entry of the cached route for position to, or -1. Only reads the cache, so it can be called while the
+ * neighbor table is read, the caller marks the entry as used once the read succeeded */
+static int route_find(vcp_position_t to) {
+    int found = -1;
+
+    for (int i = 0; i < VCP_ROUTE_CACHE_SIZE; i++) {
+        vcp_route_data_t *e = &route_cache[i];
+        if (e->i_next_hop != -1 && e->low <= to && to <= e->high &&
+            (found == -1 || e->high - e->low < route_cache[found].high - route_cache[found].low)) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+/* Caches next hop n for the positions from low to high, replacing the least recently used entry if the cache is full.
+ * Returns false if exactly this route was cached already */
+static bool route_insert(vcp_position_t low, vcp_position_t high, int8_t n) {
+    vcp_route_data_t *e = NULL;
+
+    for (int i = 0; i < VCP_ROUTE_CACHE_SIZE; i++) {
+        vcp_route_data_t *c = &route_cache[i];
+        if (c->i_next_hop != -1 && c->low == low && c->high == high) {
+            e = c;
+            break;
+        }
+        if (e == NULL || (e->i_next_hop != -1 && (c->i_next_hop == -1 || c->last_used < e->last_used))) {
+            e = c;
+        }
+    }
+
+    e->last_used = ++route_clock;
+    if (e->i_next_hop == n && e->low == low && e->high == high) {
+        return false;
+    }
+    e->low = low;
+    e->high = high;
+    e->i_next_hop = n;
+    return true;
 }
 
-/* Searches for a specific neighbor given its position. Returns its position in the neighbors array or -1 if not found */
-static int8_t find_neighbor_pos(float p) {
-    for (int i = 0; i < neighbors_len; i++) {
-        if (neighbors[i].position == p) {
-            return i;
+/* Moves below and above to p if p is closer to reached from below or above, below == reached means none yet */
+static void route_bound(vcp_position_t p, vcp_position_t reached, vcp_position_t *below, vcp_position_t *above) {
+    if (p == VCP_INITIAL) {
+        return;
+    }
+    if (p < reached && (*below == reached || p > *below)) {
+        *below = p;
+    } else if (p > reached && (*above == reached || p < *above)) {
+        *above = p;
+    }
+}
+
+/* Range of destinations for which reached is the closest position reachable in one or two hops, see route cache */
+static void route_range(vcp_position_t reached, vcp_position_t *low, vcp_position_t *high) {
+    vcp_position_t below = reached, above = reached;
+    int8_t n;
+
+    route_bound(atomic_load_explicit(&own_position, memory_order_relaxed), reached, &below, &above);
+    for (int r = 0; r < neighbors_len; r++) {
+        n = neighbor_at(r);
+        if (neighbors[n].position == VCP_INITIAL) {
+            break;
         }
+        route_bound(neighbors[n].position, reached, &below, &above);
+        route_bound(neighbors[n].successor, reached, &below, &above);
+        route_bound(neighbors[n].predecessor, reached, &below, &above);
     }
 
-    return -1;
+    // positions in the middle between two candidates are as close to the other one and are left out
+    *low = below == reached ? VCP_START : reached - (reached - below - 1) / 2;
+    *high = above == reached ? VCP_END : reached + (above - reached - 1) / 2;
 }
 
-/* Searches for a specific neighbor given its mac address. Returns its position in the neighbors array or -1 if not found */
-static int8_t find_neighbor_addr(uint8_t addr[ESP_NOW_ETH_ALEN]) {
-    for (int i = 0; i < neighbors_len; i++) {
-        if (!cmp_mac_addr(neighbors[i].mac_addr, addr)) {
-            return i;
+/* Remembers that the node at position source is reached through the neighbor a DATA message was received from */
+static void route_learn(uint8_t from[ESP_NOW_ETH_ALEN], vcp_position_t source) {
+    uint32_t seq, epoch;
+    int8_t n;
+
+    do {
+        seq = table_read_begin();
+        epoch = (uint32_t)atomic_load_explicit(&route_epoch, memory_order_acquire);
+        n = -1;
+        // neighbors are found in the neighbor table anyway
+        if (source != VCP_INITIAL && source != atomic_load_explicit(&own_position, memory_order_relaxed) &&
+            neighbor_find_pos(source) == -1) {
+            n = neighbor_find_addr(from);
         }
+    } while (table_read_retry(seq));
+    route_sync(epoch);
+    if (n != -1 && route_insert(source, source, n)) {
+        route_stats.learned++;
     }
+}
 
-    return -1;
+/* Drops all entries if the control task changed the cord or the neighbor positions since the cache was filled, epoch
+ * is route_epoch as it was read together with the neighbor table */
+static void route_sync(uint32_t epoch) {
+    if (epoch != route_epoch_seen) {
+        route_flush();
+        route_epoch_seen = epoch;
+    }
 }
 
-/* Returns 0 if the two mac addresses are the same */
-static int cmp_mac_addr(uint8_t a1[ESP_NOW_ETH_ALEN], uint8_t a2[ESP_NOW_ETH_ALEN]) {
-    for (int i = 0; i < ESP_NOW_ETH_ALEN; i++) {
-        if (a1[i] != a2[i]) {
-            return -1;
+static void route_flush() {
+    for (int i = 0; i < VCP_ROUTE_CACHE_SIZE; i++) {
+        if (route_cache[i].i_next_hop != -1) {
+            route_cache[i].i_next_hop = -1;
+            route_stats.invalidated++;
         }
     }
-    return 0;
 }
 
-/* Returns a new position between p1 and p2 */
-static float position(float p1, float p2) {
-    return (p1 + p2) / 2;
-    // TODO rewrite using VCP_INTERVAL to avoid float hell
+/* Copies the route cache counters of this node */
+void vcp_get_route_cache_stats(vcp_route_cache_stats_t *stats) {
+    *stats = route_stats;
 }
 
 void init_vcp(void) {
-    xTaskCreate(vcp_task, "vcp_state_machine", 4096, NULL, 4, NULL);
+    // the state both tasks share is set up before they exist
+    own_position = VCP_INITIAL;
+    i_successor = -1;
+    i_predecessor = -1;
+    init_neighbor_table();
+    init_route_cache();
+    init_link_layer();
+    esp_wifi_get_mac(ESPNOW_WIFI_IF, own_mac);
+    virtual_nodes_len = 0;
+    hello_interval = 0;
+    memset(&hello_stats, 0, sizeof(hello_stats));
+    atomic_store_explicit(&table_seq, 0, memory_order_relaxed);
+    table_lock = xSemaphoreCreateMutex();
+    control_queue = xQueueCreate(VCP_CONTROL_QUEUE_SIZE, sizeof(vcp_control_message_t));
+    link_requests = xQueueCreate(VCP_LINK_REQUEST_SIZE, sizeof(vcp_link_request_t));
+    if (table_lock == NULL || control_queue == NULL || link_requests == NULL) {
+        ESP_LOGE(TAGS.send_tag, "Error creating the queues between the control task and the vcp task");
+    }
+    // before the task exists, so that vcp_stream_send, vcp_metrics_request and vcp_data_send can be called once
+    // init_vcp returned
+    init_stream();
+    metrics_requests = xQueueCreate(VCP_METRICS_QUEUE_SIZE, sizeof(vcp_message_t));
+    data_requests = xQueueCreate(VCP_DATA_QUEUE_SIZE, sizeof(vcp_data_request_t));
+    if (metrics_requests == NULL || data_requests == NULL) {
+        ESP_LOGE(TAGS.send_tag, "Error creating metrics request or data queue");
+    }
+#if VCP_PERF
+    perf_requests = xQueueCreate(2, sizeof(vcp_perf_config_t));
+    perf_timer = xTimerCreate("vcp_perf", pdMS_TO_TICKS(VCP_PERF_TICK), pdTRUE, NULL, perf_timer_callback);
+    if (perf_requests == NULL || perf_timer == NULL) {
+        ESP_LOGE(TAGS.send_tag, "Error creating perf queue or timer");
+    }
+#endif
+    // the vcp task hands control messages over from its first frame on
+    xTaskCreatePinnedToCore(control_task, "vcp_control", 4096, NULL, VCP_CONTROL_PRIORITY, &control_task_handle,
+                            VCP_CONTROL_CORE);
+    metrics_watch_task(METRICS_TASK_CONTROL, control_task_handle);
+    xTaskCreatePinnedToCore(vcp_task, "vcp_state_machine", 4096, NULL, VCP_DATA_PRIORITY, &vcp_task_handle,
+                            VCP_DATA_CORE);
+    queue_consumer_task = vcp_task_handle;
+    metrics_watch_task(METRICS_TASK_VCP, vcp_task_handle);
+#if VCP_PERF
+    // the generator of a firmware built for one target, any node can be made a generator with vcp_perf_start
+    if (VCP_PERF_TARGET != VCP_INITIAL &&
+        vcp_perf_start(VCP_PERF_TARGET, VCP_PERF_RATE, VCP_PERF_PAYLOAD_LEN) != ESP_OK) {
+        ESP_LOGE(TAGS.send_tag, "Could not start the perf generator");
+    }
+#endif
+}
+
+/* -------------------------------------------- Metrics over the cord -------------------------------------------- */
+
+void vcp_metrics_register(vcp_metrics_cb_t on_metrics) {
+    metrics_cb = on_metrics;
+}
+
+/* Asks the node at position to for the bytes of its metrics snapshot from offset on, the answer goes to the callback
+ * of vcp_metrics_register. Can be called from any task, ESP_ERR_NO_MEM is returned if too many requests wait */
+esp_err_t vcp_metrics_request(vcp_position_t to, uint16_t offset) {
+    vcp_message_t request = {.type = VCP_METRICS_REQUEST};
+
+    request.data.recipient = to;
+    request.data.stream.index = offset;
+    if (metrics_requests == NULL || xQueueSend(metrics_requests, &request, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_METRICS, eSetBits);
+    return ESP_OK;
+}
+
+/* Sends the requests vcp_metrics_request queued, the own position is only known to the vcp task */
+static void send_metrics_requests() {
+    vcp_message_t request;
+
+    while (xQueueReceive(metrics_requests, &request, 0) == pdTRUE) {
+        request.data.source = atomic_load_explicit(&own_position, memory_order_relaxed);
+        if (vcp_route(&request) != ESP_OK) {
+            ESP_LOGE(TAGS.send_tag, "Could not send metrics request to %" PRIu32, request.data.recipient);
+        }
+    }
+}
+
+/* Answers a METRICS_REQUEST with the part of the snapshot from the requested offset on which fits into one frame */
+static void answer_metrics_request(const vcp_message_t *request) {
+    metrics_snapshot_t snapshot;
+    vcp_message_t answer = {.type = VCP_METRICS};
+    uint16_t offset = request->data.stream.index;
+
+    if (offset >= sizeof(snapshot)) {
+        ESP_LOGE(TAGS.receive_tag, "Metrics requested from offset %u of %zu bytes", offset, sizeof(snapshot));
+        return;
+    }
+    metrics_snapshot(&snapshot);
+    answer.data.recipient = request->data.source;
+    answer.data.source = atomic_load_explicit(&own_position, memory_order_relaxed);
+    answer.data.stream.index = offset;
+    answer.data.stream.total_len = sizeof(snapshot);
+    answer.data.payload = (const uint8_t *)&snapshot + offset;
+    answer.data.payload_len = sizeof(snapshot) - offset < VCP_METRICS_PAGE_LEN ? sizeof(snapshot) - offset
+                                                                               : VCP_METRICS_PAGE_LEN;
+    if (vcp_route(&answer) != ESP_OK) {
+        ESP_LOGE(TAGS.send_tag, "Could not answer metrics request of %" PRIu32, request->data.source);
+    }
+}
+
+/* --------------------------------------------------- DATA messages -------------------------------------------------- */
+
+void vcp_data_register(vcp_data_receive_cb_t on_data) {
+    data_cb = on_data;
+}
+
+/* Returns the payload of a DATA frame in a buffer of the packet pool, VCP_DATA_MAX_LEN bytes, or NULL if the pool is
+ * exhausted. Can be called from any task, never blocks */
+uint8_t *vcp_data_alloc(void) {
+    uint8_t *frame = packet_alloc();
+
+    return frame != NULL ? frame + VCP_DATA_HEADER_LEN : NULL;
+}
+
+/* Gives a buffer of vcp_data_alloc back which was not sent, NULL is ignored */
+void vcp_data_free(uint8_t *data) {
+    if (data != NULL) {
+        packet_free(data - VCP_DATA_HEADER_LEN);
+    }
+}
+
+/* Sends the first len bytes of data, a buffer of vcp_data_alloc, to position to with a latency budget of budget ms (0
+ * for none, at most VCP_DATA_MAX_BUDGET). Can be called from any task: the vcp task puts the header in front of the payload and routes the frame,
+ * ESP_ERR_NO_MEM is returned if too many messages wait for it */
+esp_err_t vcp_data_send(vcp_position_t to, uint8_t *data, uint8_t len, uint16_t budget) {
+    vcp_data_request_t request = {.to = to, .budget = budget, .payload_len = len};
+
+    if (data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > VCP_DATA_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (budget > VCP_DATA_MAX_BUDGET) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    request.frame = data - VCP_DATA_HEADER_LEN;
+    if (data_requests == NULL || xQueueSend(data_requests, &request, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_DATA, eSetBits);
+    return ESP_OK;
+}
+
+/* Sends the messages vcp_data_send queued in the buffers they were written into: the header is put in front of the
+ * payload and the frame goes to the link layer like a forwarded one. A message for the own position is delivered */
+static void send_data_requests() {
+    vcp_data_request_t request;
+    vcp_message_t msg = {.type = VCP_DATA};
+    esp_now_data_t frame;
+    esp_err_t err;
+
+    while (xQueueReceive(data_requests, &request, 0) == pdTRUE) {
+        msg.data.recipient = request.to;
+        msg.data.source = atomic_load_explicit(&own_position, memory_order_relaxed);
+        msg.data.budget = request.budget;
+        msg.data.payload = request.frame + VCP_DATA_HEADER_LEN;
+        msg.data.payload_len = request.payload_len;
+        frame.payload = request.frame;
+        err = vcp_encode(&msg, frame.payload, &frame.payload_length);
+        if (err == ESP_OK && request.to == msg.data.source) {
+            deliver(&msg);
+        } else if (err == ESP_OK) {
+            err = cut_through(&msg, &frame);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAGS.send_tag, "Could not send DATA message to %" PRIu32 ": %s", request.to, esp_err_to_name(err));
+        }
+        // NULL if the link layer took the frame over
+        packet_free(frame.payload);
+    }
+}
+
+/* Hands a DATA message for this node to the callback of vcp_data_register, perf messages are counted by the sink */
+static void deliver(const vcp_message_t *msg) {
+#if VCP_PERF
+    if (perf_receive(msg)) {
+        return;
+    }
+#endif
+    if (data_cb != NULL) {
+        data_cb(msg->data.source, msg->data.payload, msg->data.payload_len);
+    } else {
+        printf("Received data: %.*s\n", msg->data.payload_len, (const char *)msg->data.payload);
+    }
+}
+
+/* ---------------------------------------------------- Perf mode ---------------------------------------------------- */
+#if VCP_PERF
+
+/* Makes this node send DATA messages of payload_len bytes to position to, rate per second, replacing a generator which
+ * runs already. Can be called from any task, the generator waits until the node joined the cord */
+esp_err_t vcp_perf_start(vcp_position_t to, uint16_t rate, uint8_t payload_len) {
+    vcp_perf_config_t config = {.to = to, .rate = rate, .payload_len = payload_len};
+
+    if (rate == 0 || payload_len < sizeof(vcp_perf_header_t) || payload_len > VCP_PERF_MAX_PAYLOAD_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (perf_requests == NULL || xQueueSend(perf_requests, &config, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_PERF, eSetBits);
+    return ESP_OK;
+}
+
+/* Stops the generator of this node, can be called from any task */
+esp_err_t vcp_perf_stop(void) {
+    vcp_perf_config_t config = {.rate = 0};
+
+    if (perf_requests == NULL || xQueueSend(perf_requests, &config, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_PERF, eSetBits);
+    return ESP_OK;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Copies the counters of the generator and the sink of this node and computes loss, goodput and the latency
+ * percentiles. The sample is copied before it is sorted, the vcp task may replace a latency of it meanwhile */
+void vcp_perf_get_stats(vcp_perf_stats_t *stats) {
+    uint32_t n = perf_samples_seen < VCP_PERF_SAMPLES ? perf_samples_seen : VCP_PERF_SAMPLES;
+    uint32_t expected;
+
+    *stats = perf_stats;
+    stats->lost = 0;
+    stats->generators = 0;
+    for (int i = 0; i < VCP_PERF_SOURCES; i++) {
+        if (perf_sources[i].received > 0) {
+            expected = perf_sources[i].next_seq - perf_sources[i].first_seq;
+            // an end to end duplicate after a route change counts as received twice
+            stats->lost += expected > perf_sources[i].received ? expected - perf_sources[i].received : 0;
+            stats->generators++;
+        }
+    }
+    stats->goodput = perf_last_at > perf_first_at ? stats->bytes * 1000000 / (perf_last_at - perf_first_at) : 0;
+    memcpy(perf_sorted, perf_samples, n * sizeof(uint32_t));
+    qsort(perf_sorted, n, sizeof(uint32_t), cmp_u32);
+    // nearest rank
+    stats->latency_p50_us = n > 0 ? perf_sorted[(n + 1) / 2 - 1] : 0;
+    stats->latency_p99_us = n > 0 ? perf_sorted[(n * 99 + 99) / 100 - 1] : 0;
+}
+
+/* Wakes up the vcp task, called by the timer service task */
+static void perf_timer_callback(TimerHandle_t timer) {
+    xTaskNotify(vcp_task_handle, VCP_NOTIFY_PERF, eSetBits);
+}
+
+/* Applies the requests of vcp_perf_start and vcp_perf_stop, sends what is due and prints the statistics of the sink */
+static void perf_tick() {
+    vcp_perf_config_t config;
+    vcp_perf_stats_t stats;
+    int64_t now;
+
+    while (xQueueReceive(perf_requests, &config, 0) == pdTRUE) {
+        perf_config = config;
+        if (config.rate == 0) {
+            // the counters of the stopped generator stay readable
+            continue;
+        }
+        perf_generator = esp_random();
+        perf_started_at = esp_timer_get_time();
+        perf_attempted = 0;
+        perf_stats.generated = 0;
+        perf_stats.refused = 0;
+        if (xTimerIsTimerActive(perf_timer) == pdFALSE) {
+            xTimerStart(perf_timer, 0);
+        }
+    }
+    if (perf_config.rate > 0) {
+        perf_generate();
+    }
+
+    now = esp_timer_get_time();
+    if (perf_stats.received != perf_reported && now - perf_reported_at >= VCP_PERF_REPORT_PERIOD * 1000LL) {
+        vcp_perf_get_stats(&stats);
+        printf("Perf: received %" PRIu32 " messages from %" PRIu32 " generators, lost %" PRIu32 ", goodput %" PRIu32
+               " B/s, latency p50 %" PRIu32 " us, p99 %" PRIu32 " us, max %" PRIu32 " us\n",
+               stats.received, stats.generators, stats.lost, stats.goodput, stats.latency_p50_us, stats.latency_p99_us,
+               stats.latency_max_us);
+        perf_reported = stats.received;
+        perf_reported_at = now;
+    }
+}
+
+/* Routes the messages which became due since the last tick. A message the link layer cannot take is not sent later,
+ * the generator offers a fixed rate and counts what was refused */
+static void perf_generate() {
+    vcp_message_t msg = {.type = VCP_DATA};
+    vcp_perf_header_t header = {.generator = perf_generator};
+    int64_t now = esp_timer_get_time();
+    vcp_position_t self = atomic_load_explicit(&own_position, memory_order_relaxed);
+    uint32_t due;
+
+    if (self == VCP_INITIAL || self == perf_config.to) {
+        // the rate counts from the join on, nothing piles up before
+        perf_started_at = now;
+        perf_attempted = 0;
+        return;
+    }
+    due = (uint32_t)((now - perf_started_at) * perf_config.rate / 1000000) + 1;
+    msg.data.recipient = perf_config.to;
+    msg.data.source = self;
+    msg.data.payload = perf_payload;
+    msg.data.payload_len = perf_config.payload_len;
+    msg.data.perf = true;
+    while (perf_attempted < due) {
+        perf_attempted++;
+        header.seq = perf_stats.generated;
+        header.sent_at = esp_timer_get_time();
+        memcpy(perf_payload, &header, sizeof(header));
+        if (vcp_route(&msg) == ESP_OK) {
+            perf_stats.generated++;
+        } else {
+            perf_stats.refused++;
+        }
+    }
+}
+
+/* Counts a DATA message delivered to this node if it is a perf message (VCP_DATA_PERF_FLAG), returns false otherwise */
+static bool perf_receive(const vcp_message_t *msg) {
+    vcp_perf_header_t header;
+    vcp_perf_source_t *source = NULL;
+    int64_t now = esp_timer_get_time();
+    uint32_t latency, i;
+
+    if (!msg->data.perf || msg->data.payload_len < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, msg->data.payload, sizeof(header));
+
+    if (perf_stats.received == 0) {
+        perf_first_at = now;
+        perf_reported_at = now;
+        if (xTimerIsTimerActive(perf_timer) == pdFALSE) {
+            xTimerStart(perf_timer, 0);
+        }
+    }
+    perf_last_at = now;
+    perf_stats.received++;
+    perf_stats.bytes += msg->data.payload_len;
+
+    for (i = 0; i < VCP_PERF_SOURCES && source == NULL; i++) {
+        if (perf_sources[i].received == 0) {
+            source = &perf_sources[i];
+            source->generator = header.generator;
+            source->first_seq = header.seq;
+            source->next_seq = header.seq;
+        } else if (perf_sources[i].generator == header.generator) {
+            source = &perf_sources[i];
+        }
+    }
+    if (source != NULL) {
+        source->received++;
+        source->first_seq = header.seq < source->first_seq ? header.seq : source->first_seq;
+        source->next_seq = header.seq >= source->next_seq ? header.seq + 1 : source->next_seq;
+    }
+
+    latency = now <= header.sent_at ? 0 : now - header.sent_at > UINT32_MAX ? UINT32_MAX : now - header.sent_at;
+    perf_stats.latency_max_us = latency > perf_stats.latency_max_us ? latency : perf_stats.latency_max_us;
+    // reservoir sampling: every latency ends up in the sample with the same probability
+    if (perf_samples_seen < VCP_PERF_SAMPLES) {
+        perf_samples[perf_samples_seen] = latency;
+    } else {
+        i = esp_random() % (perf_samples_seen + 1);
+        if (i < VCP_PERF_SAMPLES) {
+            perf_samples[i] = latency;
+        }
+    }
+    perf_samples_seen++;
+    return true;
 }
+
+#endif